@@ -33,28 +33,585 @@
 #include "ib_m.h"
 #include "app.h"
 #include "vlarb.h"
+#include "profiler.h"
 #include <vec_file.h>
+#include <algorithm>
+#include <math.h>
 using namespace std;
 
 Define_Module(IBApp);
 
-void IBApp::parseIntListParam(const char *parName, std::vector<int> &out)
+std::vector<unsigned int> IBApp::hcaLids;
+unsigned int IBApp::traceActiveRanks = 0;
+std::vector<IBApp *> IBApp::barrierApps;
+bool IBApp::barrierStarted = false;
+unsigned int IBApp::barrierStage = 0;
+unsigned int IBApp::barrierExpected = 0;
+unsigned int IBApp::barrierArrived = 0;
+simtime_t IBApp::barrierStageStart;
+
+// a 32 bit mixing function used by the pattern permutations
+static unsigned int patternHash(unsigned int x)
+{
+  x ^= x >> 16;
+  x *= 0x85ebca6b;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35;
+  x ^= x >> 16;
+  return x;
+}
+
+// A keyed permutation of [0,n) computed independently by every HCA:
+// a 4 round Feistel network over the smallest even power of 2 >= n
+// walking the cycle until the result falls back into [0,n)
+unsigned int IBApp::permute(unsigned int x, unsigned int n,
+                            unsigned int phase, bool inverse)
+{
+  unsigned int halfBits = 1;
+  while ((1U << (2*halfBits)) < n) halfBits++;
+  unsigned int mask = (1U << halfBits) - 1;
+  unsigned int key = patternHash(dstSeed ^ patternHash(phase + 1));
+
+  do {
+    unsigned int l = x >> halfBits;
+    unsigned int r = x & mask;
+    for (int i = 0; i < 4; i++) {
+      unsigned int k = patternHash(key + (inverse ? 3 - i : i));
+      if (!inverse) {
+        unsigned int t = r;
+        r = l ^ (patternHash(r ^ k) & mask);
+        l = t;
+      } else {
+        unsigned int t = l;
+        l = r ^ (patternHash(l ^ k) & mask);
+        r = t;
+      }
+    }
+    x = (l << halfBits) | r;
+  } while (x >= n);
+  return x;
+}
+
+void IBApp::snapshotState(stateSnapshot &s)
+{
+  if ((msgDstMode == DST_TRACE) || barrier) {
+    opp_error("-E- %s the trace and barrier modes can not be snapshot",
+              getFullPath().c_str());
+  }
+  snap(s, dstSeqIdx);
+  snap(s, dstSeqDone);
+  snap(s, msgIdx);
+  snap(s, dstPhase);
+  snap(s, dstPhaseMsgIdx);
+  snap(s, patternDstLid);
+
+  snap(s, arrivalOnEnd);
+  snap(s, arrivalGapIdx);
+  snap(s, arrivalBacklog);
+  snap(s, arrivalOutstanding);
+  if (p_arrivalMsg)
+    s.timer(p_arrivalMsg);
+  snap(s, rpcOutstanding);
+}
+
+IBApp::~IBApp()
+{
+  // the LIDs table is rebuilt for the network of the next run
+  hcaLids.clear();
+  traceActiveRanks = 0;
+  barrierApps.clear();
+  barrierStarted = false;
+  barrierStage = 0;
+  barrierExpected = 0;
+  barrierArrived = 0;
+  if (p_traceResumeMsg) cancelAndDelete(p_traceResumeMsg);
+  if (p_barrierMsg) cancelAndDelete(p_barrierMsg);
+  if (p_arrivalMsg) cancelAndDelete(p_arrivalMsg);
+  while (!arrivalBacklog.empty()) {
+    delete arrivalBacklog.front();
+    arrivalBacklog.pop_front();
+  }
+}
+
+// rank the HCAs by LID and find our own rank
+void IBApp::initRank()
+{
+  if (hcaLids.empty()) {
+    cModule *p_sys = simulation.getSystemModule();
+    for (cModule::SubmoduleIterator iter(p_sys); !iter.end(); iter++) {
+      cModule *p_mod = iter();
+      if (p_mod->hasPar("srcLid"))
+        hcaLids.push_back((int)p_mod->par("srcLid"));
+    }
+    sort(hcaLids.begin(), hcaLids.end());
+  }
+
+  unsigned int srcLid = getParentModule()->par("srcLid");
+  vector<unsigned int>::iterator it =
+    lower_bound(hcaLids.begin(), hcaLids.end(), srcLid);
+  if ((it == hcaLids.end()) || (*it != srcLid))
+    opp_error("-E- %s fail to find own LID: %d among the HCAs",
+              getFullPath().c_str(), srcLid);
+  rank = it - hcaLids.begin();
+}
+
+// check the pattern fits the number of HCAs
+void IBApp::initPattern()
+{
+  initRank();
+  unsigned int n = hcaLids.size();
+  if (n < 2)
+    opp_error("-E- %s traffic patterns require at least 2 HCAs",
+              getFullPath().c_str());
+
+  dstShift = par("dstShift");
+  dstSeed = par("dstSeed");
+  dstPhaseMsgs = par("dstPhaseMsgs");
+  dstPhases = par("dstPhases");
+  if (!dstPhaseMsgs)
+    opp_error("-E- %s dstPhaseMsgs must be > 0", getFullPath().c_str());
+
+  switch (msgDstMode) {
+  case DST_SHIFT:
+    if (!(dstShift % n))
+      opp_error("-E- %s dstShift: %d is a multiple of the %d HCAs",
+                getFullPath().c_str(), dstShift, n);
+    break;
+  case DST_BIT_COMPLEMENT:
+  case DST_RECURSIVE_DOUBLING:
+    if (n & (n - 1))
+      opp_error("-E- %s dstMode: %s requires a power of 2 HCAs not: %d",
+                getFullPath().c_str(), (const char *)par("dstMode"), n);
+    break;
+  case DST_TRANSPOSE: {
+    unsigned int side = (unsigned int)(sqrt((double)n) + 0.5);
+    if (side * side != n)
+      opp_error("-E- %s dstMode: transpose requires a square number of HCAs"
+                " not: %d", getFullPath().c_str(), n);
+    break;
+  }
+  case DST_BISECTION:
+    if (n % 2)
+      opp_error("-E- %s dstMode: bisection requires an even number of HCAs"
+                " not: %d", getFullPath().c_str(), n);
+    break;
+  case DST_INCAST:
+    dstIncastLid = par("dstLid");
+    if (!binary_search(hcaLids.begin(), hcaLids.end(), dstIncastLid))
+      opp_error("-E- %s incast dstLid: %d is not an HCA LID",
+                getFullPath().c_str(), dstIncastLid);
+    break;
+  default:
+    break;
+  }
+
+  dstPhase = 0;
+  dstPhaseMsgIdx = 0;
+  patternDstLid = getPatternDstLid(0);
+  EV << "-I- " << getFullPath() << " rank: " << rank << " of " << n
+     << " HCAs first pattern DLID: " << patternDstLid << endl;
+}
+
+// the destination LID of the given phase - 0 if this HCA should not send
+unsigned int IBApp::getPatternDstLid(unsigned int phase)
+{
+  unsigned int n = hcaLids.size();
+  unsigned int dst;
+
+  switch (msgDstMode) {
+  case DST_SHIFT:
+    dst = (rank + dstShift) % n;
+    break;
+  case DST_BIT_COMPLEMENT:
+    dst = ~rank & (n - 1);
+    break;
+  case DST_TRANSPOSE: {
+    unsigned int side = (unsigned int)(sqrt((double)n) + 0.5);
+    dst = (rank % side) * side + rank / side;
+    break;
+  }
+  case DST_RAND_PERM:
+    // a random ring over all HCAs - never maps an HCA to itself
+    dst = permute((permute(rank, n, phase, false) + 1) % n, n, phase, true);
+    break;
+  case DST_RECURSIVE_DOUBLING: {
+    unsigned int log2n = 0;
+    while ((1U << log2n) < n) log2n++;
+    dst = rank ^ (1U << (phase % log2n));
+    break;
+  }
+  case DST_ALL_TO_ALL:
+    dst = (rank + 1 + phase % (n - 1)) % n;
+    break;
+  case DST_BISECTION: {
+    unsigned int half = n / 2;
+    if (rank < half)
+      dst = half + permute(rank, half, phase, false);
+    else
+      dst = permute(rank - half, half, phase, true);
+    break;
+  }
+  case DST_INCAST:
+    return (hcaLids[rank] == dstIncastLid) ? 0 : dstIncastLid;
+  default:
+    error("unsupported pattern msgDstMode: %d", msgDstMode);
+    return 0;
+  }
+  return (dst == rank) ? 0 : hcaLids[dst];
+}
+
+// open the trace of our rank
+void IBApp::initTrace()
+{
+  initRank();
+  traceOutstanding = 0;
+  traceWaitRecv = false;
+  traceCompleted = false;
+  traceLastRank = false;
+  traceSentMsgs = 0;
+  traceSentBytes = 0;
+  traceRecvMsgs = 0;
+  traceRecvWait = 0;
+  traceCompletionTime = 0;
+  p_traceResumeMsg = new cMessage("trace-resume");
+
+  // the file name may hold the rank as %d
+  const char *traceFilePar = par("traceFile");
+  char fileName[1024];
+  snprintf(fileName, sizeof(fileName), traceFilePar, rank);
+  if (trace.open(fileName, par("traceReadAhead"))) {
+    opp_error("-E- %s fail to read trace file: %s",
+              getFullPath().c_str(), fileName);
+  }
+  EV << "-I- " << getFullPath() << " rank: " << rank
+     << " replaying trace: " << fileName << endl;
+}
+
+// execute trace records until blocked by a send, compute or recv
+void IBApp::processTrace()
+{
+  while ((traceOutstanding < numQPs) && !p_traceResumeMsg->isScheduled()) {
+    const traceRecord *p_rec = trace.peek();
+    if (!p_rec) break;
+
+    if (p_rec->op == 's') {
+      if ((unsigned int)p_rec->peer >= hcaLids.size())
+        opp_error("-E- %s trace line: %d send to rank: %d out of %d HCAs",
+                  getFullPath().c_str(), p_rec->lineNum, p_rec->peer,
+                  hcaLids.size());
+      IBAppMsg *p_new = getNewMsg();
+      traceSentMsgs++;
+      traceSentBytes += p_new->getLenBytes();
+      send(p_new, "out$o");
+      traceOutstanding++;
+      EV << "-I- " << getFullPath() << " trace send "
+         << p_new->getName() << endl;
+    } else if (p_rec->op == 'c') {
+      scheduleAt(simTime() + p_rec->delay_ns*1e-9, p_traceResumeMsg);
+    } else {
+      // find the first received message matching source and tag
+      list<pair<int, int> >::iterator lI;
+      for (lI = traceUnexpected.begin(); lI != traceUnexpected.end(); lI++) {
+        if (((p_rec->peer < 0) || (p_rec->peer == (*lI).first)) &&
+            ((p_rec->tag < 0) || (p_rec->tag == (*lI).second)))
+          break;
+      }
+      if (lI == traceUnexpected.end()) {
+        if (!traceWaitRecv) {
+          traceWaitRecv = true;
+          traceWaitStart = simTime();
+        }
+        return;
+      }
+      traceUnexpected.erase(lI);
+      if (traceWaitRecv) {
+        traceWaitRecv = false;
+        traceRecvWait += simTime() - traceWaitStart;
+      }
+      traceRecvMsgs++;
+    }
+    trace.pop();
+  }
+
+  if (trace.bad())
+    opp_error("-E- %s fail to parse trace at line: %d",
+              getFullPath().c_str(), trace.getLineNum());
+
+  // done once the last send was consumed by the generator
+  if (!traceCompleted && !traceOutstanding &&
+      !p_traceResumeMsg->isScheduled() && !trace.peek()) {
+    traceCompleted = true;
+    traceCompletionTime = simTime();
+    EV << "-I- " << getFullPath() << " completed trace at: "
+       << simTime() << endl;
+    if (--traceActiveRanks == 0) {
+      traceLastRank = true;
+      EV << "-I- " << getFullPath() << " all traces completed at: "
+         << simTime() << endl;
+      endSimulation();
+    }
+  }
+}
+
+// number of messages this app sends in the next stage
+unsigned int IBApp::getStageMsgs()
+{
+  if (dstSeqDone)
+    return 0;
+  if (msgDstMode >= DST_SHIFT)
+    return patternDstLid ? dstPhaseMsgs - dstPhaseMsgIdx : 0;
+  return 1;
+}
+
+// start the next stage on all apps - ends the run if none has messages
+void IBApp::barrierRelease()
 {
-  int cnt = 0;
-  const char *str = par(parName);
-  char *tmpBuf = new char[strlen(str)+1];
-  strcpy(tmpBuf, str);
-  char *entStr = strtok(tmpBuf, " ,");
-  if (out.size()) out.clear();
-  while (entStr) {
-    cnt++;
-    out.push_back(atoi(entStr));
-    entStr = strtok(NULL, " ,");
+  barrierStageStart = simulation.getSimTime();
+  barrierExpected = 0;
+  barrierArrived = 0;
+  for (unsigned int i = 0; i < barrierApps.size(); i++)
+    barrierExpected += barrierApps[i]->startStage();
+
+  if (!barrierExpected) {
+    IBApp *p_leader = barrierApps[0];
+    EV << "-I- " << p_leader->getFullPath() << " collective completed "
+       << barrierStage << " stages at: " << p_leader->collectiveTime << endl;
+    p_leader->endSimulation();
   }
 }
 
+// schedule sending the stage messages - returns their number
+unsigned int IBApp::startStage()
+{
+  Enter_Method_Silent();
+  barrierStageMsgs = getStageMsgs();
+  if (barrierStageMsgs)
+    scheduleAt(simTime(), p_barrierMsg);
+  return barrierStageMsgs;
+}
+
+void IBApp::msgReceived(unsigned int srcLid, int tag, int rpcType,
+                        int stage)
+{
+  if (rpcType == IB_RPC_REQUEST) {
+    if (!rpcServer)
+      return;
+    // reply to the requester with the same tag after the service time
+    Enter_Method_Silent();
+    unsigned int replyLen = par("rpcReplyLength");
+    IBAppMsg *p_reply = newAppMsg(srcLid, replyLen ? replyLen : 1, tag);
+    p_reply->setRpcType(IB_RPC_REPLY);
+    double delay_ns = par("rpcServiceTime");
+    sendDelayed(p_reply, delay_ns*1e-9, "out$o");
+    EV << "-I- " << getFullPath() << " replying to request: " << tag
+       << " from: " << srcLid << endl;
+    return;
+  }
+
+  if (rpcType == IB_RPC_REPLY) {
+    Enter_Method_Silent();
+    map<int, simtime_t>::iterator rI = rpcOutstanding.find(tag);
+    if (rI == rpcOutstanding.end())
+      opp_error("-E- %s received reply: %d from: %d with no request",
+                getFullPath().c_str(), tag, srcLid);
+    double latency = (simTime() - (*rI).second).dbl();
+    rpcOutstanding.erase(rI);
+    rpcLatencies.push_back(latency);
+    rpcLatencyStats.collect(latency);
+
+    // the QP of the request is free after the think time
+    double delay_ns = par("rpcThinkTime");
+    scheduleAt(simTime() + delay_ns*1e-9, new cMessage);
+    return;
+  }
+
+  // only messages sent by the barrier stages count for the barrier
+  if (barrierStarted && (stage >= 0)) {
+    if ((unsigned int)stage != barrierStage)
+      opp_error("-E- %s received stage: %d message during stage: %d",
+                getFullPath().c_str(), stage, barrierStage);
+    if (++barrierArrived == barrierExpected) {
+      // the stage is complete - the first app tracks the stage times
+      IBApp *p_leader = barrierApps[0];
+      simtime_t stageTime = simTime() - barrierStageStart;
+      p_leader->stageTimeVec.recordWithTimestamp(barrierStageStart, stageTime);
+      p_leader->stageTimeStats.collect(stageTime);
+      p_leader->collectiveTime = simTime();
+      EV << "-I- " << getFullPath() << " completed collective stage: "
+         << barrierStage << " in: " << stageTime << endl;
+      barrierStage++;
+      barrierRelease();
+    }
+  }
+
+  if (msgDstMode != DST_TRACE)
+    return;
+
+  Enter_Method_Silent();
+  vector<unsigned int>::iterator it =
+    lower_bound(hcaLids.begin(), hcaLids.end(), srcLid);
+  if ((it == hcaLids.end()) || (*it != srcLid))
+    opp_error("-E- %s received a message from unknown LID: %d",
+              getFullPath().c_str(), srcLid);
+  traceUnexpected.push_back(pair<int, int>(it - hcaLids.begin(), tag));
+
+  if (traceWaitRecv && !p_traceResumeMsg->isScheduled())
+    scheduleAt(simTime(), p_traceResumeMsg);
+}
+
+// compute the arrival rates from the offered load and the link rate
+void IBApp::initArrivals()
+{
+  const char *arrivalModePar = par("arrivalMode");
+  if (!strcmp(arrivalModePar, "done")) {
+    arrivalMode = ARRIVAL_DONE;
+  } else if (!strcmp(arrivalModePar, "poisson")) {
+    arrivalMode = ARRIVAL_POISSON;
+  } else if (!strcmp(arrivalModePar, "onoff")) {
+    arrivalMode = ARRIVAL_ONOFF;
+  } else if (!strcmp(arrivalModePar, "trace")) {
+    arrivalMode = ARRIVAL_TRACE;
+  } else {
+    opp_error("unknown arrivalMode: %s", arrivalModePar);
+  }
+
+  numArrivals = 0;
+  numOverflows = 0;
+  arrivalOutstanding = 0;
+  backlogWaitStats.setName("App-Backlog-Wait");
+  if (arrivalMode == ARRIVAL_DONE)
+    return;
+
+  if ((msgDstMode == DST_TRACE) || barrier || rpcClient)
+    opp_error("-E- %s arrivalMode: %s does not support trace, barrier or"
+              " rpcClient", getFullPath().c_str(), arrivalModePar);
+
+  // the link rate in bits per second
+  double linkRate = (double)par("arrivalLinkRate") * 1e9;
+  if (linkRate <= 0) {
+    cChannel *p_ch =
+      getParentModule()->gate("port$o")->getTransmissionChannel();
+    cDatarateChannel *p_wire = dynamic_cast<cDatarateChannel *>(p_ch);
+    if (!p_wire)
+      opp_error("-E- %s fail to find the HCA port wire data rate",
+                getFullPath().c_str());
+    linkRate = p_wire->getDatarate();
+  }
+
+  // the mean message length - param lengths are averaged over samples
+  double meanLen_B;
+  if (p_msgLenDist) {
+    meanLen_B = p_msgLenDist->getMean();
+  } else {
+    meanLen_B = 0;
+    for (int i = 0; i < 1000; i++)
+      meanLen_B += (int)par("msgLength");
+    meanLen_B /= 1000;
+  }
+
+  double load = par("arrivalLoad");
+  if ((load <= 0) && (arrivalMode != ARRIVAL_TRACE))
+    opp_error("-E- %s arrivalLoad must be > 0", getFullPath().c_str());
+  arrivalMeanGap_s = (load > 0) ? meanLen_B * 8 / (load * linkRate) : 0;
+
+  if (arrivalMode == ARRIVAL_ONOFF) {
+    arrivalOnTime_s = (double)par("arrivalOnTime") * 1e-9;
+    arrivalOffTime_s = (double)par("arrivalOffTime") * 1e-9;
+    if (arrivalOnTime_s <= 0)
+      opp_error("-E- %s arrivalOnTime must be > 0", getFullPath().c_str());
+    // denser arrivals in the on periods keep the mean load
+    arrivalOnGap_s = arrivalMeanGap_s * arrivalOnTime_s /
+      (arrivalOnTime_s + arrivalOffTime_s);
+    arrivalOnEnd = simTime() + exponential(arrivalOnTime_s);
+  } else if (arrivalMode == ARRIVAL_TRACE) {
+    const char *arrivalVecFile = par("arrivalVecFile");
+    int arrivalVecIdx = par("arrivalVecIdx");
+    arrivalGaps = vecFiles::get()->getFloatVec(arrivalVecFile, arrivalVecIdx);
+    if (!arrivalGaps || arrivalGaps->empty())
+      opp_error("-E- %s fail to obtain arrival times vector: %s/%d",
+                getFullPath().c_str(), arrivalVecFile, arrivalVecIdx);
+    double sum = 0;
+    for (unsigned int i = 0; i < arrivalGaps->size(); i++)
+      sum += (*arrivalGaps)[i];
+    double traceMeanGap_s = sum * 1e-9 / arrivalGaps->size();
+    arrivalGapScale = ((load > 0) && (traceMeanGap_s > 0)) ?
+      arrivalMeanGap_s / traceMeanGap_s : 1.0;
+    arrivalGapIdx = 0;
+  }
+
+  arrivalBacklogSize = par("arrivalBacklog");
+  p_arrivalMsg = new cMessage("arrival");
+  EV << "-I- " << getFullPath() << " " << arrivalModePar
+     << " arrivals of mean length: " << meanLen_B << "B every: "
+     << arrivalMeanGap_s * 1e9 << "ns on link of: " << linkRate / 1e9
+     << "Gbps" << endl;
+}
+
+// the time to the next arrival by the arrival mode
+double IBApp::getNextArrivalGap()
+{
+  switch (arrivalMode) {
+  case ARRIVAL_POISSON:
+    return exponential(arrivalMeanGap_s);
+  case ARRIVAL_ONOFF: {
+    // arrivals beyond the on period end move to the next on period
+    simtime_t t = simTime();
+    for (;;) {
+      double gap = exponential(arrivalOnGap_s);
+      if (t + gap <= arrivalOnEnd)
+        return (t + gap - simTime()).dbl();
+      t = arrivalOnEnd + exponential(arrivalOffTime_s);
+      arrivalOnEnd = t + exponential(arrivalOnTime_s);
+    }
+  }
+  case ARRIVAL_TRACE: {
+    double gap_ns = (*arrivalGaps)[arrivalGapIdx++];
+    if (arrivalGapIdx == arrivalGaps->size())
+      arrivalGapIdx = 0;
+    return gap_ns * 1e-9 * arrivalGapScale;
+  }
+  default:
+    error("unsupported arrivalMode: %d", arrivalMode);
+    return 0;
+  }
+}
+
+// give the message to the generator
+void IBApp::sendAppMsg(IBAppMsg *p_msg)
+{
+  arrivalOutstanding++;
+  backlogWaitStats.collect(simTime() - p_msg->getTimestamp());
+  send(p_msg, "out$o");
+  EV << "-I- " << getFullPath() << " sending new app message "
+     << p_msg->getName() << endl;
+}
+
+// a new message arrived - send, backlog or drop it
+void IBApp::handleArrival()
+{
+  if (dstSeqDone)
+    return;
+
+  IBAppMsg *p_new = getNewMsg();
+  p_new->setTimestamp(simTime());
+  numArrivals++;
+  if (arrivalOutstanding < numQPs) {
+    sendAppMsg(p_new);
+  } else if (arrivalBacklog.size() < arrivalBacklogSize) {
+    arrivalBacklog.push_back(p_new);
+  } else {
+    EV << "-I- " << getFullPath() << " dropping arrived message "
+       << p_new->getName() << " on full backlog" << endl;
+    numOverflows++;
+    delete p_new;
+  }
+
+  scheduleAt(simTime() + getNextArrivalGap(), p_arrivalMsg);
+}
+
 // main init of the module
 void IBApp::initialize(){
+  IB_PROF_CALL("IBApp::initialize");
   // init destination sequence related params
   dstSeqIdx = 0;
   dstSeqDone = 0;
@@ -70,16 +627,41 @@ void IBApp::initialize(){
     msgDstMode = DST_SEQ_LOOP;
   } else if (!strcmp(dstModePar, "seq_rand")) {
     msgDstMode = DST_SEQ_RAND;
+  } else if (!strcmp(dstModePar, "trace")) {
+    msgDstMode = DST_TRACE;
+  } else if (!strcmp(dstModePar, "shift")) {
+    msgDstMode = DST_SHIFT;
+  } else if (!strcmp(dstModePar, "bit_complement")) {
+    msgDstMode = DST_BIT_COMPLEMENT;
+  } else if (!strcmp(dstModePar, "transpose")) {
+    msgDstMode = DST_TRANSPOSE;
+  } else if (!strcmp(dstModePar, "rand_perm")) {
+    msgDstMode = DST_RAND_PERM;
+  } else if (!strcmp(dstModePar, "recursive_doubling")) {
+    msgDstMode = DST_RECURSIVE_DOUBLING;
+  } else if (!strcmp(dstModePar, "all_to_all")) {
+    msgDstMode = DST_ALL_TO_ALL;
+  } else if (!strcmp(dstModePar, "bisection")) {
+    msgDstMode = DST_BISECTION;
+  } else if (!strcmp(dstModePar, "incast")) {
+    msgDstMode = DST_INCAST;
   } else {
     error("unknown dstMode: %s", dstModePar);
   }
 
   // destination related parameters
-  if (msgDstMode != DST_PARAM) {
+  if (msgDstMode >= DST_SHIFT) {
+    initPattern();
+  } else if (msgDstMode == DST_TRACE) {
+    initTrace();
+  } else if (msgDstMode != DST_PARAM) {
     const char *dstSeqVecFile = par("dstSeqVecFile");
     const int   dstSeqVecIdx  = par("dstSeqVecIdx");
     vecFiles   *vecMgr = vecFiles::get();
-    dstSeq = vecMgr->getIntVec(dstSeqVecFile, dstSeqVecIdx);
+    {
+      IB_PROF_CALL("vecFiles::getIntVec");
+      dstSeq = vecMgr->getIntVec(dstSeqVecFile, dstSeqVecIdx);
+    }
     if (dstSeq == NULL) {
             opp_error("fail to obtain dstSeq vector: %s/%d",
                                dstSeqVecFile, dstSeqVecIdx);
@@ -95,52 +677,106 @@ void IBApp::initialize(){
     msgLenMode = MSG_LEN_PARAM;
   } else if (!strcmp(msgLenModePar,"set")) {
     msgLenMode = MSG_LEN_SET;
+  } else if (!strcmp(msgLenModePar,"cdf")) {
+    msgLenMode = MSG_LEN_CDF;
   } else {
-    opp_error("unknown msgLenMode: %s", msgLenMode);
+    opp_error("unknown msgLenMode: %s", msgLenModePar);
   }
 
-  // need to init the set...
+  // build the alias table of the length distribution
+  p_msgLenDist = NULL;
   if (msgLenMode == MSG_LEN_SET) {
-    parseIntListParam("msgLenSet", msgLenSet);
-    vector<int> msgLenProbVec;
-    parseIntListParam("msgLenProb", msgLenProbVec);
-
-    if (msgLenSet.size() != msgLenProbVec.size()) {
-      error("provided msgLenSet size: %d != msgLenProb size: %d",
-            msgLenSet.size(), msgLenProbVec.size());
+    if (msgLenSet.parseSet(par("msgLenSet").stdstringValue(),
+                           par("msgLenProb").stdstringValue())) {
+      error("bad msgLenSet/msgLenProb: %s", msgLenSet.getError().c_str());
     }
+    p_msgLenDist = &msgLenSet;
+  } else if (msgLenMode == MSG_LEN_CDF) {
+    const char *msgLenFile = par("msgLenFile");
+    p_msgLenDist = sizeDists::get()->getCdf(msgLenFile,
+                                            par("msgLenCdfContinuous"));
+    if (!p_msgLenDist)
+      opp_error("-E- %s fail to parse msgLenFile: %s",
+                getFullPath().c_str(), msgLenFile);
+  }
 
-    // convert the given probabilities into a histogram
-    // with Prob[idx] where idx is the index of the length in the vector
-    msgLenProb.setNumCells(msgLenSet.size());
-    msgLenProb.setRange(0,msgLenSet.size()-1);
-    // HACK: there must be a faster way to do this!
-    for (unsigned int i = 0; i < msgLenProbVec.size(); i++)
-      for (int p = 0; p < msgLenProbVec[i]; p++)
-        msgLenProb.collect(i);
-
-    EV << "-I- Defined Length Set of " << msgLenSet.size() << " size" << endl;
+  if (p_msgLenDist) {
+    EV << "-I- Defined Length distribution of "
+       << p_msgLenDist->getNumBuckets() << " buckets with mean: "
+       << p_msgLenDist->getMean() << "B" << endl;
   }
 
   seqIdxVec.setName("Dst-Sequence-Index");
 
+  numQPs = par("numQPs");
+  if (!numQPs)
+    opp_error("-E- %s numQPs must be > 0", getFullPath().c_str());
+
+  rpcClient = par("rpcClient");
+  rpcServer = par("rpcServer");
+  rpcLatencyStats.setName("RPC-Response-Time");
+  if (rpcClient &&
+      ((msgDstMode == DST_TRACE) || (bool)par("barrier")))
+    opp_error("-E- %s rpcClient does not support trace or barrier modes",
+              getFullPath().c_str());
+
+  barrier = par("barrier");
+  initArrivals();
+  if (barrier && !disable) {
+    if ((msgDstMode == DST_PARAM) || (msgDstMode == DST_TRACE))
+      opp_error("-E- %s barrier requires a seq_* or pattern dstMode",
+                getFullPath().c_str());
+    // the first app releases the first stage once all registered
+    p_barrierMsg = new cMessage("barrier");
+    if (barrierApps.empty()) {
+      stageTimeVec.setName("Collective-Stage-Time");
+      stageTimeStats.setName("Collective-Stage-Time");
+      collectiveTime = 0;
+      scheduleAt(simTime(), p_barrierMsg);
+    }
+    barrierApps.push_back(this);
+    return;
+  }
+
+  if (arrivalMode != ARRIVAL_DONE) {
+    // the first arrival is at a random time like any other
+    if (!disable && ((msgDstMode < DST_SHIFT) || patternDstLid) &&
+        ((msgDstMode != DST_PARAM) || (int)par("dstLid")))
+      scheduleAt(simTime() + getNextArrivalGap(), p_arrivalMsg);
+    return;
+  }
+
+  // each QP starts with its own emulated "done"
+  unsigned int numStarts = numQPs;
+
   // if we are in param mode we may be getting a 0 as DST and thus keep quite
   if (msgDstMode == DST_PARAM) {
 	  int dstLid = par("dstLid");
-	  if (dstLid)
-		  scheduleAt(simTime(), new cMessage);
-  } else {
-	  // Emulate a "done"
-	  scheduleAt(simTime(), new cMessage);
+	  if (!dstLid)
+		  numStarts = 0;
+  } else if (msgDstMode >= DST_SHIFT) {
+	  // patterns that do not use this HCA keep it quiet
+	  if (!patternDstLid)
+		  numStarts = 0;
+  } else if (msgDstMode == DST_TRACE) {
+	  numStarts = 0;
+	  if (!disable) {
+		  traceActiveRanks++;
+		  scheduleAt(simTime(), p_traceResumeMsg);
+	  }
   }
+  for (unsigned int i = 0; i < numStarts; i++)
+	  scheduleAt(simTime(), new cMessage);
 
 }
 
-// get random msg len by the histogram
+// get random msg len by the alias table
 unsigned int IBApp::getMsgLenByDistribution()
 {
- double r = msgLenProb.random();
- return int(r);
+  double u1 = uniform(0,1);
+  double u2 = uniform(0,1);
+  unsigned int len = p_msgLenDist->sample(u1, u2);
+  return len ? len : 1;
 }
 
 // Initialize the parameters for a new message by sampling the
@@ -148,21 +784,24 @@ unsigned int IBApp::getMsgLenByDistribution()
 IBAppMsg *IBApp::getNewMsg()
 {
 
-  unsigned int msgMtuLen_B; // MTU of packet. same for entire message.
-  unsigned int msgLen_P;    // the message length in packets
   unsigned int msgLen_B;    // the length of a message in bytes
-  unsigned int msgSQ;       // the SQ to be used
   unsigned int msgDstLid;   // destination lid
 
-  msgMtuLen_B = par("msgMtuLen");
-  msgSQ = par("msgSQ");
+  int msgTag = 0;           // the message tag
 
   // obtain the message length
-  switch (msgLenMode) {
+  if (msgDstMode == DST_TRACE) {
+    // the trace provides the length, destination and tag
+    const traceRecord *p_rec = trace.peek();
+    msgLen_B = p_rec->bytes ? p_rec->bytes : 1;
+    msgDstLid = hcaLids[p_rec->peer];
+    msgTag = p_rec->tag;
+  } else switch (msgLenMode) {
   case MSG_LEN_PARAM:
     msgLen_B = par("msgLength");
     break;
   case MSG_LEN_SET:
+  case MSG_LEN_CDF:
     msgLen_B = getMsgLenByDistribution();
     break;
   default:
@@ -170,10 +809,10 @@ IBAppMsg *IBApp::getNewMsg()
     break;
   }
 
-  msgLen_P = msgLen_B / msgMtuLen_B;
-
   // obtain the message destination
   switch (msgDstMode) {
+  case DST_TRACE:
+    break;
   case DST_PARAM:
     msgDstLid = par("dstLid");
     break;
@@ -196,26 +835,113 @@ IBAppMsg *IBApp::getNewMsg()
     msgDstLid = (*dstSeq)[dstSeqIdx];
     break;
   default:
-    error("unsupported msgDstMode: %d", msgDstMode);
+    // traffic patterns - move to the next phase after dstPhaseMsgs
+    msgDstLid = patternDstLid;
+    if (++dstPhaseMsgIdx == dstPhaseMsgs) {
+      dstPhaseMsgIdx = 0;
+      dstPhase++;
+      if (dstPhases && (dstPhase == dstPhases)) {
+        dstSeqDone = 1;
+      } else {
+        patternDstLid = getPatternDstLid(dstPhase);
+      }
+      seqIdxVec.record(dstPhase);
+    }
     break;
   }
 
+  return newAppMsg(msgDstLid, msgLen_B, msgTag);
+}
+
+// allocate and init a new message of the given destination and length
+IBAppMsg *IBApp::newAppMsg(unsigned int dstLid, unsigned int lenBytes,
+                           int tag)
+{
+  unsigned int msgMtuLen_B; // MTU of packet. same for entire message.
+  unsigned int msgLen_P;    // the message length in packets
+  unsigned int msgSQ;       // the SQ to be used
+
+  msgMtuLen_B = par("msgMtuLen");
+  msgSQ = par("msgSQ");
+
+  // the last packet may be shorter than the MTU
+  msgLen_P = (lenBytes + msgMtuLen_B - 1) / msgMtuLen_B;
+
   IBAppMsg *p_msg;
   char name[128];
   sprintf(name, "app-%s-%d", getFullPath().c_str() ,msgIdx);
   p_msg = new IBAppMsg(name, IB_APP_MSG);
   p_msg->setAppIdx( getIndex() );
   p_msg->setMsgIdx(msgIdx);
-  p_msg->setDstLid(msgDstLid);
+  p_msg->setDstLid(dstLid);
   p_msg->setSQ(msgSQ);
-  p_msg->setLenBytes(msgLen_B);
+  p_msg->setLenBytes(lenBytes);
   p_msg->setLenPkts(msgLen_P);
   p_msg->setMtuBytes(msgMtuLen_B);
+  p_msg->setTag(tag);
+  p_msg->setRpcType(IB_RPC_NONE);
   msgIdx++;
   return p_msg;
 }
 
 void IBApp::handleMessage(cMessage *p_msg){
+  IB_PROF_EVENT(p_msg);
+
+  // a reply or a client request was injected - nothing more to do
+  IBAppMsg *p_appMsg = dynamic_cast<IBAppMsg *>(p_msg);
+  if (p_appMsg &&
+      ((p_appMsg->getRpcType() == IB_RPC_REPLY) || rpcClient)) {
+    delete p_msg;
+    return;
+  }
+
+  if (msgDstMode == DST_TRACE) {
+    // a done from the gen or the resume of a compute or recv
+    if (p_msg != p_traceResumeMsg) {
+      delete p_msg;
+      traceOutstanding--;
+    }
+    processTrace();
+    return;
+  }
+
+  if (barrier) {
+    if (p_msg != p_barrierMsg) {
+      // a done from the gen
+      delete p_msg;
+    } else if (!barrierStarted) {
+      barrierStarted = true;
+      barrierRelease();
+      return;
+    }
+    // a stage start fills all the QPs, a done frees a single one
+    unsigned int numSends = (p_msg == p_barrierMsg) ? numQPs : 1;
+    for (; numSends && barrierStageMsgs; numSends--) {
+      barrierStageMsgs--;
+      IBAppMsg *p_new = getNewMsg();
+      p_new->setBarrierStage(barrierStage);
+      double delay_ns = par("msg2msgGap");
+      sendDelayed(p_new, delay_ns*1e-9, "out$o");
+      EV << "-I- " << getFullPath() << " sending stage: " << barrierStage
+         << " message " << p_new->getName() << endl;
+    }
+    return;
+  }
+
+  if (arrivalMode != ARRIVAL_DONE) {
+    if (p_msg == p_arrivalMsg) {
+      handleArrival();
+    } else {
+      // a done from the gen frees a QP for the oldest backlog message
+      delete p_msg;
+      arrivalOutstanding--;
+      if (!arrivalBacklog.empty()) {
+        sendAppMsg(arrivalBacklog.front());
+        arrivalBacklog.pop_front();
+      }
+    }
+    return;
+  }
   delete p_msg;
 
   if(disable) return;
@@ -224,6 +950,12 @@ void IBApp::handleMessage(cMessage *p_msg){
     IBAppMsg *p_new = getNewMsg();
 
     double delay_ns = par("msg2msgGap");
+    if (rpcClient) {
+      // the request is tracked by its unique message index
+      p_new->setRpcType(IB_RPC_REQUEST);
+      p_new->setTag(p_new->getMsgIdx());
+      rpcOutstanding[p_new->getTag()] = simTime() + delay_ns*1e-9;
+    }
     sendDelayed(p_new, delay_ns*1e-9, "out$o");
 
     EV << "-I- " << getFullPath()
@@ -232,6 +964,54 @@ void IBApp::handleMessage(cMessage *p_msg){
   }
 }
 
+// the q quantile of the sorted samples
+static double quantile(const vector<double> &sorted, double q)
+{
+  if (sorted.empty())
+    return 0;
+  unsigned int idx = (unsigned int)ceil(q * sorted.size());
+  return sorted[idx ? idx - 1 : 0];
+}
+
 void IBApp::finish()
 {
+  if (arrivalMode != ARRIVAL_DONE) {
+    recordScalar("Arrived-Msgs", numArrivals);
+    recordScalar("Backlog-Overflow-Msgs", numOverflows);
+    recordScalar("Backlog-Msgs", arrivalBacklog.size());
+    backlogWaitStats.record();
+  }
+  if (rpcClient) {
+    sort(rpcLatencies.begin(), rpcLatencies.end());
+    recordScalar("RPC-Completed", rpcLatencies.size());
+    recordScalar("RPC-Outstanding", rpcOutstanding.size());
+    recordScalar("RPC-Response-Time-p50", quantile(rpcLatencies, 0.5));
+    recordScalar("RPC-Response-Time-p99", quantile(rpcLatencies, 0.99));
+    recordScalar("RPC-Response-Time-p99.9", quantile(rpcLatencies, 0.999));
+    rpcLatencyStats.record();
+  }
+
+  if (barrier && !disable && (barrierApps[0] == this)) {
+    recordScalar("Collective-Stages", barrierStage);
+    recordScalar("Collective-Completion-Time", collectiveTime);
+    stageTimeStats.record();
+  }
+
+  if ((msgDstMode != DST_TRACE) || disable)
+    return;
+
+  if (!traceCompleted) {
+    const traceRecord *p_rec = trace.peek();
+    EV << "-W- " << getFullPath() << " rank: " << rank
+       << " did not complete its trace - stopped at line: "
+       << (p_rec ? p_rec->lineNum : trace.getLineNum()) << endl;
+  }
+  recordScalar("Trace-Completion-Time",
+               traceCompleted ? traceCompletionTime.dbl() : -1);
+  recordScalar("Trace-Sent-Msgs", traceSentMsgs);
+  recordScalar("Trace-Sent-Bytes", traceSentBytes);
+  recordScalar("Trace-Recv-Msgs", traceRecvMsgs);
+  recordScalar("Trace-Recv-Wait-Time", traceRecvWait);
+  if (traceLastRank)
+    recordScalar("Trace-Total-Completion-Time", traceCompletionTime);
 }
@@ -57,23 +57,77 @@
 //           DST_SEQ_ONCE - go over the sequence only once - flag completion
 //           DST_SEQ_LOOP - loop over the sequence in
 //           DST_SEQ_RAND - choose from the sequence in random order
+// DST_TRACE - replay the traceFile of this HCA rank (see trace_file.h).
+//           Sends are given to the generator one per QP, receives wait
+//           for a message with matching source and tag to be consumed by
+//           the HCA sink and compute records delay the next record.
+//           The message length comes from the trace. The run ends once
+//           all ranks completed their trace.
+//
+//
+// Traffic patterns computed from the HCA rank and the number of HCAs N
+// (HCAs are ranked by sorted LID, no files are required):
+// DST_SHIFT - send to rank (r + dstShift) mod N
+// DST_BIT_COMPLEMENT - send to rank ~r (N must be a power of 2)
+// DST_TRANSPOSE - rank r = (row,col) of a square matrix sends to (col,row)
+//           HCAs on the diagonal do not send (N must be a square)
+// DST_RAND_PERM - a new random permutation with no fixed points per phase
+//           all HCAs compute the same permutation from dstSeed and the phase
+// DST_RECURSIVE_DOUBLING - at phase p send to rank r xor 2^(p mod log2(N))
+// DST_ALL_TO_ALL - at phase p send to rank (r + 1 + p mod (N-1)) mod N
+// DST_BISECTION - each HCA of the lower half is paired with a random HCA
+//           of the upper half and vice versa - new pairs every phase
+// DST_INCAST - all HCAs send to the dstLid HCA which does not send
+//
+// A phase is dstPhaseMsgs messages long. Pattern modes stop after
+// dstPhases phases unless it is 0 in which case they never stop.
+//
+// Collective stages:
+// When barrier is set the seq_* and pattern modes run as bulk synchronous
+// stages: a stage is a single sequence entry or a single pattern phase.
+// No HCA starts stage i+1 before all the messages of stage i were fully
+// consumed by their destination sinks. The barrier is tracked by counters
+// shared by all apps so no extra messages are sent. Messages carry their
+// stage in the barrierStage field (the tag is left to the application);
+// messages of other modes carry -1 and are not counted by the barrier.
+// All the active apps of the run must use barrier.
+// The first app records the per stage time vector and statistics and
+// the collective completion time. When no app has any message left the
+// run ends.
 //
 // Parameters for destination selection:
-// dstMode - possible values: param|seq_once|seq_loop|seq_rand
-// dstLid - the destination LID - used in DST_PARAM
+// dstMode - possible values: param|seq_once|seq_loop|seq_rand|trace|
+//           shift|bit_complement|transpose|rand_perm|recursive_doubling|
+//           all_to_all|bisection|incast
+// dstLid - the destination LID - used in DST_PARAM and DST_INCAST
+//           In DST_PARAM it may be a multicast LID (0xC000 - 0xFFFE)
+//           replicated by the switches MFT (see pktfwd.h) - multicast
+//           messages are not reported to the destination apps
 // dstSeqVecFile - the vector file name that contain the sequences
 // dstSeqVecIdx - the index of the generator in the file
+// dstShift - the rank offset of DST_SHIFT
+// dstSeed - the seed of the DST_RAND_PERM and DST_BISECTION permutations
+// dstPhaseMsgs - number of messages sent in each pattern phase
+// dstPhases - number of pattern phases to send (0 for infinite)
+// traceFile - the trace file name, a %d is replaced by the HCA rank
+// traceReadAhead - maximal number of trace records kept in memory
+// barrier - run the seq_* or pattern modes as globally synchronized stages
 //
 // Message/Packet Size Selection:
 // ==============================
 // MSG_LEN_PARAM - message length is based on msgSize param
 // MSG_LEN_SET - selects from a set of sizes with their relative probability
+// MSG_LEN_CDF - samples the empirical CDF given in the msgLenFile
+// Both distributions are sampled in O(1) by an alias table (see size_dist.h)
 //
 // Parameters for message size:
-// msgLenMode - possible values: param|set
+// msgLenMode - possible values: param|set|cdf
 // msgLength_B - the length of a message in bytes - last packet may be padded
-// msgLenSet - a set of lengths
-// msgLenProb - probability for each length
+// msgLenSet - a set of lengths, each may be a range LO-HI sampled uniformly
+// msgLenProb - relative weight (real) of each length
+// msgLenFile - the "<size> <cdf>" lines file of MSG_LEN_CDF
+// msgLenCdfContinuous - sample sizes between the CDF points uniformly
+//                       otherwise only the CDF points are used
 // mtuLen_B - the MTU of single packet. It is the same for entire message.
 //
 // NOTE: due to current limitation of the simulator of sending full flits
@@ -81,10 +135,53 @@
 //
 // Traffic Shaping:
 // ================
-// There are no special modes here.
+// The arrivalMode selects how new messages are triggered:
+// ARRIVAL_DONE - a new message is sent msg2msgGap after the generator
+//           consumed the previous one (closed loop, the default)
+// ARRIVAL_POISSON - messages arrive by a Poisson process
+// ARRIVAL_ONOFF - a 2 state MMPP: Poisson arrivals during exponential on
+//           periods and none during exponential off periods
+// ARRIVAL_TRACE - inter arrival times (ns) replayed in a loop from a vector
+//           file float vector
+// The open loop modes offer arrivalLoad of the HCA link rate on average
+// (a trace is scaled to it unless arrivalLoad is 0). Arrived messages go
+// to the generator while it holds less than numQPs of them and otherwise
+// wait in a backlog of up to arrivalBacklog messages. Arrivals to a full
+// backlog are dropped and counted.
 //
 // Parameters that control shaping:
 // msg2msgGap_ns - the extra delay from one msg end to the next start [ns]
+// arrivalMode - possible values: done|poisson|onoff|trace
+// arrivalLoad - the offered load as a fraction of the link rate
+// arrivalLinkRate - the link rate, 0 takes it from the HCA port wire
+// arrivalOnTime, arrivalOffTime - mean on and off periods of onoff
+// arrivalVecFile, arrivalVecIdx - the inter arrival times vector
+// arrivalBacklog - maximal number of messages waiting for the generator
+//
+// QPs:
+// ====
+// The app keeps numQPs messages outstanding at the generator, each may be
+// thought of as a QP. The generator interleaves them (see gen.h).
+// In trace mode up to numQPs sends are outstanding before a send blocks.
+//
+// Request/Response:
+// =================
+// A client (rpcClient) sends every message as a request and keeps numQPs
+// requests outstanding. A new request is sent rpcThinkTime after the
+// reply of a previous one was fully received. The response time is
+// measured from the request send to the reply last flit consumption and
+// reported per client as p50, p99 and p99.9.
+// A server (rpcServer) answers every fully received request with a reply
+// of rpcReplyLength bytes after rpcServiceTime. Any HCA may be both.
+// Requests destinations and lengths are selected by the dstMode and
+// msgLenMode like any other message.
+//
+// Parameters:
+// rpcClient - send requests and wait for their replies
+// rpcServer - reply to received requests
+// rpcReplyLength - the reply message length in bytes
+// rpcServiceTime - delay from request arrival to reply send
+// rpcThinkTime - delay from reply arrival to the next request
 //
 // SQ selection:
 // ================
@@ -100,11 +197,16 @@
 #define __APP_H
 
 #include <omnetpp.h>
+#include <list>
+#include <deque>
+#include "trace_file.h"
+#include "size_dist.h"
+#include "snapshot.h"
 
 //
 // Generates IB Application Messages
 //
-class IBApp : public cSimpleModule
+class IBApp : public cSimpleModule, public snapshotModule
 {
  private:
   // destination selection modes
@@ -112,13 +214,31 @@ class IBApp : public cSimpleModule
     DST_PARAM,     // invoke the dstLid param every message
     DST_SEQ_ONCE,  // use the dstSeq vector of dstLids only once.
     DST_SEQ_LOOP,  // continously loop through the dstSeq vector od dstLids.
-    DST_SEQ_RAND   // Destination is randomly selected from the sequence
+    DST_SEQ_RAND,  // Destination is randomly selected from the sequence
+    DST_TRACE,     // replay the sends of a trace file
+    DST_SHIFT,     // the next rank by a fixed offset
+    DST_BIT_COMPLEMENT, // the rank with all bits flipped
+    DST_TRANSPOSE, // the transposed rank in a square matrix
+    DST_RAND_PERM, // a random permutation per phase
+    DST_RECURSIVE_DOUBLING, // the rank differing by a single bit per phase
+    DST_ALL_TO_ALL, // every other rank one per phase
+    DST_BISECTION, // a random rank of the other half per phase
+    DST_INCAST     // all to the single dstLid
+  };
+
+  // how new messages are triggered
+  enum arrivalModes {
+    ARRIVAL_DONE,    // a new message when the previous one is consumed
+    ARRIVAL_POISSON, // exponential inter arrival times
+    ARRIVAL_ONOFF,   // Poisson arrivals in exponential on periods
+    ARRIVAL_TRACE    // inter arrival times from a vector file
   };
 
   // how message length is defined
   enum msgLenModes {
     MSG_LEN_PARAM, // invoke the msgLength param every message
-    MSG_LEN_SET    // select from the given set of lengths/probabilities
+    MSG_LEN_SET,   // select from the given set of lengths/probabilities
+    MSG_LEN_CDF    // sample the empirical CDF of the msgLenFile
   };
 
   // - destination
@@ -127,38 +247,124 @@ class IBApp : public cSimpleModule
   std::string dstSeqVecFile; // the vector file name that contain the sequences
   unsigned int dstSeqVecIdx; // the index of the generator in the file
   std::vector<int> *dstSeq; // a destination lid sequence
+  unsigned int dstShift;     // the rank offset of DST_SHIFT
+  unsigned int dstSeed;      // the seed of the random pattern permutations
+  unsigned int dstPhaseMsgs; // number of messages in each pattern phase
+  unsigned int dstPhases;    // number of phases to send (0 is infinite)
+  unsigned int dstIncastLid; // the target of DST_INCAST
+  static std::vector<unsigned int> hcaLids; // all HCA LIDs sorted
+  traceFile trace;           // the trace being replayed in DST_TRACE
 
   // - length
-  msgLenModes msgLenMode;          // possible values: param|set
-  std::vector<int> msgLenSet; // a set of lengths
-  cLongHistogram msgLenProb;// probability for each index in msgLenSet
+  msgLenModes msgLenMode;          // possible values: param|set|cdf
+  sizeDist msgLenSet;              // the set of lengths and their weights
+  sizeDist *p_msgLenDist;          // the sampled length distribution
 
   // - shape
   double msg2msgGap_ns;   // extra delay from one msg end to the next start
+  arrivalModes arrivalMode;    // how new messages are triggered
+  double arrivalMeanGap_s;     // mean inter arrival time
+  double arrivalOnGap_s;       // mean inter arrival time in on periods
+  double arrivalOnTime_s;      // mean on period
+  double arrivalOffTime_s;     // mean off period
+  simtime_t arrivalOnEnd;      // end of the current on period
+  std::vector<float> *arrivalGaps; // inter arrival times trace in ns
+  unsigned int arrivalGapIdx;  // next index in the arrivalGaps
+  double arrivalGapScale;      // scale of the trace to the offered load
+  unsigned int arrivalBacklogSize; // max messages in the backlog
+  std::deque<IBAppMsg *> arrivalBacklog; // arrived messages not yet sent
+  unsigned int arrivalOutstanding; // messages at the generator
+  cMessage *p_arrivalMsg;      // the next arrival
+
+  // - RPC
+  bool rpcClient;         // send requests and wait for their replies
+  bool rpcServer;         // reply to received requests
+  std::map<int, simtime_t> rpcOutstanding; // request send time by tag
+  std::vector<double> rpcLatencies; // response time of all the requests
+  cStdDev rpcLatencyStats;          // response time statistics
 
   // - SQ
 
   // state
+  unsigned int numQPs;    // messages kept outstanding at the generator
   unsigned int dstSeqIdx; // Using a sequence of dLids the next index to use
   int dstSeqDone;         // When using a sequence once 1 if entire seq was gen
   unsigned int msgIdx;    // counter of generated messages
+  unsigned int rank;      // the index of our LID in the hcaLids
+  unsigned int dstPhase;  // the current pattern phase
+  unsigned int dstPhaseMsgIdx; // messages sent in the current phase
+  unsigned int patternDstLid;  // the pattern destination of the phase
+  cMessage *p_traceResumeMsg;  // resume the trace after compute or recv
+  unsigned int traceOutstanding; // trace sends not done by the gen yet
+  bool traceWaitRecv;          // blocked on a trace recv record
+  bool traceCompleted;         // reached the end of the trace
+  simtime_t traceWaitStart;    // time the current recv blocked
+  std::list<std::pair<int, int> > traceUnexpected; // (src rank, tag) received
+                                                   // but not yet matched
+  static unsigned int traceActiveRanks; // ranks still replaying their trace
+
+  // - collective stages
+  bool barrier;                  // synchronize stages across all apps
+  unsigned int barrierStageMsgs; // messages left to send in the stage
+  cMessage *p_barrierMsg;        // start sending the stage messages
+  static std::vector<IBApp *> barrierApps; // all apps in barrier mode
+  static bool barrierStarted;    // first stage was released
+  static unsigned int barrierStage;    // the current stage
+  static unsigned int barrierExpected; // messages sent in the stage
+  static unsigned int barrierArrived;  // messages consumed in the stage
+  static simtime_t barrierStageStart;  // time the stage was released
 
   // statistics
   cOutVector seqIdxVec;   // track the current sequence index
+  unsigned int numArrivals;    // messages arrived in open loop modes
+  unsigned int numOverflows;   // arrivals dropped on a full backlog
+  cStdDev backlogWaitStats;    // time arrived messages wait in the backlog
+  unsigned int traceSentMsgs;  // trace messages sent
+  double traceSentBytes;       // trace bytes sent
+  unsigned int traceRecvMsgs;  // trace recv records matched
+  simtime_t traceRecvWait;     // total time blocked on recv records
+  simtime_t traceCompletionTime; // time the trace was completed
+  bool traceLastRank;          // completed the trace last of all ranks
+  cOutVector stageTimeVec;     // barrier leader: time of every stage
+  cStdDev stageTimeStats;      // barrier leader: stage time statistics
+  simtime_t collectiveTime;    // barrier leader: time last stage completed
 
   // methods
  private:
 
   // Initialize a new set of parameters for a new message
   void makeNewMsgParams();
-  void parseIntListParam(const char *parName, std::vector<int> &out);
   IBAppMsg *getNewMsg();
+  IBAppMsg *newAppMsg(unsigned int dstLid, unsigned int lenBytes, int tag);
+  void initArrivals();
+  double getNextArrivalGap();
+  void handleArrival();
+  void sendAppMsg(IBAppMsg *p_msg);
   unsigned int getMsgLenByDistribution();
+  void initRank();
+  void initPattern();
+  void initTrace();
+  void processTrace();
+  unsigned int getStageMsgs();
+  unsigned int startStage();
+  static void barrierRelease();
+  unsigned int getPatternDstLid(unsigned int phase);
+  unsigned int permute(unsigned int x, unsigned int n, unsigned int phase,
+                       bool inverse);
 
  protected:
   virtual void initialize();
   virtual void handleMessage(cMessage *msg);
   virtual void finish();
+ public:
+  IBApp() { p_traceResumeMsg = NULL; p_barrierMsg = NULL; p_arrivalMsg = NULL; };
+  virtual ~IBApp();
+  // called by the HCA sink when a message was fully consumed
+  void msgReceived(unsigned int srcLid, int tag, int rpcType,
+                   int barrierStage);
+  // the destination pattern position, arrivals and RPCs outstanding. The
+  // trace and barrier modes are not supported
+  virtual void snapshotState(stateSnapshot &s);
 };
 
 #endif
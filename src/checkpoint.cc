@@ -0,0 +1,442 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBCheckpoint saves and forks the simulation at checkpoint time and
+// loads a saved snapshot. See functional description in the header file.
+//
+#include "checkpoint.h"
+#include "snapshot.h"
+#include <fstream>
+#include <climits>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+Define_Module( IBCheckpoint );
+
+void IBCheckpoint::initialize()
+{
+  checkpointTime = par("checkpointTime");
+  snapshotFile = par("snapshotFile").stdstringValue();
+  forkFile = par("forkFile").stdstringValue();
+  waitForForks = par("waitForForks");
+  loadFile = par("loadSnapshot").stdstringValue();
+  forkIdx = -1;
+  WATCH(forkIdx);
+
+  p_ckptMsg = new cMessage("checkpoint");
+  p_loadMsg = new cMessage("load-snapshot");
+
+  // the snapshot replaces the initial state before any other event
+  if (!loadFile.empty()) {
+    p_loadMsg->setSchedulingPriority(SHRT_MIN);
+    scheduleAt(simTime(), p_loadMsg);
+  }
+
+  if (checkpointTime <= 0) {
+    EV << "-I- " << getFullPath() << " checkpoint disabled" << endl;
+    return;
+  }
+
+  if (!forkFile.empty())
+    parseForkFile();
+  if (forks.empty() && snapshotFile.empty()) {
+    opp_error("-E- %s no snapshotFile and no forks defined in forkFile: %s",
+              getFullPath().c_str(), forkFile.c_str());
+  }
+
+  EV << "-I- " << getFullPath() << " will save: " << snapshotFile
+     << " and fork " << forks.size() << " experiments at:"
+     << checkpointTime << endl;
+  scheduleAt(checkpointTime, p_ckptMsg);
+}
+
+// read the fork sections and their overrides
+void IBCheckpoint::parseForkFile()
+{
+  std::ifstream f(forkFile.c_str());
+  if (!f.good()) {
+    opp_error("-E- %s can not open forkFile: %s",
+              getFullPath().c_str(), forkFile.c_str());
+  }
+
+  std::string line;
+  int lineNum = 0;
+  while (std::getline(f, line)) {
+    lineNum++;
+    // strip comments and surrounding white space
+    size_t pos = line.find('#');
+    if (pos != std::string::npos) line.erase(pos);
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos) continue;
+    line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+    if (line[0] == '[') {
+      char name[128];
+      if (sscanf(line.c_str(), "[fork %127[^] ]]", name) != 1) {
+        opp_error("-E- %s forkFile: %s line: %d bad section: %s",
+                  getFullPath().c_str(), forkFile.c_str(), lineNum,
+                  line.c_str());
+      }
+      ForkSpec spec;
+      spec.name = name;
+      forks.push_back(spec);
+      continue;
+    }
+
+    pos = line.find('=');
+    if ((pos == std::string::npos) || forks.empty()) {
+      opp_error("-E- %s forkFile: %s line: %d expected <pattern> = <value>"
+                " inside a [fork <name>] section",
+                getFullPath().c_str(), forkFile.c_str(), lineNum);
+    }
+    std::string pattern = line.substr(0, line.find_last_not_of(" \t", pos-1)+1);
+    std::string value = line.substr(line.find_first_not_of(" \t", pos+1));
+    forks.back().overrides.push_back(make_pair(pattern, value));
+  }
+}
+
+// apply the given value to all parameters matching the pattern under the
+// module. Return the number of parameters changed
+int IBCheckpoint::applyOverride(cModule *p_mod, cPatternMatcher &matcher,
+                                const char *value)
+{
+  int numMatched = 0;
+  for (int i = 0; i < p_mod->getNumParams(); i++) {
+    cPar &p = p_mod->par(i);
+    std::string fullName = p_mod->getFullPath() + "." + p.getName();
+    if (matcher.matches(fullName.c_str())) {
+      p.parse(value);
+      numMatched++;
+    }
+  }
+
+  for (cModule::SubmoduleIterator iter(p_mod); !iter.end(); iter++)
+    numMatched += applyOverride(iter(), matcher, value);
+  return numMatched;
+}
+
+// the files written by the parent (vector, event log...) are shared by all
+// its children. Copy each into the current (fork) directory, under its path
+// relative to the parent directory, and move its descriptor to the copy
+void IBCheckpoint::reopenOutputFiles(const std::string &parentDir)
+{
+  DIR *p_dir = opendir("/proc/self/fd");
+  if (!p_dir) {
+    opp_error("-E- %s fork: %s can not list its open files",
+              getFullPath().c_str(), forks[forkIdx].name.c_str());
+  }
+  std::vector<int> fds;
+  struct dirent *p_ent;
+  while ((p_ent = readdir(p_dir)) != NULL) {
+    int fd = atoi(p_ent->d_name);
+    if ((fd > 2) && (fd != dirfd(p_dir)))
+      fds.push_back(fd);
+  }
+  closedir(p_dir);
+
+  for (unsigned int i = 0; i < fds.size(); i++) {
+    int flags = fcntl(fds[i], F_GETFL);
+    struct stat st;
+    if ((flags < 0) || !(flags & (O_WRONLY | O_RDWR)) ||
+        fstat(fds[i], &st) || !S_ISREG(st.st_mode))
+      continue;
+
+    char link[64], path[PATH_MAX];
+    sprintf(link, "/proc/self/fd/%d", fds[i]);
+    ssize_t len = readlink(link, path, sizeof(path) - 1);
+    if (len < 0) continue;
+    path[len] = '\0';
+
+    std::string fileName = path;
+    if (!fileName.compare(0, parentDir.size() + 1, parentDir + "/"))
+      fileName.erase(0, parentDir.size() + 1);
+    else
+      fileName.erase(0, fileName.rfind('/') + 1);
+    for (size_t pos = fileName.find('/'); pos != std::string::npos;
+         pos = fileName.find('/', pos + 1))
+      mkdir(fileName.substr(0, pos).c_str(), 0755);
+
+    int srcFd = open(path, O_RDONLY);
+    int newFd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ((srcFd < 0) || (newFd < 0)) {
+      opp_error("-E- %s fork: %s failed to copy: %s",
+                getFullPath().c_str(), forks[forkIdx].name.c_str(), path);
+    }
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(srcFd, buf, sizeof(buf))) > 0) {
+      if (write(newFd, buf, n) != n) {
+        opp_error("-E- %s fork: %s failed to copy: %s",
+                  getFullPath().c_str(), forks[forkIdx].name.c_str(), path);
+      }
+    }
+    close(srcFd);
+
+    lseek(newFd, lseek(fds[i], 0, SEEK_CUR), SEEK_SET);
+    if (flags & O_APPEND)
+      fcntl(newFd, F_SETFL, O_APPEND);
+    dup2(newFd, fds[i]);
+    close(newFd);
+    EV << "-I- " << getFullPath() << " fork: " << forks[forkIdx].name
+       << " writes its own copy of: " << fileName << endl;
+  }
+}
+
+// we are the child of the given fork - move into its directory and apply
+// its overrides
+void IBCheckpoint::becomeFork(unsigned int idx)
+{
+  ForkSpec &spec = forks[idx];
+  forkIdx = idx;
+  childPids.clear();
+
+  char parentDir[PATH_MAX];
+  if (!getcwd(parentDir, sizeof(parentDir))) {
+    opp_error("-E- %s fork: %s failed to get the current directory",
+              getFullPath().c_str(), spec.name.c_str());
+  }
+  if (mkdir(spec.name.c_str(), 0755) && (errno != EEXIST)) {
+    opp_error("-E- %s fork: %s failed to create its directory",
+              getFullPath().c_str(), spec.name.c_str());
+  }
+  if (chdir(spec.name.c_str())) {
+    opp_error("-E- %s fork: %s failed to enter its directory",
+              getFullPath().c_str(), spec.name.c_str());
+  }
+  if (!freopen("stdout.log", "w", stdout)) {
+    opp_error("-E- %s fork: %s failed to redirect stdout",
+              getFullPath().c_str(), spec.name.c_str());
+  }
+  reopenOutputFiles(parentDir);
+
+  for (unsigned int o = 0; o < spec.overrides.size(); o++) {
+    const char *pattern = spec.overrides[o].first.c_str();
+    const char *value = spec.overrides[o].second.c_str();
+    cPatternMatcher matcher(pattern, true, true, true);
+    int numMatched = applyOverride(simulation.getSystemModule(), matcher, value);
+    if (!numMatched) {
+      opp_error("-E- %s fork: %s override: %s matches no parameter",
+                getFullPath().c_str(), spec.name.c_str(), pattern);
+    }
+    EV << "-I- " << getFullPath() << " fork: " << spec.name << " set "
+       << numMatched << " parameters by " << pattern << " = " << value << endl;
+  }
+}
+
+// the modules holding state in the snapshot - by module id
+void IBCheckpoint::getSnapshotModules(std::vector<cModule *> &mods)
+{
+  for (int id = 0; id <= simulation.getLastModuleId(); id++) {
+    cModule *p_mod = simulation.getModule(id);
+    if (dynamic_cast<snapshotModule *>(p_mod))
+      mods.push_back(p_mod);
+  }
+}
+
+// write the state of the modules and their future events
+void IBCheckpoint::saveSnapshot()
+{
+  stateSnapshot s(snapshotFile.c_str(), false);
+  s.header();
+
+  std::vector<cModule *> mods;
+  getSnapshotModules(mods);
+  s.tag("modules");
+  unsigned long numMods = mods.size();
+  snap(s, numMods);
+  for (unsigned int m = 0; m < mods.size(); m++) {
+    s.tag("module");
+    std::string path = mods[m]->getFullPath();
+    snap(s, path);
+    cContextSwitcher ctx(mods[m]);
+    dynamic_cast<snapshotModule *>(mods[m])->snapshotState(s);
+  }
+
+  // the FES is taken out to be walked in order and put back as is. The
+  // events of the other modules are created again by their initialize
+  std::vector<cMessage *> events;
+  unsigned long numEvents = 0;
+  while (simulation.msgQueue.getLength()) {
+    cMessage *p_msg = simulation.msgQueue.removeFirst();
+    if (dynamic_cast<snapshotModule *>(p_msg->getArrivalModule()))
+      numEvents++;
+    events.push_back(p_msg);
+  }
+  s.tag("fes");
+  snap(s, numEvents);
+  for (unsigned int e = 0; e < events.size(); e++)
+    if (dynamic_cast<snapshotModule *>(events[e]->getArrivalModule()))
+      s.event(events[e]);
+  for (unsigned int e = 0; e < events.size(); e++)
+    simulation.insertMsg(events[e]);
+  s.tag("end");
+  s.close();
+
+  EV << "-I- " << getFullPath() << " saved snapshot: " << snapshotFile
+     << " of " << mods.size() << " modules and " << numEvents
+     << " events at:" << simTime() << endl;
+}
+
+// replace the initial state and events of the modules by the snapshot
+void IBCheckpoint::loadSnapshot()
+{
+  stateSnapshot s(loadFile.c_str(), true);
+  s.header();
+  simtime_t t = s.getTime();
+
+  // drop the initialize events of the modules in the snapshot. Their self
+  // messages are kept until the loaded state claims its timers - the rest
+  // are anonymous and deleted. The events of the other modules are kept
+  // but not before the snapshot time
+  std::vector<cMessage *> kept, selfMsgs;
+  while (simulation.msgQueue.getLength()) {
+    cMessage *p_msg = simulation.msgQueue.peekFirst();
+    cModule *p_mod = p_msg->getArrivalModule();
+    cContextSwitcher ctx(p_mod);
+    simulation.msgQueue.removeFirst();
+    if (!dynamic_cast<snapshotModule *>(p_mod)) {
+      if (p_msg->getArrivalTime() < t)
+        p_msg->setArrival(p_mod, p_msg->getArrivalGateId(), t);
+      kept.push_back(p_msg);
+    } else if (p_msg->isSelfMessage()) {
+      selfMsgs.push_back(p_msg);
+    } else {
+      delete p_msg;
+    }
+  }
+
+  std::vector<cModule *> mods;
+  getSnapshotModules(mods);
+  s.tag("modules");
+  unsigned long numMods;
+  snap(s, numMods);
+  if (numMods != mods.size()) {
+    opp_error("-E- %s snapshot: %s holds %lu modules but the network: %u",
+              getFullPath().c_str(), loadFile.c_str(), numMods,
+              (unsigned int)mods.size());
+  }
+  for (unsigned int m = 0; m < numMods; m++) {
+    s.tag("module");
+    std::string path;
+    snap(s, path);
+    cModule *p_mod = simulation.getModuleByPath(path.c_str());
+    snapshotModule *p_snap = dynamic_cast<snapshotModule *>(p_mod);
+    if (!p_snap) {
+      opp_error("-E- %s snapshot: %s module: %s is not in the network",
+                getFullPath().c_str(), loadFile.c_str(), path.c_str());
+    }
+    cContextSwitcher ctx(p_mod);
+    p_snap->snapshotState(s);
+  }
+  for (unsigned int i = 0; i < selfMsgs.size(); i++)
+    if (!s.isClaimed(selfMsgs[i]))
+      delete selfMsgs[i];
+
+  s.tag("fes");
+  unsigned long numEvents;
+  snap(s, numEvents);
+  for (unsigned long e = 0; e < numEvents; e++)
+    simulation.insertMsg(s.event());
+  for (unsigned int e = 0; e < kept.size(); e++)
+    simulation.insertMsg(kept[e]);
+  s.tag("end");
+  s.close();
+
+  EV << "-I- " << getFullPath() << " loaded snapshot: " << loadFile
+     << " of " << numMods << " modules and " << numEvents
+     << " events - continuing from:" << t << endl;
+}
+
+// save the snapshot and fork all children. Children return from here as
+// their fork
+void IBCheckpoint::handleCheckpoint()
+{
+  if (!snapshotFile.empty())
+    saveSnapshot();
+
+  for (unsigned int i = 0; i < forks.size(); i++) {
+    // avoid duplicating buffered output into the children and have the
+    // result files complete for their copies
+    ev.flush();
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      opp_error("-E- %s failed to fork: %s", getFullPath().c_str(),
+                forks[i].name.c_str());
+    } else if (pid == 0) {
+      becomeFork(i);
+      return;
+    }
+
+    EV << "-I- " << getFullPath() << " forked: " << forks[i].name
+       << " pid:" << pid << " at:" << simTime() << endl;
+    childPids.push_back(pid);
+  }
+}
+
+void IBCheckpoint::handleMessage(cMessage *p_msg)
+{
+  if (p_msg == p_ckptMsg) {
+    handleCheckpoint();
+  } else if (p_msg == p_loadMsg) {
+    loadSnapshot();
+  } else {
+    opp_error("-E- %s does not know how to handle message: %d",
+              getFullPath().c_str(), p_msg->getKind());
+    delete p_msg;
+  }
+}
+
+void IBCheckpoint::finish()
+{
+  if (checkpointTime <= 0) return;
+
+  if (forkIdx >= 0) {
+    recordScalar("Fork-Index", forkIdx);
+    recordScalar("Forked-At", checkpointTime);
+    fflush(stdout);
+    return;
+  }
+
+  int numFailed = 0;
+  if (waitForForks) {
+    for (unsigned int i = 0; i < childPids.size(); i++) {
+      int status;
+      if ((waitpid(childPids[i], &status, 0) < 0) ||
+          !WIFEXITED(status) || WEXITSTATUS(status)) {
+        ev << "-E- " << getFullPath() << " fork: " << forks[i].name
+           << " did not complete cleanly" << endl;
+        numFailed++;
+      }
+    }
+  }
+  recordScalar("Num-Forks", childPids.size());
+  recordScalar("Num-Failed-Forks", numFailed);
+}
+
+IBCheckpoint::~IBCheckpoint() {
+  if (p_ckptMsg) cancelAndDelete(p_ckptMsg);
+  if (p_loadMsg) cancelAndDelete(p_loadMsg);
+}
@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Warm State Checkpoint - Save or fork the simulation after warmup
+//
+// Overview:
+// =========
+// Every run pays the same warmup before the statistics collection starts.
+// When sweeping post-warmup parameters (hiccups, gaps, lengths) we want to
+// simulate the warmup only once and then branch into several experiments.
+//
+// At checkpointTime the checkpoint module may:
+// - save the warm state into the snapshotFile, such that later runs start
+//   from it by loadSnapshot, and
+// - fork the simulation process into the experiments of the forkFile.
+//
+// Snapshot:
+// =========
+// The snapshot is a versioned file (see snapshot.h) holding the state of
+// the IBUF queues and credits, the VLA tables and HoQs, the OBUF queues and
+// FCTBS/FCCL, the generator, application and sink state and the FES -
+// including the FLITs and credits in flight on the wires.
+//
+// A run given loadSnapshot initializes the network as usual and, as its
+// first event, replaces the initial state of these modules by the loaded
+// one and their events by the loaded FES. The simulation then continues
+// from the snapshot time. The network, simtime-scale and the parameters
+// read on initialize (buffer sizes, VLs, routing...) must be the same as
+// in the saving run - only the volatile parameters may differ.
+//
+// NOTE: statistics are not part of the snapshot: the loaded run collects
+// them from the snapshot time (the sinks start their collection no earlier
+// than it).
+// NOTE: modules not holding traffic - the steady state, failures and
+// profiler - are not saved. They run from their initial state and their
+// events before the snapshot time are delivered at it.
+// NOTE: the random number streams are not saved, the trace and barrier
+// application modes can not be saved.
+//
+// Fork File:
+// ==========
+// The forkFile holds one section per fork. Each section starts with a
+// "[fork <name>]" line and is followed by ini style parameter assignments
+// that are applied on the child right after the fork:
+//
+//   [fork hiccup5us]
+//   **.sink.hiccupDelay = 5us
+//   [fork longMsgs]
+//   **H_1**.msgLength = 262144B
+//
+// Lines starting with # are comments.
+//
+// Each forked child runs in its own sub directory (named by the fork) such
+// that its results and stdout do not collide with the parent or the other
+// forks. The result files already open at the fork (vectors recorded
+// during warmup) are copied into the fork directory under the same relative
+// path and the child writes its own copy. The parent continues as the
+// baseline (no overrides).
+//
+// NOTE: only parameters read after the checkpoint take effect - in practice
+// volatile parameters (msg2msgGap, msgLength, hiccupDelay, dstLid...) since
+// most of the others are cached on initialize.
+// NOTE: forking relies on POSIX fork() and the Linux /proc/self/fd to find
+// the open result files: Cmdenv on Linux only. Each fork is a full process
+// (sharing memory copy-on-write), so the number of concurrent forks is
+// bound by the host cores and memory.
+//
+// Parameters:
+// checkpointTime - the simulation time to save and fork at. 0 disables both
+// snapshotFile - the file to save the warm state into
+// forkFile - the file describing the forks
+// waitForForks - if true the parent waits for all its children on finish
+// loadSnapshot - start from the state saved in this file
+//
+
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <omnetpp.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+// a single fork and its parameter overrides
+class ForkSpec {
+public:
+  std::string name;
+  std::vector< std::pair< std::string, std::string > > overrides;
+};
+
+//
+// Saves or forks the simulation at checkpoint time; see NED file for more info.
+//
+class IBCheckpoint : public cSimpleModule
+{
+ private:
+  cMessage *p_ckptMsg;
+  cMessage *p_loadMsg;
+
+  // parameters
+  simtime_t checkpointTime;   // time to save and fork at
+  std::string snapshotFile;   // the file to save the warm state into
+  std::string forkFile;       // the file holding the forks overrides
+  bool waitForForks;          // parent waits for its children on finish
+  std::string loadFile;       // the snapshot to start from
+
+  // state
+  std::vector<ForkSpec> forks; // the forks to create
+  std::vector<pid_t> childPids; // pids of forked children (parent only)
+  int forkIdx;                 // index of this process fork, -1 for parent
+
+  // methods
+  void parseForkFile();
+  int  applyOverride(cModule *p_mod, cPatternMatcher &matcher,
+                     const char *value);
+  void reopenOutputFiles(const std::string &parentDir);
+  void becomeFork(unsigned int idx);
+  void getSnapshotModules(std::vector<cModule *> &mods);
+  void saveSnapshot();
+  void loadSnapshot();
+  void handleCheckpoint();
+
+ protected:
+  virtual void initialize();
+  virtual void handleMessage(cMessage *msg);
+  virtual void finish();
+  virtual ~IBCheckpoint();
+};
+
+#endif
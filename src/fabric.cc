@@ -0,0 +1,252 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBFabric builds the HCAs, switches and wires of the network from a
+// .topo file. See functional description in the header file.
+//
+#include "fabric.h"
+#include "link_spec.h"
+#include "profiler.h"
+#include <fstream>
+#include <set>
+
+Define_Module( IBFabric );
+
+// read the HCA names and LIDs: "H-1/U1/1 1"
+void IBFabric::parseHcasFile(const char *fileName)
+{
+  std::ifstream f(fileName);
+  if (!f.good()) {
+    opp_error("-E- %s can not open hcasFile: %s",
+              getFullPath().c_str(), fileName);
+  }
+
+  std::string line;
+  int lineNum = 0;
+  while (std::getline(f, line)) {
+    lineNum++;
+    char name[128];
+    int lid;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    if (sscanf(line.c_str(), " %127[^/ ]%*s %d", name, &lid) != 2) {
+      opp_error("-E- %s bad hcasFile: %s line: %d format: <name>/U1/1 <lid>",
+                getFullPath().c_str(), fileName, lineNum);
+    }
+    lidByHca[name] = lid;
+  }
+}
+
+// read the switch blocks and their port links
+void IBFabric::parseTopoFile(const char *fileName)
+{
+  std::ifstream f(fileName);
+  if (!f.good()) {
+    opp_error("-E- %s can not open topoFile: %s",
+              getFullPath().c_str(), fileName);
+  }
+
+  std::string line;
+  std::string curNode;
+  int lineNum = 0;
+  while (std::getline(f, line)) {
+    lineNum++;
+    size_t pos = line.find('#');
+    if (pos != std::string::npos) line.erase(pos);
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+    char sysType[128], name[128], arrow[64], remType[128], remName[128];
+    if ((line[0] != ' ') && (line[0] != '\t')) {
+      // a new system block
+      if (sscanf(line.c_str(), "%127s %127s", sysType, name) != 2) {
+        opp_error("-E- %s bad topoFile: %s line: %d expected: <type> <name>",
+                  getFullPath().c_str(), fileName, lineNum);
+      }
+      curNode = name;
+      if (numPortsBySw.find(curNode) == numPortsBySw.end())
+        numPortsBySw[curNode] = 0;
+      continue;
+    }
+
+    TopoLink link;
+    if (curNode.empty() ||
+        (sscanf(line.c_str(), " P%d %63s %127s %127s P%d",
+                &link.port, arrow, remType, remName, &link.remPort) != 5)) {
+      opp_error("-E- %s bad topoFile: %s line: %d expected: "
+                "P<n> -> <type> <name> P<n> (directors must be flattened)",
+                getFullPath().c_str(), fileName, lineNum);
+    }
+    link.node = curNode;
+    link.remNode = remName;
+    linkSpec spec;
+    if (spec.parse(arrow) || (!spec.width != !spec.speed_Gbps)) {
+      opp_error("-E- %s bad topoFile: %s line: %d unknown link spec: %s",
+                getFullPath().c_str(), fileName, lineNum, arrow);
+    }
+    link.width = spec.width;
+    link.speed_Gbps = spec.speed_Gbps;
+    link.length_m = spec.length_m;
+    links.push_back(link);
+  }
+
+  // the switches are all the nodes that are not HCAs
+  for (unsigned int i = 0; i < links.size(); i++) {
+    const TopoLink &link = links[i];
+    if (lidByHca.find(link.node) == lidByHca.end()) {
+      int &n = numPortsBySw[link.node];
+      if (n < link.port) n = link.port;
+    }
+    if (lidByHca.find(link.remNode) == lidByHca.end()) {
+      int &n = numPortsBySw[link.remNode];
+      if (n < link.remPort) n = link.remPort;
+    }
+  }
+  for (std::map<std::string, int>::iterator hI = lidByHca.begin();
+       hI != lidByHca.end(); hI++) {
+    numPortsBySw.erase((*hI).first);
+  }
+}
+
+// SW-L0-0-0 -> SW_L0_0_0_U1
+std::string IBFabric::nedName(const std::string &topoName)
+{
+  std::string name = topoName;
+  for (unsigned int i = 0; i < name.size(); i++)
+    if (name[i] == '-') name[i] = '_';
+  return name + "_U1";
+}
+
+cGate *IBFabric::getPortGate(cModule *p_node, int port, const char *half)
+{
+  std::string gateName = std::string("port$") + half;
+  if (!p_node->isGateVector(gateName.c_str())) {
+    if (port != 1) {
+      opp_error("-E- %s HCA %s has no port: %d",
+                getFullPath().c_str(), p_node->getName(), port);
+    }
+    return p_node->gate(gateName.c_str());
+  }
+  if (port > p_node->gateSize(gateName.c_str())) {
+    opp_error("-E- %s switch %s has no port: %d",
+              getFullPath().c_str(), p_node->getName(), port);
+  }
+  return p_node->gate(gateName.c_str(), port - 1);
+}
+
+cChannel *IBFabric::createWire(const TopoLink &link)
+{
+  cChannel *p_wire;
+  if (link.width) {
+    p_wire = cChannelType::get("ib_model.IBWire")->create("channel");
+    p_wire->par("width").setDoubleValue(link.width);
+    p_wire->par("speed").setDoubleValue(link.speed_Gbps);
+  } else {
+    p_wire = cChannelType::get(par("wireType").stringValue())->create("channel");
+  }
+
+  // the cable length sets the propagation delay of the IBWire
+  double length_m = link.length_m;
+  if (!length_m)
+    length_m = par("cableLength").doubleValue();
+  if (length_m > 0)
+    p_wire->par("length").setDoubleValue(length_m);
+  p_wire->finalizeParameters();
+  return p_wire;
+}
+
+void IBFabric::doBuildInside()
+{
+  IBProfiler::markStartup("ned-load");
+
+  // the NED declared submodules (checkpoint, profiler...)
+  cCompoundModule::doBuildInside();
+
+  parseHcasFile(par("hcasFile").stringValue());
+  parseTopoFile(par("topoFile").stringValue());
+  IBProfiler::markStartup("fabric-topo-parse");
+
+  // create the HCAs and switches
+  std::map<std::string, cModule *> modByName;
+  cModuleType *p_hcaType = cModuleType::get("ib_model.HCA");
+  for (std::map<std::string, int>::iterator hI = lidByHca.begin();
+       hI != lidByHca.end(); hI++) {
+    cModule *p_hca = p_hcaType->create(nedName((*hI).first).c_str(), this);
+    p_hca->par("srcLid").setLongValue((*hI).second);
+    p_hca->finalizeParameters();
+    p_hca->buildInside();
+    modByName[(*hI).first] = p_hca;
+  }
+
+  int switchPorts = par("switchPorts");
+  cModuleType *p_swType = cModuleType::get("ib_model.Switch");
+  for (std::map<std::string, int>::iterator sI = numPortsBySw.begin();
+       sI != numPortsBySw.end(); sI++) {
+    int numPorts = (*sI).second;
+    if (switchPorts) {
+      if (numPorts > switchPorts) {
+        opp_error("-E- %s switch %s uses port %d > switchPorts %d",
+                  getFullPath().c_str(), (*sI).first.c_str(), numPorts,
+                  switchPorts);
+      }
+      numPorts = switchPorts;
+    }
+    cModule *p_sw = p_swType->create(nedName((*sI).first).c_str(), this);
+    p_sw->par("numSwitchPorts").setDoubleValue(numPorts);
+    p_sw->finalizeParameters();
+    p_sw->setGateSize("port", numPorts);
+    p_sw->buildInside();
+    modByName[(*sI).first] = p_sw;
+  }
+  IBProfiler::markStartup("fabric-module-creation");
+
+  // connect both directions of every link once
+  std::set<std::pair<std::string, int> > connected;
+  for (unsigned int i = 0; i < links.size(); i++) {
+    const TopoLink &link = links[i];
+    std::pair<std::string, int> end(link.node, link.port);
+    std::pair<std::string, int> remEnd(link.remNode, link.remPort);
+    int isConn = connected.count(end);
+    int isRemConn = connected.count(remEnd);
+    if (isConn && isRemConn)
+      continue;
+    if (isConn || isRemConn) {
+      opp_error("-E- %s inconsistent topo link %s/P%d -> %s/P%d",
+                getFullPath().c_str(), link.node.c_str(), link.port,
+                link.remNode.c_str(), link.remPort);
+    }
+    connected.insert(end);
+    connected.insert(remEnd);
+
+    cModule *p_node = modByName[link.node];
+    cModule *p_remNode = modByName[link.remNode];
+    if (!p_remNode) {
+      opp_error("-E- %s link to unknown node %s", getFullPath().c_str(),
+                link.remNode.c_str());
+    }
+    getPortGate(p_node, link.port, "o")->connectTo(
+      getPortGate(p_remNode, link.remPort, "i"), createWire(link), true);
+    getPortGate(p_remNode, link.remPort, "o")->connectTo(
+      getPortGate(p_node, link.port, "i"), createWire(link), true);
+  }
+  IBProfiler::markStartup("fabric-connection");
+
+  EV << "-I- " << getFullPath() << " built " << lidByHca.size() << " HCAs "
+     << numPortsBySw.size() << " switches and " << connected.size()/2
+     << " links" << endl;
+}
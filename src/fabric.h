@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Fast Fabric Build - construct the network from a .topo file in C++
+//
+// Overview:
+// =========
+// Large fabrics come with generated static NED files (500KB for 1944
+// nodes) that take long to load and elaborate. The IBFabric network builds
+// the same fabric programmatically from the IBDM style .topo file that the
+// NED was generated from:
+//
+//   MTS800 SW-L2-0-0
+//     P1 -> Cougar H-1 P1
+//     P5 -> MTS800 SW-L1-0-0 P1
+//
+// Each block starts with the system type and name of a switch and lists its
+// ports. Port names must be P<n> (flat systems only, no directors - flatten
+// them first). Links listed from both sides are connected once. A link may
+// carry its width, speed and cable length as in "P1 -4x-10G-> ..." or
+// "P1 -4x-EDR-5m-> ..." (see link_spec.h) otherwise the wireType channel is
+// used. The cable length, or cableLength if not given, sets the propagation
+// delay of the wire.
+//
+// The HCAs are the nodes listed in the hcasFile (the ftree.hcas file, lines
+// of "H-1/U1/1 <lid>") which also provides their LIDs. All other nodes are
+// switches. Names follow the generated NED files: '-' turns into '_' and a
+// "_U1" suffix is added, such that SW-L0-0-0 is built as SW_L0_0_0_U1 and
+// H-1 as H_1_U1 and the same ini files apply.
+//
+// Run with only the src directory in the NED path to avoid loading the
+// static example NED files.
+//
+// Parameters:
+// topoFile - the .topo file
+// hcasFile - the HCA names and LIDs
+// wireType - the channel type used for links with no speed spec
+// cableLength - the cable length of links with no length spec
+// switchPorts - number of ports on each switch, 0 means the max port used
+//
+
+#ifndef __FABRIC_H
+#define __FABRIC_H
+
+#include <omnetpp.h>
+#include <map>
+#include <vector>
+
+//
+// A network compound module building its HCAs and switches from a topo file
+//
+class IBFabric : public cCompoundModule
+{
+ private:
+  // a link end as read from the topo file
+  class TopoLink {
+  public:
+    std::string node;       // the local node name
+    int port;               // the local port number (1 based)
+    std::string remNode;    // the remote node name
+    int remPort;            // the remote port number (1 based)
+    double width;           // link width or 0 if not given
+    double speed_Gbps;      // link speed or 0 if not given
+    double length_m;        // cable length or 0 if not given
+  };
+
+  std::map<std::string, int> lidByHca;  // HCA LIDs by topo name
+  std::map<std::string, int> numPortsBySw; // switch max port by topo name
+  std::vector<TopoLink> links;
+
+  void parseHcasFile(const char *fileName);
+  void parseTopoFile(const char *fileName);
+  std::string nedName(const std::string &topoName);
+  cGate *getPortGate(cModule *p_node, int port, const char *half);
+  cChannel *createWire(const TopoLink &link);
+
+ protected:
+  virtual void doBuildInside();
+};
+
+#endif
@@ -0,0 +1,370 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBFailures applies scheduled failures and FDB reloads and measures
+// the throughput loss and recovery time.
+// See functional description in the header file.
+//
+#include "ib_m.h"
+#include "failures.h"
+#include "obuf.h"
+#include "pktfwd.h"
+#include "sink.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+Define_Module( IBFailures );
+
+static bool failureEventBefore(const FailureEvent &a, const FailureEvent &b)
+{
+  return a.time < b.time;
+}
+
+void IBFailures::initialize()
+{
+  sampleTime_s = par("sampleTime");
+  baselineSamples = par("baselineSamples");
+  recoveryFraction = par("recoveryFraction");
+  recoveryWindow = par("recoveryWindow");
+
+  // the scenario parameter events are separated by ';'
+  std::string scenario = par("scenario").stdstringValue();
+  std::istringstream ss(scenario);
+  std::string line;
+  while (std::getline(ss, line, ';'))
+    parseEvent(line);
+
+  std::string scenarioFile = par("scenarioFile").stdstringValue();
+  if (scenarioFile.size()) {
+    std::ifstream f(scenarioFile.c_str());
+    if (!f.good()) {
+      opp_error("-E- %s can not open scenarioFile: %s",
+                getFullPath().c_str(), scenarioFile.c_str());
+    }
+    while (std::getline(f, line))
+      parseEvent(line);
+  }
+  std::stable_sort(events.begin(), events.end(), failureEventBefore);
+
+  nextEvent = 0;
+  lastBytes = 0;
+  inDisruption = false;
+  totLostBytes = 0;
+  numUnrecovered = 0;
+  thrVec.setName("Fabric-Throughput-Gbps");
+  recoveryTimeStat.setName("Failure-Recovery-Time");
+  baselineStat.setName("Failure-Baseline-Gbps");
+  minThrStat.setName("Failure-Min-Gbps");
+  WATCH(nextEvent);
+
+  p_eventMsg = new cMessage("failure");
+  p_sampleMsg = new cMessage("sample");
+  if (events.empty()) {
+    EV << "-I- " << getFullPath() << " no failure events" << endl;
+    return;
+  }
+
+  if ((sampleTime_s <= 0) || (baselineSamples == 0)) {
+    opp_error("-E- %s requires positive sampleTime and baselineSamples",
+              getFullPath().c_str());
+  }
+  EV << "-I- " << getFullPath() << " scheduled " << events.size()
+     << " failure events" << endl;
+  scheduleAt(events[0].time, p_eventMsg);
+  scheduleAt(simTime() + sampleTime_s, p_sampleMsg);
+}
+
+void IBFailures::registerSink(IBSink *p_sink)
+{
+  sinks.push_back(p_sink);
+}
+
+// parse "<usec> <op> <args>" - flaps are expanded into down and up events.
+// Only blank and comment lines are skipped
+void IBFailures::parseEvent(const std::string &line)
+{
+  std::string l = line.substr(0, line.find('#'));
+  if (l.find_first_not_of(" \t\r\n") == std::string::npos)
+    return;
+  std::istringstream is(l);
+  double time_us;
+  std::string op;
+  if (!(is >> time_us) || (time_us < 0)) {
+    opp_error("-E- %s failure event: %s has no valid time",
+              getFullPath().c_str(), line.c_str());
+  }
+  if (!(is >> op)) {
+    opp_error("-E- %s failure event: %s has no operation",
+              getFullPath().c_str(), line.c_str());
+  }
+
+  FailureEvent event;
+  event.time = time_us * 1e-6;
+  event.port = -1;
+  event.inFlap = false;
+  bool ok = true;
+  if ((op == "link_down") || (op == "link_up")) {
+    event.op = (op == "link_down") ? FailureEvent::LINK_DOWN : FailureEvent::LINK_UP;
+    ok = (is >> event.node >> event.port);
+  } else if ((op == "switch_down") || (op == "switch_up")) {
+    event.op = (op == "switch_down") ?
+      FailureEvent::SWITCH_DOWN : FailureEvent::SWITCH_UP;
+    ok = (is >> event.node);
+  } else if (op == "fdb") {
+    event.op = FailureEvent::FDB_LOAD;
+    ok = (is >> event.node >> event.fdbFile);
+    if (ok && !(is >> event.port))
+      event.port = -1;
+  } else if (op == "flap") {
+    double period_us;
+    int count;
+    ok = (is >> event.node >> event.port >> period_us >> count) &&
+      (period_us > 0) && (count > 0);
+    for (int i = 0; ok && (i < count); i++) {
+      event.op = FailureEvent::LINK_DOWN;
+      event.inFlap = (i > 0);
+      event.time = (time_us + 2*i*period_us) * 1e-6;
+      events.push_back(event);
+      event.op = FailureEvent::LINK_UP;
+      event.inFlap = false;
+      event.time = (time_us + (2*i+1)*period_us) * 1e-6;
+      events.push_back(event);
+    }
+    if (ok) return;
+  } else {
+    ok = false;
+  }
+
+  if (!ok) {
+    opp_error("-E- %s bad failure event: %s", getFullPath().c_str(),
+              line.c_str());
+  }
+  events.push_back(event);
+}
+
+// the network submodule of the given name
+cModule *IBFailures::getNode(const std::string &name)
+{
+  cModule *p_node = simulation.getSystemModule()->getSubmodule(name.c_str());
+  if (!p_node) {
+    opp_error("-E- %s failure event node: %s not found",
+              getFullPath().c_str(), name.c_str());
+  }
+  return p_node;
+}
+
+// the OBUF driving the node port or the one driving it from the remote side
+// NULL if the port is not connected
+IBOutBuf *IBFailures::getPortOBuf(cModule *p_node, int port, bool remote)
+{
+  const char *gateName = remote ? "port$i" : "port$o";
+  cGate *p_gate;
+  if (p_node->isGateVector("port")) {
+    if ((port < 0) || (port >= p_node->gateSize("port"))) {
+      opp_error("-E- %s node: %s has no port: %d", getFullPath().c_str(),
+                p_node->getFullName(), port);
+    }
+    p_gate = p_node->gate(gateName, port);
+  } else {
+    p_gate = p_node->gate(gateName);
+  }
+  return dynamic_cast<IBOutBuf *>(p_gate->getPathStartGate()->getOwnerModule());
+}
+
+// fail or recover both directions of the link on the node port
+void IBFailures::setLink(cModule *p_node, int port, bool up)
+{
+  IBOutBuf *p_local = getPortOBuf(p_node, port, false);
+  IBOutBuf *p_remote = getPortOBuf(p_node, port, true);
+  if (!p_local || !p_remote)
+    return;
+  EV << "-I- " << getFullPath() << " link " << p_node->getFullName()
+     << " port:" << port << (up ? " UP" : " DOWN") << endl;
+  p_local->setLinkUp(up);
+  p_remote->setLinkUp(up);
+}
+
+// reload the FDB of a switch
+void IBFailures::loadFDB(cModule *p_node, const FailureEvent &event)
+{
+  Pktfwd *p_fwd = dynamic_cast<Pktfwd *>(p_node->getSubmodule("pktfwd"));
+  if (!p_fwd) {
+    opp_error("-E- %s fdb event node: %s is not a switch",
+              getFullPath().c_str(), p_node->getFullName());
+  }
+  int fdbIdx = event.port;
+  if (fdbIdx < 0)
+    fdbIdx = p_fwd->par("fdbIndex");
+  p_fwd->loadFDB(event.fdbFile.c_str(), fdbIdx);
+}
+
+void IBFailures::applyEvent(const FailureEvent &event)
+{
+  switch (event.op) {
+  case FailureEvent::LINK_DOWN:
+  case FailureEvent::LINK_UP:
+    setLink(getNode(event.node), event.port, event.op == FailureEvent::LINK_UP);
+    break;
+  case FailureEvent::SWITCH_DOWN:
+  case FailureEvent::SWITCH_UP: {
+    cModule *p_node = getNode(event.node);
+    if (!p_node->getSubmodule("pktfwd")) {
+      opp_error("-E- %s switch event node: %s is not a switch",
+                getFullPath().c_str(), event.node.c_str());
+    }
+    EV << "-I- " << getFullPath() << " switch " << event.node
+       << (event.op == FailureEvent::SWITCH_UP ? " UP" : " DOWN") << endl;
+    for (int p = 0; p < p_node->gateSize("port"); p++)
+      setLink(p_node, p, event.op == FailureEvent::SWITCH_UP);
+    break;
+  }
+  case FailureEvent::FDB_LOAD:
+    if (event.node == "*") {
+      // all the switches reload in this single event
+      cModule *p_sys = simulation.getSystemModule();
+      for (cModule::SubmoduleIterator iter(p_sys); !iter.end(); iter++)
+        if (iter()->getSubmodule("pktfwd"))
+          loadFDB(iter(), event);
+    } else {
+      loadFDB(getNode(event.node), event);
+    }
+    break;
+  }
+
+  // the later downs of a flap extend the disruption of its first down
+  if (((event.op == FailureEvent::LINK_DOWN) && !event.inFlap) ||
+      (event.op == FailureEvent::SWITCH_DOWN))
+    startDisruption();
+}
+
+// a down event - close the previous disruption and start a new one
+void IBFailures::startDisruption()
+{
+  if (inDisruption)
+    endDisruption();
+
+  baselineGbps = 0;
+  for (unsigned int i = 0; i < recentGbps.size(); i++)
+    baselineGbps += recentGbps[i];
+  if (recentGbps.size())
+    baselineGbps /= recentGbps.size();
+
+  inDisruption = true;
+  disruptStart = simTime();
+  lastBelowTime = simTime();
+  minGbps = baselineGbps;
+  lostBytes = 0;
+  EV << "-I- " << getFullPath() << " disruption started with baseline:"
+     << baselineGbps << " Gbps" << endl;
+}
+
+// record the disruption
+void IBFailures::endDisruption()
+{
+  inDisruption = false;
+  simtime_t recoveryTime = lastBelowTime - disruptStart;
+  recoveryTimeStat.collect(recoveryTime);
+  baselineStat.collect(baselineGbps);
+  minThrStat.collect(minGbps);
+  totLostBytes += lostBytes;
+  EV << "-I- " << getFullPath() << " disruption of:" << recoveryTime
+     << " min:" << minGbps << " Gbps lost:" << lostBytes << " bytes" << endl;
+}
+
+// close the last disruption - it never recovered if its last sample is
+// still below target
+void IBFailures::closeDisruption()
+{
+  if (!inDisruption)
+    return;
+  if (lastBelowTime + sampleTime_s >= simTime())
+    numUnrecovered++;
+  endDisruption();
+}
+
+// sample the fabric throughput and track the disruption
+void IBFailures::handleSample()
+{
+  double bytes = 0;
+  for (unsigned int i = 0; i < sinks.size(); i++)
+    bytes += sinks[i]->getDeliveredBytes();
+  double gbps = (bytes - lastBytes) * 8 / sampleTime_s / 1e9;
+  lastBytes = bytes;
+  thrVec.record(gbps);
+
+  if (inDisruption) {
+    if (gbps < minGbps)
+      minGbps = gbps;
+    if (gbps < baselineGbps)
+      lostBytes += (baselineGbps - gbps) * 1e9 / 8 * sampleTime_s;
+    if (gbps < recoveryFraction * baselineGbps)
+      lastBelowTime = simTime();
+  } else {
+    recentGbps.push_back(gbps);
+    if (recentGbps.size() > baselineSamples)
+      recentGbps.pop_front();
+  }
+
+  // stop sampling once the last event had its recovery window
+  if ((recoveryWindow > 0) && (nextEvent == events.size()) &&
+      (simTime() >= events.back().time + recoveryWindow)) {
+    closeDisruption();
+    EV << "-I- " << getFullPath() << " stopped sampling at:" << simTime()
+       << endl;
+    return;
+  }
+  scheduleAt(simTime() + sampleTime_s, p_sampleMsg);
+}
+
+void IBFailures::handleMessage(cMessage *p_msg)
+{
+  if (p_msg == p_sampleMsg) {
+    handleSample();
+    return;
+  }
+
+  // apply all the events of this time
+  while ((nextEvent < events.size()) &&
+         (events[nextEvent].time <= simTime()))
+    applyEvent(events[nextEvent++]);
+  if (nextEvent < events.size())
+    scheduleAt(events[nextEvent].time, p_eventMsg);
+}
+
+void IBFailures::finish()
+{
+  if (events.empty())
+    return;
+
+  closeDisruption();
+  recordScalar("Failure-Events", events.size());
+  recoveryTimeStat.record();
+  baselineStat.record();
+  minThrStat.record();
+  recordScalar("Failure-Lost-MB", totLostBytes / 1e6);
+  recordScalar("Failure-Unrecovered", numUnrecovered);
+}
+
+IBFailures::~IBFailures()
+{
+  if (p_eventMsg) cancelAndDelete(p_eventMsg);
+  if (p_sampleMsg) cancelAndDelete(p_sampleMsg);
+}
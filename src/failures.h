@@ -0,0 +1,155 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Failure Injection - scheduled link and switch failures and FDB reloads
+//
+// Overview:
+// =========
+// The controller applies a scenario of failure events at given times and
+// measures how the aggregate fabric throughput collapses and recovers:
+// * Link down/up - both directions of the link fail. The OBUFs complete
+//   the packet on the wire and then discard all the data they get while
+//   the link is down (see obuf.h), such that no buffer is left blocked.
+// * Switch down/up - all the links of the switch fail or recover.
+// * Flap - the link goes down and up period apart count times. The whole
+//   flap is measured as a single disruption.
+// * FDB reload - the switch (or all switches) replace their FDB by a
+//   precomputed one from an fdbs vec file. All the switches of a single
+//   event reload together. Packets already routed keep their out port.
+//
+// Scenario:
+// =========
+// Events are given in the scenario parameter (separated by ';') and/or in
+// the scenarioFile (one per line, # starts a comment). Times are in usec,
+// nodes are the network submodule names and ports are port gate indexes:
+//
+//   10 link_down SW_L1_0_0_U1 3
+//   12 fdb * reroute.fdbs
+//   30 link_up SW_L1_0_0_U1 3
+//   40 switch_down SW_L2_0_0_U1
+//   50 flap H_1_U1 0 5 4
+//   60 fdb SW_L0_0_0_U1 reroute.fdbs 7
+//
+// An fdb event of * loads each switch its own fdbIndex from the file.
+//
+// Throughput loss and recovery:
+// =============================
+// The sinks register on initialize and the controller samples their
+// delivered bytes every sampleTime. A down event starts a disruption with
+// a baseline of the mean throughput of the last baselineSamples samples.
+// The disruption lasts until the next down event, or until the sampling
+// stops recoveryWindow after the last event (or the end of the run).
+// Its recovery time is the time from the failure to the end of the last
+// sample below recoveryFraction of the baseline. The lost bytes sum the
+// throughput deficit below the baseline over the disruption.
+//
+// Parameters:
+// scenario - ';' separated events
+// scenarioFile - a file of events, one per line
+// sampleTime - the throughput sampling period
+// baselineSamples - number of samples averaged for the baseline
+// recoveryFraction - the fraction of the baseline considered recovered
+// recoveryWindow - sampling stops this long after the last event. If 0 the
+//   sampling never stops and the run must be bound by sim-time-limit
+//
+
+#ifndef __FAILURES_H
+#define __FAILURES_H
+
+#include <omnetpp.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+class IBSink;
+class IBOutBuf;
+
+// a single scheduled failure event
+class FailureEvent {
+public:
+  enum failOps { LINK_DOWN, LINK_UP, SWITCH_DOWN, SWITCH_UP, FDB_LOAD };
+  simtime_t time;
+  failOps op;
+  std::string node;    // the network submodule name or * (fdb only)
+  int port;            // link port or FDB index (-1 keeps the fdbIndex)
+  std::string fdbFile; // the fdbs vec file
+  bool inFlap;         // a flap down after its first - the flap continues
+};
+
+//
+// Failure injection and recovery measurement; see NED for more info.
+//
+class IBFailures : public cSimpleModule
+{
+ private:
+  cMessage *p_eventMsg;
+  cMessage *p_sampleMsg;
+
+  // parameters
+  double sampleTime_s;          // the throughput sampling period
+  unsigned int baselineSamples; // samples averaged for the baseline
+  double recoveryFraction;      // fraction of the baseline to recover to
+  simtime_t recoveryWindow;     // sampling time left after the last event
+
+  // state
+  std::vector<FailureEvent> events; // the scenario sorted by time
+  unsigned int nextEvent;           // the next event to apply
+  std::vector<IBSink*> sinks;       // registered sinks
+  double lastBytes;                 // delivered bytes at the last sample
+  std::deque<double> recentGbps;    // the last samples for the baseline
+  bool inDisruption;                // a down event was applied
+  simtime_t disruptStart;           // time of the down event
+  simtime_t lastBelowTime;          // end of the last sample below target
+  double baselineGbps;              // the disruption baseline
+  double minGbps;                   // the disruption min throughput
+  double lostBytes;                 // the disruption throughput deficit
+
+  // statistics
+  cOutVector thrVec;            // fabric throughput samples
+  cStdDev recoveryTimeStat;     // recovery time of the disruptions
+  cStdDev baselineStat;         // baseline throughput of the disruptions
+  cStdDev minThrStat;           // min throughput of the disruptions
+  double totLostBytes;          // lost bytes of all disruptions
+  unsigned int numUnrecovered;  // disruptions below target at the end
+
+  // methods
+  void parseEvent(const std::string &line);
+  cModule *getNode(const std::string &name);
+  IBOutBuf *getPortOBuf(cModule *p_node, int port, bool remote);
+  void setLink(cModule *p_node, int port, bool up);
+  void loadFDB(cModule *p_node, const FailureEvent &event);
+  void applyEvent(const FailureEvent &event);
+  void startDisruption();
+  void endDisruption();
+  void closeDisruption();
+  void handleSample();
+
+ public:
+  // called by the sinks on initialize
+  void registerSink(IBSink *p_sink);
+
+ protected:
+  virtual void initialize();
+  virtual void handleMessage(cMessage *msg);
+  virtual void finish();
+  virtual ~IBFailures();
+};
+
+#endif
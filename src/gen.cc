@@ -35,12 +35,14 @@
 #include "ib_m.h"
 #include "gen.h"
 #include "vlarb.h"
+#include "profiler.h"
 #include <vec_file.h>
 
 Define_Module(IBGenerator);
 
 // main init of the module
 void IBGenerator::initialize() {
+  IB_PROF_CALL("IBGenerator::initialize");
   // General non-volatile parameters
   srcLid = par("srcLid");
   flitSize_B = par("flitSize"); 
@@ -55,19 +57,305 @@ void IBGenerator::initialize() {
   pktId = 0;
   msgIdx = 0;
 
-  // init the vector of incoming messages
+  // init the per app queues of incoming messages
   numApps = gateSize("in");
-  appMsgs.resize(numApps, NULL);
-  curApp = 0;
+  appWindow = par("appWindow");
+  appActive.resize(numApps, 0);
+  appWaiting.resize(numApps);
+  curMsg = activeMsgs.end();
+  rrNextMsg = activeMsgs.end();
   numContPkts = 0;
   maxContPkts = par("maxContPkts");
   maxQueuedPerVL = par("maxQueuedPerVL");
 
   pushMsg = new cMessage("push1", IB_PUSH_MSG);
+  for (unsigned int vl = 0; vl < 8; vl++)
+    vlPktMsg[vl] = NULL;
+
+  // the HCA port SL2VL table
+  maxVL = par("maxVL");
+  SL2VL = NULL;
+  const char *sl2vlFile = par("sl2vlVecFile");
+  if (strlen(sl2vlFile)) {
+    int sl2vlIdx = par("sl2vlIndex");
+    SL2VL = vecFiles::get()->getIntVec(sl2vlFile, sl2vlIdx);
+    if (!SL2VL || (SL2VL->size() != 16)) {
+      opp_error("-E- %s fail to obtain a 16 entries SL2VL table %s, %d",
+                getFullPath().c_str(), sl2vlFile, sl2vlIdx);
+    }
+    for (unsigned int sl = 0; sl < 16; sl++) {
+      if (((*SL2VL)[sl] < 0) || ((unsigned)(*SL2VL)[sl] > maxVL) ||
+          ((*SL2VL)[sl] >= 8)) {
+        opp_error("-E- %s SL2VL table %s, %d maps SL: %d to bad VL: %d",
+                  getFullPath().c_str(), sl2vlFile, sl2vlIdx, sl,
+                  (*SL2VL)[sl]);
+      }
+    }
+  }
+
+  shaperStalls = 0;
+  initShapers();
+  initQoS();
+  initTransport();
+  initMultipath();
 
   // no need for self start
 }
 
+// parse the shaper parameters and fill in the token buckets
+void IBGenerator::initShapers()
+{
+  const char *mode = par("shaperMode");
+  unsigned int numShapers;
+  if (!strcmp(mode, "none")) {
+    shaperMode = SHAPE_NONE;
+    return;
+  } else if (!strcmp(mode, "sl")) {
+    shaperMode = SHAPE_SL;
+    numShapers = 16;
+  } else if (!strcmp(mode, "app")) {
+    shaperMode = SHAPE_APP;
+    numShapers = numApps;
+  } else {
+    opp_error("-E- %s unknown shaperMode: %s", getFullPath().c_str(), mode);
+    return;
+  }
+
+  shaperBurst_B = par("shaperBurst");
+  if (shaperBurst_B < flitSize_B) {
+    opp_error("-E- %s shaperBurst: %d is smaller than a FLIT: %d",
+              getFullPath().c_str(), shaperBurst_B, flitSize_B);
+  }
+
+  const char *ratesStr = par("shaperRates");
+  std::vector<double> rates = cStringTokenizer(ratesStr).asDoubleVector();
+  if (rates.empty()) {
+    opp_error("-E- %s shaperMode: %s requires shaperRates",
+              getFullPath().c_str(), mode);
+  }
+
+  shapers.resize(numShapers);
+  for (unsigned int i = 0; i < numShapers; i++) {
+    double rate_Gbps = rates[i < rates.size() ? i : rates.size() - 1];
+    if (rate_Gbps < 0) {
+      opp_error("-E- %s negative shaperRates entry: %g",
+                getFullPath().c_str(), rate_Gbps);
+    }
+    shapers[i].rate_Bps = rate_Gbps * 1e9 / 8;
+    shapers[i].tokens_B = shaperBurst_B;
+    shapers[i].lastUpdate = 0;
+  }
+}
+
+// parse the QoS parameters
+void IBGenerator::initQoS()
+{
+  std::vector<int> highSLs =
+    cStringTokenizer(par("qosHighSLs").stringValue()).asIntVector();
+  std::vector<int> weights =
+    cStringTokenizer(par("qosSLWeights").stringValue()).asIntVector();
+  qosEnabled = !highSLs.empty() || !weights.empty();
+  qosCurSL = 0;
+  qosUsed_B = 0;
+  if (!qosEnabled)
+    return;
+
+  qosHighSL.resize(16, false);
+  for (unsigned int i = 0; i < highSLs.size(); i++) {
+    if ((highSLs[i] < 0) || (highSLs[i] > 15)) {
+      opp_error("-E- %s bad qosHighSLs SL: %d", getFullPath().c_str(),
+                highSLs[i]);
+    }
+    qosHighSL[highSLs[i]] = true;
+  }
+
+  qosWeight_B.resize(16);
+  for (unsigned int sl = 0; sl < 16; sl++) {
+    int weight = 1;
+    if (!weights.empty())
+      weight = weights[sl < weights.size() ? sl : weights.size() - 1];
+    if ((weight < 1) || (weight > 255)) {
+      opp_error("-E- %s qosSLWeights weight: %d of SL: %d is not 1-255",
+                getFullPath().c_str(), weight, sl);
+    }
+    qosWeight_B[sl] = 64 * weight;
+  }
+}
+
+// parse the reliable transport parameters
+void IBGenerator::initTransport()
+{
+  const char *mode = par("transport");
+  if (!strcmp(mode, "none")) {
+    transport = IB_TRANSPORT_NONE;
+  } else if (!strcmp(mode, "gbn")) {
+    transport = IB_TRANSPORT_GBN;
+  } else if (!strcmp(mode, "sr")) {
+    transport = IB_TRANSPORT_SR;
+  } else {
+    opp_error("-E- %s unknown transport: %s", getFullPath().c_str(), mode);
+  }
+
+  rtxTimeout = (double)par("rtxTimeout") * 1e-6;
+  rtxBufPkts = par("rtxBufPkts");
+  if ((transport != IB_TRANSPORT_NONE) && (rtxBufPkts == 0)) {
+    opp_error("-E- %s rtxBufPkts must be positive", getFullPath().c_str());
+  }
+  rtxCurPkt = NULL;
+  rtxFlitIdx = 0;
+  rtxPackets = 0;
+  rtxBytes = 0;
+  rtxTimeouts = 0;
+  naksReceived = 0;
+}
+
+// a 32 bit mixing function spreading the flows over the paths
+static unsigned int pathHash(unsigned int x)
+{
+  x ^= x >> 16;
+  x *= 0x85ebca6b;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35;
+  x ^= x >> 16;
+  return x;
+}
+
+// parse the LMC path selection parameters
+void IBGenerator::initMultipath()
+{
+  lmc = par("lmc");
+  if (lmc > 7) {
+    opp_error("-E- %s lmc: %d is above 7", getFullPath().c_str(), lmc);
+  }
+  if (srcLid & ((1 << lmc) - 1)) {
+    opp_error("-E- %s srcLid: %d is not aligned to its %d LIDs",
+              getFullPath().c_str(), srcLid, 1 << lmc);
+  }
+
+  const char *select = par("pathSelect");
+  if (!strcmp(select, "hash")) {
+    pathSelect = PATH_HASH;
+  } else if (!strcmp(select, "round_robin")) {
+    pathSelect = PATH_RR;
+  } else if (!strcmp(select, "lrc")) {
+    pathSelect = PATH_LRC;
+  } else {
+    opp_error("-E- %s unknown pathSelect: %s", getFullPath().c_str(), select);
+  }
+
+  const char *scope = par("pathScope");
+  if (!strcmp(scope, "msg")) {
+    pathPerQP = false;
+  } else if (!strcmp(scope, "qp")) {
+    pathPerQP = true;
+  } else {
+    opp_error("-E- %s unknown pathScope: %s", getFullPath().c_str(), scope);
+  }
+
+  pathRRNext = 0;
+  pathCongNotices = 0;
+  pathPackets.resize(1 << lmc, 0);
+}
+
+// select the path DLID of the message to its destination base LID
+unsigned int IBGenerator::selectPath(IBAppMsg *p_msg)
+{
+  unsigned int dstLid = p_msg->getDstLid();
+  unsigned int numPaths = 1 << lmc;
+  if ((numPaths == 1) || (dstLid >= IB_MC_LID_BASE))
+    return dstLid;
+
+  // the QP keeps its path
+  std::map<unsigned int, unsigned int>::iterator pI;
+  if (pathPerQP && ((pI = qpPath.find(dstLid)) != qpPath.end()))
+    return dstLid + (*pI).second;
+
+  unsigned int path;
+  if (pathSelect == PATH_HASH) {
+    unsigned int key = (srcLid << 16) ^ dstLid;
+    if (!pathPerQP)
+      key = pathHash(key) ^ p_msg->getMsgIdx();
+    path = pathHash(key) % numPaths;
+  } else if (pathSelect == PATH_RR) {
+    path = pathRRNext++ % numPaths;
+  } else {
+    // the least recently congested - ties are broken round robin
+    std::vector<simtime_t> &congTime = pathCongTime[dstLid];
+    if (congTime.empty())
+      congTime.resize(numPaths, 0);
+    path = pathRRNext++ % numPaths;
+    for (unsigned int i = 1; i < numPaths; i++) {
+      unsigned int p = (path + i) % numPaths;
+      if (congTime[p] < congTime[path])
+        path = p;
+    }
+  }
+
+  if (pathPerQP)
+    qpPath[dstLid] = path;
+  EV << "-I- " << getFullPath() << " message:" << p_msg->getName()
+     << " to:" << dstLid << " takes path:" << path << endl;
+  return dstLid + path;
+}
+
+// a destination sink found packets on the path congested
+void IBGenerator::pathCongested(unsigned int pathLid)
+{
+  Enter_Method_Silent();
+  if (!lmc || (pathSelect != PATH_LRC))
+    return;
+
+  unsigned int dstLid = pathLid & ~((1 << lmc) - 1);
+  unsigned int path = pathLid - dstLid;
+  std::vector<simtime_t> &congTime = pathCongTime[dstLid];
+  if (congTime.empty())
+    congTime.resize(1 << lmc, 0);
+  congTime[path] = simTime();
+  pathCongNotices++;
+
+  // the QP moves to a new path with its next message
+  std::map<unsigned int, unsigned int>::iterator pI = qpPath.find(dstLid);
+  if ((pI != qpPath.end()) && ((*pI).second == path))
+    qpPath.erase(pI);
+}
+
+// the token bucket of the given message or NULL if not limited
+tokenBucket *IBGenerator::getShaper(IBAppMsg *p_msg)
+{
+  tokenBucket *p_bucket;
+  if (shaperMode == SHAPE_SL) {
+    p_bucket = &shapers[p_msg->getSQ() & 0xf];
+  } else if (shaperMode == SHAPE_APP) {
+    p_bucket = &shapers[p_msg->getArrivalGate()->getIndex()];
+  } else {
+    return NULL;
+  }
+  if (p_bucket->rate_Bps == 0)
+    return NULL;
+  return p_bucket;
+}
+
+// refill the message bucket and return the time until it holds a FLIT
+// worth of tokens (0 if it can be sent now)
+simtime_t IBGenerator::getShaperDelay(IBAppMsg *p_msg)
+{
+  tokenBucket *p_bucket = getShaper(p_msg);
+  if (!p_bucket)
+    return 0;
+
+  p_bucket->tokens_B +=
+    p_bucket->rate_Bps * (simTime() - p_bucket->lastUpdate).dbl();
+  if (p_bucket->tokens_B > shaperBurst_B)
+    p_bucket->tokens_B = shaperBurst_B;
+  p_bucket->lastUpdate = simTime();
+
+  // allow one byte slack for the simtime rounding of the wakeup time
+  double missing_B = flitSize_B - p_bucket->tokens_B;
+  if (missing_B < 1.0)
+    return 0;
+  return missing_B / p_bucket->rate_Bps;
+}
+
 // initialize the packet with index pktIdx parameters on the message
 void IBGenerator::initPacketParams(IBAppMsg *p_msg, unsigned int pktIdx)
 {
@@ -113,48 +401,144 @@ int IBGenerator::isRemoteHoQFree(int vl){
   return(p_vla->isHoQFree(remotePortNum, vl));
 }
 
+// the SQ is the SL - map it through the SL2VL table if given
 unsigned int IBGenerator::vlBySQ(unsigned sq) 
 {
-  return(sq);
+  if (!SL2VL)
+    return(sq);
+  if (sq > 15) {
+    opp_error("-E- %s SQ: %d is not a valid SL", getFullPath().c_str(), sq);
+  }
+  return((*SL2VL)[sq]);
+}
+
+// return true if the message VLQ has space, no other message is inside a
+// packet on its VL and its shaper has tokens
+// track the minimal time to tokens in shaperWait
+bool IBGenerator::isMsgReady(IBAppMsg *p_msg)
+{
+  unsigned vl = vlBySQ(p_msg->getSQ());
+  simtime_t tokensDelay;
+  std::map<unsigned int, rcSendQP>::iterator qI;
+  if (vlPktMsg[vl] && (vlPktMsg[vl] != p_msg)) {
+    EV << "-I-" << getFullPath() << " skipping msg:" << p_msg->getName()
+       << " since a packet of:" << vlPktMsg[vl]->getName()
+       << " is in progress on VL:" << vl << endl;
+    return false;
+  } else if ((unsigned)VLQ[vl].length() >= maxQueuedPerVL) {
+    EV << "-I-" << getFullPath() << " skipping msg:" << p_msg->getName()
+       << " since VLQ[" << vl << "] is full" << endl;
+    return false;
+  } else if ((tokensDelay = getShaperDelay(p_msg)) > 0) {
+    EV << "-I-" << getFullPath() << " skipping msg:" << p_msg->getName()
+       << " since its shaper is out of tokens for " << tokensDelay << endl;
+    if ((shaperWait < 0) || (tokensDelay < shaperWait))
+      shaperWait = tokensDelay;
+    return false;
+  } else if ((transport != IB_TRANSPORT_NONE) && (p_msg->getFlitIdx() == 0) &&
+             ((qI = sendQPs.find(p_msg->getDstLid())) != sendQPs.end()) &&
+             ((*qI).second.unacked.size() >= rtxBufPkts)) {
+    EV << "-I-" << getFullPath() << " skipping msg:" << p_msg->getName()
+       << " since the retransmit buffer to:" << p_msg->getDstLid()
+       << " is full" << endl;
+    return false;
+  }
+  return true;
+}
+
+#define QOS_HIGH_CLASS 16
+
+// select the SL to serve: QOS_HIGH_CLASS if any strict priority SL is
+// ready, else the WRR SL. Return -1 if nothing is ready.
+int IBGenerator::selectQoSClass()
+{
+  std::vector<bool> slReady(16, false);
+  std::list<IBAppMsg *>::iterator mI;
+  for (mI = activeMsgs.begin(); mI != activeMsgs.end(); mI++)
+    if (isMsgReady(*mI))
+      slReady[(*mI)->getSQ() & 0xf] = true;
+
+  for (unsigned int sl = 0; sl < 16; sl++)
+    if (slReady[sl] && qosHighSL[sl])
+      return QOS_HIGH_CLASS;
+
+  // stay on the current SL while it has weight left
+  if (slReady[qosCurSL] && !qosHighSL[qosCurSL] &&
+      (qosUsed_B < qosWeight_B[qosCurSL]))
+    return qosCurSL;
+
+  for (unsigned int i = 1; i <= 16; i++) {
+    unsigned int sl = (qosCurSL + i) % 16;
+    if (slReady[sl] && !qosHighSL[sl]) {
+      qosCurSL = sl;
+      qosUsed_B = 0;
+      return sl;
+    }
+  }
+  return -1;
+}
+
+// return true if the message may be served in the given QoS class
+bool IBGenerator::isQoSClassMsg(IBAppMsg *p_msg, int qosClass)
+{
+  if (qosClass < 0)
+    return true;
+  unsigned int sl = p_msg->getSQ() & 0xf;
+  if (qosClass == QOS_HIGH_CLASS)
+    return qosHighSL[sl];
+  return (sl == (unsigned int)qosClass);
 }
 
-// scan through the available applications and schedule next one
-// take current VLQ threshold and maxContPkts into account
-// updates curApp
+// scan through the active messages and schedule next one
+// take current VLQ threshold, shaper tokens, QoS and maxContPkts into
+// account
+// updates curMsg and shaperWait
 // return true if found new appMsg to work on
 bool IBGenerator::arbitrateApps() 
 {
-  // try to stay with current app if possible
-  if (appMsgs[curApp]) {
-    unsigned vl = vlBySQ(appMsgs[curApp]->getSQ());
+  shaperWait = -1;
+  if (activeMsgs.empty()) {
+    EV << "-I-" << getFullPath() << " arbitrate apps found no app" << endl;
+    return false;
+  }
+
+  // the QoS arbitration restricts the served messages to a single class
+  int qosClass = qosEnabled ? selectQoSClass() : -1;
+
+  // try to stay with current message if possible
+  std::list<IBAppMsg *>::iterator mI;
+  if (curMsg != activeMsgs.end()) {
     if ((numContPkts < maxContPkts) && 
-        ((unsigned)VLQ[vl].length() < maxQueuedPerVL)) {
+        isQoSClassMsg(*curMsg, qosClass) && isMsgReady(*curMsg)) {
       EV << "-I-" << getFullPath() << " arbitrate apps continue" << endl;
       return true;
     }
+    mI = curMsg;
+    mI++;
+  } else {
+    // the served message was completed - start from the one following it
+    mI = rrNextMsg;
   }
 
-  unsigned int oldApp = curApp;
+  IBAppMsg *p_oldMsg = (curMsg != activeMsgs.end()) ? *curMsg : NULL;
   bool found = false;
-  // search through all apps return to current 
-  for (unsigned i = 1; !found && (i <= numApps); i++) {
-    unsigned int a = (curApp + i) % numApps;
-    EV << "-I-" << getFullPath() << " trying app: " << a << endl;
-    if (appMsgs[a]) {
-      unsigned vl = vlBySQ(appMsgs[a]->getSQ());
-      if ((unsigned)VLQ[vl].length() < maxQueuedPerVL) {
-        curApp = a;
-        EV << "-I-" << getFullPath() << " arbitrate apps selected:" 
-           << a << endl;
-        found = true;
-      } else {
-        EV << "-I-" << getFullPath() << " skipping app:" << a
-           << " since VLQ[" << vl << "] is full" << endl;
-      }
+  // search through all active messages return to current
+  for (unsigned i = 0; !found && (i < activeMsgs.size()); i++, mI++) {
+    if (mI == activeMsgs.end())
+      mI = activeMsgs.begin();
+    EV << "-I-" << getFullPath() << " trying msg: " << (*mI)->getName() << endl;
+    if (!isQoSClassMsg(*mI, qosClass)) {
+      EV << "-I-" << getFullPath() << " skipping msg:" << (*mI)->getName()
+         << " since its SL is not served now" << endl;
+    } else if (isMsgReady(*mI)) {
+      curMsg = mI;
+      EV << "-I-" << getFullPath() << " arbitrate apps selected:" 
+         << (*mI)->getName() << endl;
+      found = true;
     }
   }
 
-  if (oldApp != curApp) {
+  if (found && (p_oldMsg != *curMsg)) {
     numContPkts = 0;
   } else {
     numContPkts++;
@@ -166,13 +550,34 @@ bool IBGenerator::arbitrateApps()
   return found;
 }
 
+// make the message active - it joins the round robin
+void IBGenerator::activateAppMsg(IBAppMsg *p_msg, unsigned int a)
+{
+  // init the first packet parameters
+  initPacketParams(p_msg, 0);
+  activeMsgs.push_back(p_msg);
+  if (rrNextMsg == activeMsgs.end())
+    rrNextMsg = activeMsgs.begin();
+  appActive[a]++;
+}
+
 // Called when there is some active appMsg that can be
 // handled. Create the FLIT and place on VLQ, Maybe send (if VLA empty)
 // also may retire the appMsg and clean the appMsgs and send it back to 
 // its app
-void IBGenerator::getNextAppMsg()
+// return true if the FLIT was the last of its packet
+bool IBGenerator::getNextAppMsg()
 {
-  IBAppMsg *p_msg = appMsgs[curApp];
+  IBAppMsg *p_msg = *curMsg;
+
+  // consume the FLIT tokens
+  tokenBucket *p_bucket = getShaper(p_msg);
+  if (p_bucket)
+    p_bucket->tokens_B -= flitSize_B;
+
+  // charge the WRR served SL
+  if (qosEnabled && !qosHighSL[p_msg->getSQ() & 0xf])
+    qosUsed_B += flitSize_B;
 
   // IN THE MSG CONECT WE ALWAYS STORE NEXT (TO BE SENT) FLIT AND PKT INDEX
 
@@ -193,7 +598,10 @@ void IBGenerator::getNextAppMsg()
   p_cred->setBitLength(flitSize_B*8);
   p_cred->setByteLength(flitSize_B);
 
-  p_cred->setDstLid(thisPktDst);
+  // the path of the message is selected by its first FLIT
+  if (!thisFlitIdx && !thisPktIdx)
+    p_msg->setPathLid(selectPath(p_msg));
+  p_cred->setDstLid(p_msg->getPathLid());
   p_cred->setSL(p_msg->getSQ());
   p_cred->setVL(p_msg->getVL());
 
@@ -203,6 +611,9 @@ void IBGenerator::getNextAppMsg()
   p_cred->setAppIdx(thisAppIdx);
   p_cred->setPktIdx(thisPktIdx);
   p_cred->setMsgLen(thisMsgLen);
+  p_cred->setTag(p_msg->getTag());
+  p_cred->setRpcType(p_msg->getRpcType());
+  p_cred->setBarrierStage(p_msg->getBarrierStage());
   p_cred->setPacketLength(p_msg->getPktLenFlits());
   p_cred->setPacketLengthBytes(p_msg->getPktLenBytes());
 
@@ -218,6 +629,21 @@ void IBGenerator::getNextAppMsg()
 		  dstPktSn = ++lastPktSnPerDst[thisPktDst];
 	  }
 	  p_cred->setPacketSn(dstPktSn);
+	  if (thisPktDst < IB_MC_LID_BASE)
+		  pathPackets[p_msg->getPathLid() - thisPktDst]++;
+
+	  // keep a copy of the head for retransmission
+	  if ((transport != IB_TRANSPORT_NONE) && (thisPktDst < IB_MC_LID_BASE)) {
+		  rcSendQP &qp = sendQPs[thisPktDst];
+		  if (!qp.p_timer) {
+			  qp.dstLid = thisPktDst;
+			  qp.p_timer = new cMessage("rtx-timer", IB_RTX_TIMER_MSG);
+			  qp.p_timer->setContextPointer(&qp);
+		  }
+		  qp.unacked.push_back(p_cred->dup());
+		  if (!qp.p_timer->isScheduled())
+			  armRtxTimer(&qp);
+	  }
   } else {
 	  p_cred->setPacketSn(0);
   }
@@ -225,25 +651,32 @@ void IBGenerator::getNextAppMsg()
   // now we have a new FLIT at hand we can either Q it or send it over 
   // if there is a place for it in the VLA 
   unsigned int vl = p_msg->getVL();
-  if (VLQ[vl].empty() && isRemoteHoQFree(vl)) {
-    sendDataOut(p_cred);
-  } else {
-    VLQ[vl].insert(p_cred);
-    EV << "-I- " << getFullPath() << " Queue new FLIT " << p_cred->getName() << " as HoQ not free for vl:"
-       << vl << endl;
-  }
+  queueFLIT(p_cred, vl);
 
   // now anvance to next FLIT or declare the app msg done
 
   // decide if we are at end of packet or not
-  if (++thisFlitIdx == p_msg->getPktLenFlits()) {
+  bool pktEnd = (++thisFlitIdx == p_msg->getPktLenFlits());
+  vlPktMsg[vl] = pktEnd ? NULL : p_msg;
+  if (pktEnd) {
     // we completed a packet was it the last?
     if (++thisPktIdx == p_msg->getLenPkts()) {
       // we are done with the app msg
       EV << "-I- " << getFullPath() << " completed appMsg:" 
          << p_msg->getName() << endl;
-      send(p_msg, "in$o", curApp);
-      appMsgs[curApp] = NULL;
+      unsigned int a = p_msg->getArrivalGate()->getIndex();
+      send(p_msg, "in$o", a);
+      rrNextMsg = activeMsgs.erase(curMsg);
+      curMsg = activeMsgs.end();
+      if (rrNextMsg == activeMsgs.end())
+        rrNextMsg = activeMsgs.begin();
+
+      // the next queued message of the app takes the free window slot
+      appActive[a]--;
+      if (!appWaiting[a].empty()) {
+        activateAppMsg(appWaiting[a].front(), a);
+        appWaiting[a].pop_front();
+      }
     } else {
       p_msg->setPktIdx(thisPktIdx);
       initPacketParams(p_msg, thisPktIdx);
@@ -251,25 +684,253 @@ void IBGenerator::getNextAppMsg()
   } else {
     p_msg->setFlitIdx(thisFlitIdx);
   }
+  return pktEnd;
+}
+
+// send the FLIT to the VLA if its HoQ is free or queue it on the VLQ
+void IBGenerator::queueFLIT(IBDataMsg *p_cred, unsigned int vl)
+{
+  if (VLQ[vl].empty() && isRemoteHoQFree(vl)) {
+    sendDataOut(p_cred);
+  } else {
+    VLQ[vl].insert(p_cred);
+    EV << "-I- " << getFullPath() << " Queue new FLIT " << p_cred->getName() << " as HoQ not free for vl:"
+       << vl << endl;
+  }
+}
+
+// schedule a push if none is pending
+void IBGenerator::wakeUp()
+{
+  if (!pushMsg->isScheduled())
+    scheduleAt(simTime(), pushMsg);
+}
+
+// (re)start the retransmission timer of the QP
+void IBGenerator::armRtxTimer(rcSendQP *p_qp)
+{
+  if (p_qp->p_timer->isScheduled())
+    cancelEvent(p_qp->p_timer);
+  scheduleAt(simTime() + rtxTimeout, p_qp->p_timer);
+}
+
+// add the packet to the retransmission queue unless already there
+void IBGenerator::queueRetransmit(unsigned int dstLid, unsigned int psn)
+{
+  for (unsigned int i = 0; i < rtxQ.size(); i++)
+    if ((rtxQ[i].dstLid == dstLid) && (rtxQ[i].psn == psn))
+      return;
+  rcRtxReq req;
+  req.dstLid = dstLid;
+  req.psn = psn;
+  rtxQ.push_back(req);
+}
+
+// generate the next FLIT of the ACK/NAK and retransmitted packets.
+// A retransmitted packet in progress whose VLQ is full stalls the
+// generation - no app FLIT is generated until handleSent drains the VLQ
+IBTransportGen IBGenerator::genTransportFLIT(bool &pktEnd)
+{
+  pktEnd = true;
+
+  // a retransmitted packet is completed before anything else
+  if (rtxCurPkt) {
+    unsigned int vl = rtxCurPkt->getVL();
+    if ((unsigned)VLQ[vl].length() >= maxQueuedPerVL) {
+      EV << "-I- " << getFullPath() << " retransmission waits for VLQ["
+         << vl << "]" << endl;
+      return IB_TRANS_GEN_STALLED;
+    }
+  } else if (!ackQ.empty()) {
+    IBDataMsg *p_ack = ackQ.front();
+    unsigned int vl = p_ack->getVL();
+    if (!vlPktMsg[vl] && ((unsigned)VLQ[vl].length() < maxQueuedPerVL)) {
+      ackQ.pop_front();
+      queueFLIT(p_ack, vl);
+      return IB_TRANS_GEN_FLIT;
+    }
+  }
+
+  // start the next retransmission whose packet is still unacknowledged
+  while (!rtxCurPkt && !rtxQ.empty()) {
+    rcRtxReq req = rtxQ.front();
+    std::map<unsigned int, rcSendQP>::iterator qI = sendQPs.find(req.dstLid);
+    if ((qI == sendQPs.end()) || (*qI).second.unacked.empty() ||
+        (req.psn < (unsigned)(*qI).second.unacked.front()->getPacketSn())) {
+      rtxQ.pop_front();
+      continue;
+    }
+    // the unacked PSNs are consecutive
+    unsigned int base = (*qI).second.unacked.front()->getPacketSn();
+    IBDataMsg *p_head = (*qI).second.unacked[req.psn - base];
+    unsigned int vl = p_head->getVL();
+    if (vlPktMsg[vl] || ((unsigned)VLQ[vl].length() >= maxQueuedPerVL))
+      return IB_TRANS_GEN_NONE;
+    rtxQ.pop_front();
+    rtxCurPkt = p_head->dup();
+    rtxFlitIdx = 0;
+    rtxPackets++;
+  }
+
+  if (!rtxCurPkt)
+    return IB_TRANS_GEN_NONE;
+
+  IBDataMsg *p_cred = rtxCurPkt->dup();
+  char name[128];
+  sprintf(name, "rtx-%d-%d-%d-%d", srcLid, rtxCurPkt->getDstLid(),
+          rtxCurPkt->getPacketSn(), rtxFlitIdx);
+  p_cred->setName(name);
+  p_cred->setFlitSn(rtxFlitIdx);
+  if (rtxFlitIdx)
+    p_cred->setPacketSn(0);
+  rtxBytes += flitSize_B;
+  queueFLIT(p_cred, rtxCurPkt->getVL());
+
+  pktEnd = (++rtxFlitIdx == (unsigned)rtxCurPkt->getPacketLength());
+  if (pktEnd) {
+    delete rtxCurPkt;
+    rtxCurPkt = NULL;
+  }
+  return IB_TRANS_GEN_FLIT;
+}
+
+// called by the HCA sink - build the ACK/NAK packet, a queued one to the
+// same LID is replaced as the new one carries the latest state
+void IBGenerator::queueTransportAck(unsigned int dstLid, unsigned int sl,
+                                   int op, unsigned int ackPsn)
+{
+  Enter_Method_Silent();
+  for (unsigned int i = 0; i < ackQ.size(); i++) {
+    if ((unsigned)ackQ[i]->getDstLid() == dstLid) {
+      ackQ[i]->setTransportOp(op);
+      ackQ[i]->setAckPsn(ackPsn);
+      return;
+    }
+  }
+
+  char name[128];
+  sprintf(name, "%s-%d-%d-%d", op == IB_TRANS_NAK ? "nak" : "ack",
+          srcLid, dstLid, ackPsn);
+  IBDataMsg *p_ack = new IBDataMsg(name, IB_DATA_MSG);
+  p_ack->setSrcLid(srcLid);
+  p_ack->setDstLid(dstLid);
+  p_ack->setBitLength(flitSize_B*8);
+  p_ack->setByteLength(flitSize_B);
+  p_ack->setSL(sl);
+  p_ack->setVL(vlBySQ(sl));
+  p_ack->setFlitSn(0);
+  p_ack->setMsgLen(1);
+  p_ack->setPacketLength(1);
+  p_ack->setPacketLengthBytes(flitSize_B);
+  p_ack->setTransportOp(op);
+  p_ack->setAckPsn(ackPsn);
+  p_ack->setBeforeAnySwitch(true);
+  ackQ.push_back(p_ack);
+  wakeUp();
+}
+
+// called by the HCA sink - release the acknowledged packets and
+// retransmit on NAK
+void IBGenerator::transportAckReceived(unsigned int dstLid, int op,
+                                       unsigned int ackPsn)
+{
+  Enter_Method_Silent();
+  std::map<unsigned int, rcSendQP>::iterator qI = sendQPs.find(dstLid);
+  if (qI == sendQPs.end())
+    return;
+  rcSendQP &qp = (*qI).second;
+
+  bool progress = false;
+  while (!qp.unacked.empty() &&
+         ((unsigned)qp.unacked.front()->getPacketSn() <= ackPsn)) {
+    delete qp.unacked.front();
+    qp.unacked.pop_front();
+    progress = true;
+  }
+
+  EV << "-I- " << getFullPath() << (op == IB_TRANS_NAK ? " NAK" : " ACK")
+     << " from:" << dstLid << " psn:" << ackPsn << " unacked:"
+     << qp.unacked.size() << endl;
+
+  if ((op == IB_TRANS_NAK) && !qp.unacked.empty()) {
+    naksReceived++;
+    if (transport == IB_TRANSPORT_GBN) {
+      for (unsigned int i = 0; i < qp.unacked.size(); i++)
+        queueRetransmit(dstLid, qp.unacked[i]->getPacketSn());
+    } else {
+      queueRetransmit(dstLid, ackPsn + 1);
+    }
+  }
+
+  if (qp.unacked.empty())
+    cancelEvent(qp.p_timer);
+  else if (progress || (op == IB_TRANS_NAK))
+    armRtxTimer(&qp);
+
+  // the retransmit buffer may have space now
+  wakeUp();
+}
+
+// no ACK progress for rtxTimeout
+void IBGenerator::handleRtxTimer(cMessage *p_msg)
+{
+  rcSendQP *p_qp = (rcSendQP *)p_msg->getContextPointer();
+  if (p_qp->unacked.empty())
+    return;
+
+  rtxTimeouts++;
+  EV << "-I- " << getFullPath() << " retransmission timeout to:"
+     << p_qp->dstLid << " unacked:" << p_qp->unacked.size() << endl;
+  if (transport == IB_TRANSPORT_GBN) {
+    for (unsigned int i = 0; i < p_qp->unacked.size(); i++)
+      queueRetransmit(p_qp->dstLid, p_qp->unacked[i]->getPacketSn());
+  } else {
+    queueRetransmit(p_qp->dstLid, p_qp->unacked.front()->getPacketSn());
+  }
+  armRtxTimer(p_qp);
+  wakeUp();
 }
 
 // arbitrate for next app, generate its FLIT and schedule next push
 void IBGenerator::genNextAppFLIT() 
 {
+  // ACKs and retransmissions go first
+  bool pktEnd;
+  if (transport != IB_TRANSPORT_NONE) {
+    IBTransportGen res = genTransportFLIT(pktEnd);
+    if (res != IB_TRANS_GEN_NONE) {
+      if (pushMsg->isScheduled())
+        cancelEvent(pushMsg);
+      // handleSent pushes again once the stalled VLQ drains
+      if (res == IB_TRANS_GEN_STALLED)
+        return;
+      double gap_ns = pktEnd ? par("pkt2PktGap") : par("flit2FlitGap");
+      simtime_t delay = genDlyPerByte_ns*1e-9*flitSize_B + gap_ns*1e-9;
+      scheduleAt(simTime()+delay, pushMsg);
+      return;
+    }
+  }
+
   // get the next application to work on
   if (!arbitrateApps()) {
     // may be we do not have anything to do
     if (pushMsg->isScheduled()) {
       cancelEvent(pushMsg);
     }
+    // wake up when the first blocked message has enough tokens
+    if (shaperWait > 0) {
+      shaperStalls++;
+      scheduleAt(simTime()+shaperWait, pushMsg);
+    }
     return;
   }
 
   // place the next app msg FLIT into the VLQ and maybe send it
-  getNextAppMsg();
+  pktEnd = getNextAppMsg();
 
-  // schedule next push
-  simtime_t delay = genDlyPerByte_ns*1e-9*flitSize_B;
+  // schedule next push adding the shaping gap
+  double gap_ns = pktEnd ? par("pkt2PktGap") : par("flit2FlitGap");
+  simtime_t delay = genDlyPerByte_ns*1e-9*flitSize_B + gap_ns*1e-9;
   scheduleAt(simTime()+delay, pushMsg);
 }
 
@@ -284,30 +945,29 @@ void IBGenerator::handleApp(IBAppMsg *p_msg){
   // decide what port it was provided on
   unsigned int a = p_msg->getArrivalGate()->getIndex();
 
-  // check that the app is empty or error
-  if (appMsgs[a] != NULL) {
-    error("provided app %d message but app not empty!", a);
-  }
-
   // count total of messages injected
   msgIdx++;
 
-  // init the first packet parameters
-  initPacketParams(p_msg, 0);
-  
-  // store it
-  appMsgs[a] = p_msg;
-  
-  // if there is curApp msg or waiting on push pushMsg = do nothing
-  if (((curApp != a) && (appMsgs[curApp] != NULL)) || ( pushMsg->isScheduled())) {
+  // queue the message if the app already has a full window of messages
+  if (appWindow && (appActive[a] >= appWindow)) {
+    appWaiting[a].push_back(p_msg);
+    EV << "-I-" << getFullPath() << " new app message:" << p_msg->getName()
+       << " queued since app:" << a << " has " << appActive[a]
+       << " active messages" << endl;
+    return;
+  }
+
+  activateAppMsg(p_msg, a);
+
+  // if there is curMsg or waiting on push pushMsg = do nothing
+  if ((curMsg != activeMsgs.end()) || ( pushMsg->isScheduled())) {
     EV << "-I-" << getFullPath() << " new app message:" << p_msg->getName()
-       << " queued since previous message:" << appMsgs[curApp]->getName() 
-       << " being served" << endl;
+       << " queued since previous message being served" << endl;
     return;
   }
 
-  // force the new app to be arbitrated
-  curApp = a;
+  // force the new message to be arbitrated
+  curMsg = --activeMsgs.end();
 
   genNextAppFLIT();
 }
@@ -320,6 +980,8 @@ void IBGenerator::sendDataOut(IBDataMsg *p_msg){
   // time stamp to enable tracking time in Fabric
   p_msg->setInjectionTime(simTime()+delay_ns*1e-9);
   p_msg->setTimestamp(simTime()+delay_ns*1e-9);
+  p_msg->setStageTime(simTime());
+  startLatencyHop(p_msg);
   totalBytesSent += bytes;
 
   sendDelayed(p_msg, delay_ns*1e-9, "out");
@@ -365,11 +1027,14 @@ void IBGenerator::handleSent(IBSentMsg *p_sent){
 }
 
 void IBGenerator::handleMessage(cMessage *p_msg) {
+  IB_PROF_EVENT(p_msg);
   int msgType = p_msg->getKind();
   if ( msgType == IB_SENT_MSG ) {
     handleSent((IBSentMsg *)p_msg);
   } else if ( msgType == IB_APP_MSG ) {
     handleApp((IBAppMsg*)p_msg);
+  } else if ( msgType == IB_RTX_TIMER_MSG ) {
+    handleRtxTimer(p_msg);
   } else {
     handlePush(p_msg);
   }
@@ -379,8 +1044,110 @@ void IBGenerator::finish()
 {
   double oBW = totalBytesSent / (simTime() - firstPktSendTime);
   ev << "STAT: " << getFullPath() << " Gen Output BW (B/s):" << oBW  << endl; 
+  if (shaperMode != SHAPE_NONE)
+    recordScalar("Shaper-Stalls", shaperStalls);
+  if (transport != IB_TRANSPORT_NONE) {
+    recordScalar("Retransmitted-Packets", rtxPackets);
+    recordScalar("Retransmitted-Bytes", rtxBytes);
+    recordScalar("Rtx-Timeouts", rtxTimeouts);
+    recordScalar("NAKs-Received", naksReceived);
+  }
+  if (lmc) {
+    char buf[32];
+    for (unsigned int p = 0; p < pathPackets.size(); p++) {
+      sprintf(buf, "Path-%d-Packets", p);
+      recordScalar(buf, pathPackets[p]);
+    }
+    if (pathSelect == PATH_LRC)
+      recordScalar("Path-Congestion-Notices", pathCongNotices);
+  }
+}
+
+static void snap(stateSnapshot &s, tokenBucket &b)
+{
+  snap(s, b.rate_Bps);
+  snap(s, b.tokens_B);
+  snap(s, b.lastUpdate);
+}
+
+static void snap(stateSnapshot &s, rcRtxReq &r)
+{
+  snap(s, r.dstLid);
+  snap(s, r.psn);
+}
+
+// the retransmission timer is created with the QP
+static void snap(stateSnapshot &s, rcSendQP &qp)
+{
+  snap(s, qp.dstLid);
+  snap(s, qp.unacked);
+  bool hasTimer = (qp.p_timer != NULL);
+  snap(s, hasTimer);
+  if (!hasTimer) return;
+  if (!qp.p_timer) {
+    qp.p_timer = new cMessage("rtx-timer", IB_RTX_TIMER_MSG);
+    qp.p_timer->setContextPointer(&qp);
+  }
+  s.timer(qp.p_timer);
+}
+
+void IBGenerator::snapshotState(stateSnapshot &s)
+{
+  snap(s, msgIdx);
+  snap(s, pktId);
+  snap(s, numContPkts);
+
+  // the iterators are kept as indices of the active messages (-1 is end)
+  snap(s, activeMsgs);
+  long curIdx = -1, rrNextIdx = -1, i = 0;
+  std::list<IBAppMsg *>::iterator mI;
+  for (mI = activeMsgs.begin(); mI != activeMsgs.end(); mI++, i++) {
+    if (mI == curMsg) curIdx = i;
+    if (mI == rrNextMsg) rrNextIdx = i;
+  }
+  snap(s, curIdx);
+  snap(s, rrNextIdx);
+  if (s.isLoading()) {
+    curMsg = rrNextMsg = activeMsgs.end();
+    for (mI = activeMsgs.begin(), i = 0; mI != activeMsgs.end(); mI++, i++) {
+      if (i == curIdx) curMsg = mI;
+      if (i == rrNextIdx) rrNextMsg = mI;
+    }
+  }
+  snap(s, appActive);
+  snap(s, appWaiting);
+
+  for (unsigned int vl = 0; vl < 8; vl++) {
+    s.queue(VLQ[vl]);
+    s.ref(vlPktMsg[vl]);
+  }
+  s.timer(pushMsg);
+
+  snap(s, lastPktSnPerDst);
+  snap(s, shapers);
+  snap(s, shaperWait);
+  snap(s, qosCurSL);
+  snap(s, qosUsed_B);
+
+  snap(s, sendQPs);
+  snap(s, rtxQ);
+  s.msg(rtxCurPkt);
+  snap(s, rtxFlitIdx);
+  snap(s, ackQ);
+  snap(s, pathRRNext);
+  snap(s, qpPath);
+  snap(s, pathCongTime);
 }
 
 IBGenerator::~IBGenerator() {
   if (pushMsg) cancelAndDelete(pushMsg);
+  std::map<unsigned int, rcSendQP>::iterator qI;
+  for (qI = sendQPs.begin(); qI != sendQPs.end(); qI++) {
+    cancelAndDelete((*qI).second.p_timer);
+    for (unsigned int i = 0; i < (*qI).second.unacked.size(); i++)
+      delete (*qI).second.unacked[i];
+  }
+  for (unsigned int i = 0; i < ackQ.size(); i++)
+    delete ackQ[i];
+  if (rtxCurPkt) delete rtxCurPkt;
 }
@@ -27,11 +27,26 @@
 // be served by the HCA.
 // 
 // The requests arrives on the in port and are saved per application.
+// Each app may provide many messages (one per QP). Up to appWindow of them
+// are active and the rest wait in the app queue.
 // At any given time there is one appMsg that is being served and it
 // continue sending out unless the VL buffer for it fills in or maxContPkts
-// is reached. When it is done the scheduler Round Robin on the messages.
+// is reached. When it is done the scheduler Round Robin on the active
+// messages of all apps.
 //
-// TBD: support QoS
+// Packets of different messages on the same VL are never interleaved - a
+// message that started a packet is the only one served on its VL until
+// the packet end.
+//
+// QoS:
+// When qosHighSLs or qosSLWeights are set the arbiter first selects an SL
+// and then round robin on the messages of that SL. Messages of the high
+// SLs are served by strict priority. The other SLs are served by weighted
+// round robin - an SL is served until it sends its weight of 64 bytes
+// units or has nothing ready and then the next ready SL is selected.
+// qosHighSLs - list of SLs served by strict priority
+// qosSLWeights - the WRR weights by SL [64B]. The last weight applies to
+//   the rest of the SLs.
 //
 // Packet generation can be configured with the following set of orthogonal
 // mechanisms:
@@ -58,6 +73,7 @@
 // It will serve max of maxContPkts of the current app.
 //
 // Parameters for destination selection:
+// appWindow - maximal active messages per app (0 is unlimited)
 // maxContPkts - maximal number of packets of single app to send
 // maxQueuedPerVL - the maximal outstanding FLITs in Q per VL
 // 
@@ -71,15 +87,77 @@
 // Traffic Shaping:
 // ================
 // Parameters that control shaping:
-// flit2FlitGap_ns - the extra delay from one flit end to the other start [ns]
-// pkt2PktGap_ns - the extra delay from one packet end to the next start [ns]
+// flit2FlitGap - the extra delay from one flit end to the other start [ns]
+// pkt2PktGap - the extra delay from one packet end to the next start [ns]
+// shaperMode - none, sl or app - selects a token bucket per SL or per app
+// shaperRates - the bucket rates [Gbps] by SL or app index. The last rate
+//   applies to the rest of the buckets. A rate of 0 is not limited.
+// shaperBurst - the depth of each token bucket [B]
+//
+// The gaps are added to the push delay after each FLIT (or packet end).
+// The token buckets are refilled by the elapsed time. A message whose
+// bucket does not hold a FLIT worth of tokens is skipped by the app
+// arbiter. If all messages are blocked by their buckets the next push is
+// scheduled for the time the first bucket will hold enough tokens.
+// This models the HCA static rate limiting and its effect on congestion.
 // 
 // SQ/VL selection:
 // ================
-// Currently there is one to one mapping
+// The SQ is used as the packet SL. The VL is looked up in the HCA port
+// SL2VL table (16 entries) or equals the SL if no table is provided.
 //
 // parameters
 // maxVL - the value of the maximal VL
+// sl2vlVecFile - the vector file holding the SL2VL table
+// sl2vlIndex - the index of the SL2VL table in the file
+//
+// Reliable Transport:
+// ===================
+// When transport is gbn or sr the generator and the sink of the HCA
+// implement an RC like transport with a QP per destination. The PSN is
+// the packetSn of the packet head. The generator keeps a copy of the head
+// FLIT of every unacknowledged packet - up to rtxBufPkts per destination.
+// A message does not start a new packet to a destination with a full
+// retransmit buffer.
+// The destination sink returns coalesced ACK and NAK packets through its
+// generator (see sink.h). ACKs are cumulative. On a NAK the generator
+// retransmits all the unacknowledged packets (gbn) or only the requested
+// one (sr). If no ACK progress is made for rtxTimeout the unacknowledged
+// packets (gbn) or the oldest one (sr) are retransmitted.
+// ACKs and retransmitted packets are served before new app packets. They
+// are only started on VLs with no partial app packet.
+// NOTE: messages are still reported done to the app once generated.
+// Packets to multicast LIDs are unreliable (like UD) and never tracked.
+//
+// parameters
+// transport - none, gbn (go back N) or sr (selective repeat)
+// rtxTimeout - the retransmission timeout [usec]
+// rtxBufPkts - the retransmit buffer size per destination [packets]
+//
+// Multipath (LMC):
+// ================
+// An HCA with lmc > 0 owns the LIDs srcLid .. srcLid + 2^lmc - 1 (srcLid
+// must be aligned) and the FDBs route each of them on its own path (see
+// utils/ibdm2ned -m). Apps address the base LID of the destination and
+// the generator selects the path DLID by pathSelect:
+// hash - a hash of the source, the destination and the message index
+//   (the QP is hashed without the message index)
+// round_robin - the next path in turn
+// lrc - the least recently congested path to the destination. Sinks
+//   report the paths of packets queued over their pathCongThreshold
+//   (see sink.h) to the source generator.
+// The path is selected on the first FLIT of a message. With pathScope qp
+// the first message to a destination selects the path of its QP and the
+// following ones keep it - unless lrc was told it is congested.
+// All the HCAs must use the same lmc (the sinks verify it when they first
+// mark a path congested). Packets of a message sent over
+// several paths may arrive out of order which the sinks count by the
+// packetSn. Transport QPs are kept per destination and not per path.
+//
+// parameters
+// lmc - the HCA owns 2^lmc LIDs (0 is a single path)
+// pathSelect - hash, round_robin or lrc
+// pathScope - msg or qp
 //
 // Other Parameters:
 // =================
@@ -91,12 +169,46 @@
 #define __GEN_H
 
 #include <omnetpp.h>
+#include <list>
+#include <deque>
+#include "snapshot.h"
 
 
+// the reliable transport modes
+enum IBTransportMode { IB_TRANSPORT_NONE, IB_TRANSPORT_GBN, IB_TRANSPORT_SR };
+
+// the result of generating a transport FLIT
+enum IBTransportGen {
+  IB_TRANS_GEN_NONE,    // nothing to send - serve the apps
+  IB_TRANS_GEN_FLIT,    // a FLIT was generated
+  IB_TRANS_GEN_STALLED  // a retransmission waits for its VLQ to drain
+};
+
+// the sender side of a reliable transport QP (one per destination)
+struct rcSendQP {
+  unsigned int dstLid;
+  std::deque<IBDataMsg *> unacked; // head FLIT copies of unacked packets
+  cMessage *p_timer;               // the retransmission timer
+  rcSendQP() { dstLid = 0; p_timer = NULL; }
+};
+
+// a packet waiting for retransmission
+struct rcRtxReq {
+  unsigned int dstLid;
+  unsigned int psn;
+};
+
+// a token bucket rate limiter - tokens are bytes
+struct tokenBucket {
+  double rate_Bps;      // refill rate - 0 means not limited
+  double tokens_B;      // available tokens
+  simtime_t lastUpdate; // time tokens were last refilled
+};
+
 //
 // Generates IB Packet Credit (messages); see NED file for more info.
 //
-class IBGenerator : public cSimpleModule
+class IBGenerator : public cSimpleModule, public snapshotModule
 {
  private:
   // parameters:
@@ -107,28 +219,69 @@ class IBGenerator : public cSimpleModule
   double genDlyPerByte_ns;    // the time it takes to bring Byte from PCIe
 
   // - shape
-  double flit2FlitGap_ns; // extra delay from one flit end to the other
-  double pkt2PktGap_ns;   // extra delay from one packet end to the next
+  enum { SHAPE_NONE, SHAPE_SL, SHAPE_APP } shaperMode;
+  unsigned int shaperBurst_B; // token bucket depth
+
+  // - QoS
+  bool qosEnabled;                 // true if SL arbitration is used
+  std::vector<bool> qosHighSL;     // true if the SL is strict priority
+  std::vector<unsigned int> qosWeight_B; // WRR weight by SL
    
   // - VL
   unsigned int maxVL;
+  std::vector<int> *SL2VL; // VL by SL or NULL if VL = SL
+
+  // - transport
+  IBTransportMode transport;
+  simtime_t rtxTimeout;       // the retransmission timeout
+  unsigned int rtxBufPkts;    // max unacked packets per destination
+
+  // - multipath
+  unsigned int lmc;           // the HCA LIDs are srcLid + 0..2^lmc-1
+  enum { PATH_HASH, PATH_RR, PATH_LRC } pathSelect;
+  bool pathPerQP;             // keep the path of the destination QP
 
   // state
   unsigned int msgIdx;              // count number of messages injected
-  unsigned int curApp;              // currently surved app
   unsigned int numApps;             // width of the in port
+  unsigned int appWindow;           // max active messages per app (0 no limit)
   unsigned int numContPkts;         // count the number of packets of same app
-  std::vector< IBAppMsg *> appMsgs; // requested messages by app port
+  std::list<IBAppMsg *> activeMsgs; // messages being round robin served
+  std::list<IBAppMsg *>::iterator curMsg; // currently surved msg or end
+  std::list<IBAppMsg *>::iterator rrNextMsg; // next to try once curMsg done
+  std::vector<unsigned int> appActive; // number of active messages by app
+  std::vector<std::deque<IBAppMsg *> > appWaiting; // queued msgs by app
   cQueue VLQ[8];                    // holds outstanding out packets if any
+  IBAppMsg *vlPktMsg[8];            // msg with a partially generated packet
   unsigned int pktId;               // packets counter
   cMessage *pushMsg;                // the self push message
   std::map<unsigned int, unsigned int> lastPktSnPerDst; // last packet serial number per DST
+  std::vector<tokenBucket> shapers; // token buckets by SL or app
+  simtime_t shaperWait;             // min time to tokens of blocked msgs
+  unsigned int qosCurSL;            // the SL being served by the WRR
+  unsigned int qosUsed_B;           // bytes sent by the current WRR SL
+  std::map<unsigned int, rcSendQP> sendQPs; // transport QPs by destination
+  std::deque<rcRtxReq> rtxQ;        // packets waiting for retransmission
+  IBDataMsg *rtxCurPkt;             // the head of the retransmitted packet
+  unsigned int rtxFlitIdx;          // next FLIT of the retransmitted packet
+  std::deque<IBDataMsg *> ackQ;     // ACK/NAK packets to be sent
+  unsigned int pathRRNext;          // the next round robin path
+  std::map<unsigned int, unsigned int> qpPath; // path by destination (qp scope)
+  // the last time each path to the destination was reported congested
+  std::map<unsigned int, std::vector<simtime_t> > pathCongTime;
 
 
   // statistics
   simtime_t firstPktSendTime; // the first send time
   unsigned int totalBytesSent; // total number of bytes sent
   simtime_t timeLastSent; // Time last flit was sent
+  unsigned int shaperStalls; // times all messages were blocked by tokens
+  unsigned int rtxPackets;   // number of retransmitted packets
+  unsigned int rtxBytes;     // number of retransmitted bytes
+  unsigned int rtxTimeouts;  // number of retransmission timeouts
+  unsigned int naksReceived; // number of NAKs received
+  std::vector<unsigned int> pathPackets; // packets sent on each path
+  unsigned int pathCongNotices; // path congestion reports received
 
   // methods
  private:
@@ -136,10 +289,27 @@ class IBGenerator : public cSimpleModule
   // Create a new FLIT for the current Packet
   IBDataMsg *getNewDataMsg();
 
+  void initShapers();
+  tokenBucket *getShaper(IBAppMsg *p_msg);
+  simtime_t getShaperDelay(IBAppMsg *p_msg);
+  void initQoS();
+  bool isMsgReady(IBAppMsg *p_msg);
+  int selectQoSClass();
+  bool isQoSClassMsg(IBAppMsg *p_msg, int qosClass);
   bool arbitrateApps();
-  void getNextAppMsg();
+  void activateAppMsg(IBAppMsg *p_msg, unsigned int a);
+  bool getNextAppMsg();
   void genNextAppFLIT();
   void initPacketParams(IBAppMsg *p_msg, unsigned int pktIdx);
+  void queueFLIT(IBDataMsg *p_cred, unsigned int vl);
+  void initTransport();
+  void wakeUp();
+  void armRtxTimer(rcSendQP *p_qp);
+  void queueRetransmit(unsigned int dstLid, unsigned int psn);
+  IBTransportGen genTransportFLIT(bool &pktEnd);
+  void handleRtxTimer(cMessage *p_msg);
+  void initMultipath();
+  unsigned int selectPath(IBAppMsg *p_msg);
   unsigned int vlBySQ(unsigned sq);
   int  isRemoteHoQFree(int vl);
   void sendDataOut(IBDataMsg *p_msg); 
@@ -147,6 +317,16 @@ class IBGenerator : public cSimpleModule
   void handleSent(IBSentMsg *p_sent);
   void handleApp(IBAppMsg *p_msg);
   virtual ~IBGenerator();
+ public:
+  // called by the HCA sink: send an ACK/NAK packet to the given LID
+  void queueTransportAck(unsigned int dstLid, unsigned int sl, int op,
+                         unsigned int ackPsn);
+  // called by the HCA sink: an ACK/NAK was received from the given LID
+  void transportAckReceived(unsigned int dstLid, int op, unsigned int ackPsn);
+  // called by a destination sink: the path to the given DLID is congested
+  void pathCongested(unsigned int pathLid);
+  // the served messages, VL queues, shapers and transport QPs
+  virtual void snapshotState(stateSnapshot &s);
  protected:
   virtual void initialize();
   virtual void handleMessage(cMessage *msg);
@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The customized IBDataMsg - see ib_data_msg.h
+//
+
+#include "ib_m.h"
+
+Register_Class(IBDataMsg);
+
+// the packet fields are not generated so they are packed here
+void IBDataMsg::parsimPack(cCommBuffer *b)
+{
+  IBDataMsg_Base::parsimPack(b);
+  b->pack(p_body->appIdx);
+  b->pack(p_body->msgIdx);
+  b->pack(p_body->msgLen);
+  b->pack(p_body->pktIdx);
+  b->pack(p_body->tag);
+  b->pack(p_body->rpcType);
+  b->pack(p_body->barrierStage);
+  b->pack(p_body->packetId);
+  b->pack(p_body->packetSn);
+  b->pack(p_body->transportOp);
+  b->pack(p_body->ackPsn);
+  b->pack(p_body->flitSn);
+  b->pack(p_body->PacketLength);
+  b->pack(p_body->PacketLengthBytes);
+  b->pack(p_body->dstLid);
+  b->pack(p_body->srcLid);
+  b->pack(p_body->SL);
+  b->pack(p_body->useStatic);
+  b->pack(p_body->injectionTime);
+}
+
+void IBDataMsg::parsimUnpack(cCommBuffer *b)
+{
+  IBDataMsg_Base::parsimUnpack(b);
+  getOwnBody();
+  b->unpack(p_body->appIdx);
+  b->unpack(p_body->msgIdx);
+  b->unpack(p_body->msgLen);
+  b->unpack(p_body->pktIdx);
+  b->unpack(p_body->tag);
+  b->unpack(p_body->rpcType);
+  b->unpack(p_body->barrierStage);
+  b->unpack(p_body->packetId);
+  b->unpack(p_body->packetSn);
+  b->unpack(p_body->transportOp);
+  b->unpack(p_body->ackPsn);
+  b->unpack(p_body->flitSn);
+  b->unpack(p_body->PacketLength);
+  b->unpack(p_body->PacketLengthBytes);
+  b->unpack(p_body->dstLid);
+  b->unpack(p_body->srcLid);
+  b->unpack(p_body->SL);
+  b->unpack(p_body->useStatic);
+  b->unpack(p_body->injectionTime);
+}
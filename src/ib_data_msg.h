@@ -0,0 +1,137 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBDataMsg of ib.msg: the per hop fields are generated and the packet
+// fields are kept in an IBDataBody shared by all the copies of the FLIT.
+//
+// A dup() of a FLIT (the multicast copies, the retransmitted packets) shares
+// the body and increments its reference count. A setter of a packet field
+// on a shared body first makes the body private (copy on write), so the
+// copies always behave as full copies.
+//
+// Included by ib_m.h after IBDataMsg_Base is declared.
+//
+
+#ifndef __IB_DATA_MSG_H
+#define __IB_DATA_MSG_H
+
+// the packet fields of a FLIT
+class IBDataBody
+{
+ public:
+  unsigned int refCount; // the number of FLIT copies sharing the body
+  int appIdx;
+  int msgIdx;
+  int msgLen;
+  int pktIdx;
+  int tag;
+  int rpcType;
+  int barrierStage;
+  int packetId;
+  int packetSn;
+  int transportOp;
+  int ackPsn;
+  int flitSn;
+  int PacketLength;
+  int PacketLengthBytes;
+  int dstLid;
+  int srcLid;
+  int SL;
+  int useStatic;
+  simtime_t injectionTime;
+
+  IBDataBody() : refCount(1), appIdx(0), msgIdx(0), msgLen(0), pktIdx(0),
+    tag(0), rpcType(0), barrierStage(-1), packetId(0), packetSn(0), transportOp(0), ackPsn(0),
+    flitSn(0), PacketLength(0), PacketLengthBytes(0), dstLid(0), srcLid(0),
+    SL(0), useStatic(0) {};
+};
+
+// the getter and copy on write setter of a packet field
+#define IB_DATA_BODY_FIELD(type, Name, field) \
+  virtual type get##Name() const { return p_body->field; }; \
+  virtual void set##Name(type v) { getOwnBody()->field = v; };
+
+class IBDataMsg : public IBDataMsg_Base
+{
+ private:
+  IBDataBody *p_body;
+
+  void releaseBody() {
+    if (!--p_body->refCount) delete p_body;
+  };
+
+  // the body for writing - copied if shared
+  IBDataBody *getOwnBody() {
+    if (p_body->refCount > 1) {
+      p_body->refCount--;
+      p_body = new IBDataBody(*p_body);
+      p_body->refCount = 1;
+    }
+    return p_body;
+  };
+
+ public:
+  IBDataMsg(const char *name = NULL, int kind = 0) :
+    IBDataMsg_Base(name, kind) { p_body = new IBDataBody(); };
+  IBDataMsg(const IBDataMsg &other) : IBDataMsg_Base(other) {
+    p_body = other.p_body;
+    p_body->refCount++;
+  };
+  IBDataMsg &operator=(const IBDataMsg &other) {
+    if (this == &other) return *this;
+    IBDataMsg_Base::operator=(other);
+    other.p_body->refCount++;
+    releaseBody();
+    p_body = other.p_body;
+    return *this;
+  };
+  virtual ~IBDataMsg() { releaseBody(); };
+  virtual IBDataMsg *dup() const { return new IBDataMsg(*this); };
+
+  // true if other FLIT copies share the packet fields
+  bool isBodyShared() const { return p_body->refCount > 1; };
+
+  virtual void parsimPack(cCommBuffer *b);
+  virtual void parsimUnpack(cCommBuffer *b);
+
+  IB_DATA_BODY_FIELD(int, AppIdx, appIdx)
+  IB_DATA_BODY_FIELD(int, MsgIdx, msgIdx)
+  IB_DATA_BODY_FIELD(int, MsgLen, msgLen)
+  IB_DATA_BODY_FIELD(int, PktIdx, pktIdx)
+  IB_DATA_BODY_FIELD(int, Tag, tag)
+  IB_DATA_BODY_FIELD(int, RpcType, rpcType)
+  IB_DATA_BODY_FIELD(int, BarrierStage, barrierStage)
+  IB_DATA_BODY_FIELD(int, PacketId, packetId)
+  IB_DATA_BODY_FIELD(int, PacketSn, packetSn)
+  IB_DATA_BODY_FIELD(int, TransportOp, transportOp)
+  IB_DATA_BODY_FIELD(int, AckPsn, ackPsn)
+  IB_DATA_BODY_FIELD(int, FlitSn, flitSn)
+  IB_DATA_BODY_FIELD(int, PacketLength, PacketLength)
+  IB_DATA_BODY_FIELD(int, PacketLengthBytes, PacketLengthBytes)
+  IB_DATA_BODY_FIELD(int, DstLid, dstLid)
+  IB_DATA_BODY_FIELD(int, SrcLid, srcLid)
+  IB_DATA_BODY_FIELD(int, SL, SL)
+  IB_DATA_BODY_FIELD(int, UseStatic, useStatic)
+  IB_DATA_BODY_FIELD(simtime_t, InjectionTime, injectionTime)
+};
+
+#undef IB_DATA_BODY_FIELD
+
+#endif
@@ -25,6 +25,8 @@
 #include "ib_m.h"
 #include "ibuf.h"
 #include "vlarb.h"
+#include "obuf.h"
+#include "profiler.h"
 #include <vec_file.h>
 
 Define_Module( IBInBuf );
@@ -54,15 +56,26 @@ void IBInBuf::parseIntListParam(char *parName, int numEntries,
 
 void IBInBuf::initialize()
 {
+  IB_PROF_CALL("IBInBuf::initialize");
   lossyMode = par("lossyMode");
   numDroppedCredits = 0;
   WATCH(numDroppedCredits);
   maxVL = par("maxVL");
   
+  // multicast FLITs are held by several Qs so the Qs do not own the FLITs
   Q = new cQueue*[gateSize("out")];
   for (int pn = 0; pn < gateSize("out"); pn++) {
     Q[pn] = new cQueue[maxVL+1];
+    for (unsigned int vl = 0; vl < maxVL+1; vl++)
+      Q[pn][vl].setTakeOwnership(false);
   }
+  hoqInVL.resize(gateSize("out"), std::vector<int>(maxVL+1, -1));
+  hoqMcRef.resize(gateSize("out"), std::vector<long>(maxVL+1, -1));
+  fwdTimers.resize(gateSize("out"),
+                   std::vector<IBFwdTimerMsg *>(maxVL+1, (IBFwdTimerMsg *)NULL));
+  lastMcRef = 0;
+  numMcPackets = 0;
+  numMcFlitCopies = 0;
   maxBeingSent = par("maxBeingSent");
   numPorts = par("numPorts");
   totalBufferSize = par("totalBufferSize");      
@@ -74,6 +87,7 @@ void IBInBuf::initialize()
   if (hcaIBuf) {
     EV << "-I- " << getFullPath() << " is HCA IBuf" << endl;
     pktfwd = NULL;
+    ISWDelay = 0;
   } else {
     EV << "-I- " << getFullPath() << " is Switch IBuf " << getId() <<  endl;
     Switch = getParentModule()->getParentModule();
@@ -85,6 +99,18 @@ void IBInBuf::initialize()
       opp_error("Could not find Packet FWDer");
     }
     ISWDelay = Switch->par("ISWDelay");
+
+    const char *mode = Switch->par("fwdMode");
+    if (!strcmp(mode, "cut_through")) {
+      fwdMode = FWD_CUT_THROUGH;
+    } else if (!strcmp(mode, "store_and_forward")) {
+      fwdMode = FWD_STORE_AND_FORWARD;
+    } else if (!strcmp(mode, "cut_through_threshold")) {
+      fwdMode = FWD_CT_THRESHOLD;
+    } else {
+      opp_error("-E- %s unknown fwdMode: %s", getFullPath().c_str(), mode);
+    }
+    ctMinFlits = Switch->par("ctMinFlits");
   }
 
   // track how many parallel sends the IBUF do:
@@ -94,19 +120,29 @@ void IBInBuf::initialize()
   // read Max Static parameters
   unsigned int totStatic = 0;
   int val;
+  int bdpCredits = getBDPCredits();
   for (unsigned int vl = 0; vl < maxVL+1; vl++ ) {
-    char parName[12];
-    sprintf(parName,"maxStatic%d", vl);
-    val = par(parName);
-    val = val*width/4;
+    if (bdpCredits) {
+      val = bdpCredits;
+    } else {
+      char parName[12];
+      sprintf(parName,"maxStatic%d", vl);
+      val = par(parName);
+      val = val*width/4;
+    }
     maxStatic.push_back(val);
     totStatic += val;
   }
+
+  // the BDP sized VL buffers may be larger than the configured buffer
+  if (bdpCredits && (totStatic > totalBufferSize))
+    totalBufferSize = totStatic;
   
   if (totStatic > totalBufferSize) {
     opp_error("-E- can not define total static (%d) > (%d) total buffer size",
               totStatic, totalBufferSize);
   }
+  initSharedBuffer(totStatic);
   
   // Initiazlize the statistical collection elements
   for (unsigned int vl = 0; vl < maxVL+1; vl++ ) {
@@ -120,18 +156,21 @@ void IBInBuf::initialize()
   for (unsigned int vl = 0; vl < maxVL+1; vl++ ) {
     ABR.push_back(0);
     staticFree.push_back(maxStatic[vl]);
-    sendRxCred(vl, 1e-9);
   }
+  for (unsigned int vl = 0; vl < maxVL+1; vl++ )
+    sendRxCred(vl, 1e-9);
   
   WATCH_VECTOR(ABR);
   WATCH_VECTOR(staticFree);
   usedStaticCredits.setName("static credits used");
   
-  lastSendTime = 0;
   curPacketId  = 0;
   curPacketSrcLid = 0;
   curPacketCredits = 0;
+  curPacketFlitsRcvd = 0;
+  curPacketHead = NULL;
   curPacketVL = -1;
+  curPacketOutVL = -1;
   curPacketOutPort = -1;
 
   gate("in")->setDeliverOnReceptionStart(true);
@@ -139,7 +178,113 @@ void IBInBuf::initialize()
   thisPortNum = getParentModule()->getIndex();
 } // init
 
+// the buffer above the static credits forms the shared pool
+void IBInBuf::initSharedBuffer(unsigned int totStatic)
+{
+  sharedBuffer = par("sharedBuffer");
+  sharedFree = 0;
+  totalSharedUsed = 0;
+  sharedGrant.resize(maxVL+1, 0);
+  sharedUsed.resize(maxVL+1, 0);
+  if (!sharedBuffer)
+    return;
+
+  if (lossyMode) {
+    opp_error("-E- %s sharedBuffer is not supported in lossyMode",
+              getFullPath().c_str());
+  }
+
+  std::vector<double> alphas =
+    cStringTokenizer(par("sharedAlpha").stringValue()).asDoubleVector();
+  if (alphas.empty()) {
+    opp_error("-E- %s sharedBuffer requires sharedAlpha",
+              getFullPath().c_str());
+  }
+  for (unsigned int vl = 0; vl < maxVL+1; vl++) {
+    double alpha = alphas[vl < alphas.size() ? vl : alphas.size() - 1];
+    if (alpha < 0) {
+      opp_error("-E- %s negative sharedAlpha: %g", getFullPath().c_str(),
+                alpha);
+    }
+    sharedAlpha.push_back(alpha);
+  }
+  sharedGrantCredits = par("sharedGrantCredits");
+  sharedFree = totalBufferSize - totStatic;
+  usedSharedCredits.setName("shared credits used");
+  sharedUsageStat.setName("Used Shared Credits");
+  EV << "-I- " << getFullPath() << " shared pool credits:" << sharedFree
+     << endl;
+}
+
+// top up the shared credits granted to the VL by the dynamic threshold
+// return the number of newly granted credits
+unsigned int IBInBuf::grantSharedCredits(int vl)
+{
+  if (!sharedBuffer || (sharedGrant[vl] >= sharedGrantCredits))
+    return 0;
+
+  unsigned int held = sharedGrant[vl] + sharedUsed[vl];
+  unsigned int threshold = (unsigned int)(sharedAlpha[vl] * sharedFree);
+  if (held >= threshold)
+    return 0;
+
+  unsigned int grant = sharedGrantCredits - sharedGrant[vl];
+  if (grant > threshold - held)
+    grant = threshold - held;
+  if (grant > sharedFree)
+    grant = sharedFree;
+  sharedGrant[vl] += grant;
+  sharedFree -= grant;
+  return grant;
+}
+
+// consume a static credit of the VL or else a granted shared one
+void IBInBuf::consumeCredit(int vl)
+{
+  if (staticFree[vl]) {
+    staticFree[vl]--;
+    staticUsageHist[vl].collect(staticFree[vl]);
+    return;
+  }
+  if (!sharedGrant[vl]) {
+    opp_error("-E- %s no static or shared credits on vl: %d",
+              getFullPath().c_str(), vl);
+  }
+  sharedGrant[vl]--;
+  sharedUsed[vl]++;
+  totalSharedUsed++;
+  usedSharedCredits.record(totalSharedUsed);
+  sharedUsageStat.collect(totalSharedUsed);
+}
+
+// the static credits per VL required to keep the link busy: the link
+// round trip delay and the credit update period at the link rate plus
+// bdpSlackCredits. Return 0 if the buffer is not sized by the BDP.
+int IBInBuf::getBDPCredits()
+{
+  if (!par("staticByBDP").boolValue())
+    return 0;
+
+  IBOutBuf *p_oBuf =
+    dynamic_cast<IBOutBuf *>(getParentModule()->getSubmodule("obuf"));
+  if (!p_oBuf) {
+    opp_error("-E- %s fail to get the port OBUF", getFullPath().c_str());
+  }
+
+  cDatarateChannel *p_chan = p_oBuf->getLinkChannel();
+  double loop_s = 2 * p_chan->getDelay().dbl() +
+    p_oBuf->getCredMinTime_us() * 1e-6;
+  int flitSize_B = par("flitSize");
+  int credits = (int)ceil(loop_s * p_chan->getDatarate() / 8 / flitSize_B);
+  credits += (int)par("bdpSlackCredits");
+  EV << "-I- " << getFullPath() << " BDP static credits per VL:" << credits
+     << " link delay:" << p_chan->getDelay() << " rate:"
+     << p_chan->getDatarate() << endl;
+  return credits;
+}
+
 int IBInBuf::incrBusyUsedPorts() {
+  IB_PROF_CALL("IBInBuf::incrBusyUsedPorts");
   if (numBeingSent < maxBeingSent) {
     numBeingSent++;
     EV << "-I- " << getFullPath() << " increase numBeingSent to:"
@@ -156,7 +301,8 @@ void IBInBuf::sendRxCred(int vl, double delay = 0)
   IBRxCredMsg *p_msg = new IBRxCredMsg("rxCred", IB_RXCRED_MSG);
   p_msg->setVL(vl);
   if (!lossyMode) {
-	 p_msg->setFCCL(ABR[vl] + staticFree[vl]);
+	 grantSharedCredits(vl);
+	 p_msg->setFCCL(ABR[vl] + staticFree[vl] + sharedGrant[vl]);
   } else {
 	 p_msg->setFCCL(ABR[vl] + maxStatic[vl]);
   }
@@ -176,10 +322,113 @@ void IBInBuf::sendTxCred(int vl, long FCCL)
   send(p_msg, "txCred"); 
 }
 
+// the FLITs of the packet that must arrive before its head is released
+unsigned int IBInBuf::getHeadFlitsRequired(IBDataMsg *p_head)
+{
+  unsigned int required;
+  if (fwdMode == FWD_STORE_AND_FORWARD) {
+    required = p_head->getPacketLength();
+  } else if (fwdMode == FWD_CT_THRESHOLD) {
+    required = ctMinFlits;
+    if (required > (unsigned int)p_head->getPacketLength())
+      required = p_head->getPacketLength();
+  } else {
+    required = 1;
+  }
+  return required;
+}
+
+// return true if the forwarding mode allows the FLIT to leave. Only the
+// head of the packet being received may be held.
+bool IBInBuf::isHeadForwardable(IBDataMsg *p_msg)
+{
+  if (p_msg->getFlitSn() || (p_msg != curPacketHead))
+    return true;
+  return (curPacketFlitsRcvd >= getHeadFlitsRequired(p_msg));
+}
+
+// wake up when the front FLIT of the Q passes the switch pipeline
+// the timer of the queue - created on first use
+IBFwdTimerMsg *IBInBuf::getFwdTimer(short int portNum, short vl)
+{
+  IBFwdTimerMsg *p_timer = fwdTimers[portNum][vl];
+  if (!p_timer) {
+    p_timer = new IBFwdTimerMsg("fwd", IB_FWD_TIMER_MSG);
+    p_timer->setPortNum(portNum);
+    p_timer->setVL(vl);
+    fwdTimers[portNum][vl] = p_timer;
+  }
+  return p_timer;
+}
+
+void IBInBuf::armFwdTimer(short int portNum, short vl, simtime_t t)
+{
+  IBFwdTimerMsg *p_timer = getFwdTimer(portNum, vl);
+  if (p_timer->isScheduled()) {
+    if (p_timer->getArrivalTime() <= t)
+      return;
+    cancelEvent(p_timer);
+  }
+  scheduleAt(t, p_timer);
+}
+
+// the out VL of the packet on the given out port by the SL2VL table
+int IBInBuf::getOutVL(IBDataMsg *p_msg, int outPort)
+{
+  int outVL = pktfwd->getVLBySL(thisPortNum, outPort, p_msg->getSL(),
+                                curPacketVL);
+  if ((outVL < 0) || (outVL > (int)maxVL)) {
+    opp_error("SL2VL maps SL: %d from port: %d to port: %d to bad VL: %d",
+              p_msg->getSL(), thisPortNum, outPort, outVL);
+  }
+  return outVL;
+}
+
+// queue the multicast FLIT once to the Q of every out port of the packet
+void IBInBuf::queueMcFlit(IBDataMsg *p_msg)
+{
+  McFlitState &mcFlit = mcQueued[p_msg];
+  mcFlit.ref = ++lastMcRef;
+  mcFlit.queued = curPacketMcPorts.size();
+  mcUnsent[mcFlit.ref] = mcFlit.queued;
+  for (unsigned int i = 0; i < curPacketMcPorts.size(); i++)
+    Q[curPacketMcPorts[i]][curPacketMcVLs[i]].insert(p_msg);
+}
+
+// a multicast FLIT copy was sent - return true if it was the last one
+bool IBInBuf::isLastMcCopySent(long mcRef)
+{
+  std::map<long, unsigned int>::iterator uI = mcUnsent.find(mcRef);
+  if (uI == mcUnsent.end()) {
+    opp_error("-E- %s sent of unknown multicast FLIT: %ld",
+              getFullPath().c_str(), mcRef);
+  }
+  if (--(*uI).second)
+    return false;
+  mcUnsent.erase(uI);
+  return true;
+}
+
 // Try to send the HoQ to the VLA
 void IBInBuf::updateVLAHoQ(short int portNum, short vl)
 {
   if (Q[portNum][vl].empty()) return;
+
+  // the forwarding mode may hold the packet head - must check before
+  // the VLA HoQ is locked
+  if (!hcaIBuf && !isHeadForwardable((IBDataMsg *)Q[portNum][vl].front())) {
+    EV << "-I- " << getFullPath() << " holding packet head on port:"
+       << portNum << " vl:" << vl << " received FLITs:"
+       << curPacketFlitsRcvd << endl;
+    return;
+  }
+
+  // the FLIT leaves ISWDelay after its release
+  IBDataMsg *p_front = (IBDataMsg *)Q[portNum][vl].front();
+  if (!hcaIBuf && (p_front->getFwdTime() > simTime())) {
+    armFwdTimer(portNum, vl, p_front->getFwdTime());
+    return;
+  }
   
   // find the VLA connected to the given port and
   // call its method for checking and setting HoQ
@@ -199,26 +448,38 @@ void IBInBuf::updateVLAHoQ(short int portNum, short vl)
   }
  
   IBDataMsg *p_msg = (IBDataMsg *)Q[portNum][vl].pop();
-  
-  if (!hcaIBuf) {
-    // Add the latency only if not in cut through mode
-    // also may be required if the last delivery time is too close
-    // and we must insert delay to avoid reordering
-    simtime_t storeTime = simTime() - p_msg->getArrivalTime();
-    simtime_t extraStoreTime = ISWDelay*1e-9 - storeTime;
-    if (simTime() + extraStoreTime <= lastSendTime) {
-      extraStoreTime = lastSendTime + 1e-9 - simTime();
-    }
-    if (extraStoreTime > 0) {
-      lastSendTime = simTime()+extraStoreTime;
-      sendDelayed(p_msg, extraStoreTime, "out", portNum);
-    } else {
-      lastSendTime = simTime();
-      send(p_msg, "out", portNum);
+
+  // a multicast FLIT leaves a copy to all but the last of its Qs
+  long mcRef = -1;
+  if (p_msg->getDstLid() >= IB_MC_LID_BASE) {
+    std::map<IBDataMsg *, McFlitState>::iterator mI = mcQueued.find(p_msg);
+    if (mI != mcQueued.end()) {
+      mcRef = (*mI).second.ref;
+      if (--(*mI).second.queued) {
+        p_msg = p_msg->dup();
+        numMcFlitCopies++;
+      } else {
+        mcQueued.erase(mI);
+      }
+      p_msg->setVL(vl);
     }
+  }
+
+  if (!hcaIBuf) {
+    // the switch pipeline is crossbar time, the rest was queuing
+    simtime_t pipe = ISWDelay*1e-9;
+    addLatency(p_msg, IB_LAT_IN_QUEUE,
+               simTime() - p_msg->getStageTime() - pipe);
+    addLatency(p_msg, IB_LAT_XBAR, pipe);
+    p_msg->setStageTime(simTime());
+
+    // the credits are freed on the in VL once the VLA sends the HoQ
+    hoqInVL[portNum][vl] = p_msg->getInVL();
+    hoqMcRef[portNum][vl] = mcRef;
   } else {
-    send(p_msg, "out", portNum);
+    chargeLatencyStage(p_msg, IB_LAT_IN_QUEUE);
   }
+  send(p_msg, "out", portNum);
 }
 
 // Handle Push message
@@ -259,6 +520,10 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
     
     // track the time of the packet in the switch
     p_dataMsg->setSwTimeStamp(simTime());
+    chargeLatencyStage(p_dataMsg, IB_LAT_WIRE);
+    if (!hcaIBuf)
+      startLatencyHop(p_dataMsg);
+    p_dataMsg->setFwdTime(simTime() + ISWDelay*1e-9);
 
     if (p_dataMsg->getFlitSn() == 0) {
       curPacketId = p_dataMsg->getPacketId();
@@ -266,6 +531,10 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
       curPacketName = p_dataMsg->getName();
       curPacketCredits = p_dataMsg->getPacketLength();
       curPacketVL = p_dataMsg->getVL();
+      curPacketOutVL = curPacketVL;
+      curPacketFlitsRcvd = 0;
+      curPacketHead = p_dataMsg;
+      curPacketMcPorts.clear();
       unsigned short dLid = p_dataMsg->getDstLid();
       
       if (dLid == 0) {
@@ -278,9 +547,11 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
       
       // do we have enough credits?
 		if (!lossyMode) {
-		  if (curPacketCredits > staticFree[curPacketVL]) {
+		  if (curPacketCredits >
+				staticFree[curPacketVL] + sharedGrant[curPacketVL]) {
 			 opp_error(" Credits overflow. Required: %d available: %d",
-						  curPacketCredits, staticFree[curPacketVL]);
+						  curPacketCredits,
+						  staticFree[curPacketVL] + sharedGrant[curPacketVL]);
 		  }
 		} else {
 		  // we need to mark out port as -1 to make next flits drop
@@ -294,7 +565,14 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
       
       // lookup out port  on the first credit of a packet
       if (numPorts > 1) {
-    	  if (!hcaIBuf) {
+    	  if (!hcaIBuf && (dLid >= IB_MC_LID_BASE)) {
+    		  // multicast is replicated to all the MFT ports
+    		  numMcPackets++;
+    		  if (pktfwd->getPortsByMLID(dLid, thisPortNum, curPacketMcPorts))
+    			  curPacketOutPort = curPacketMcPorts[0];
+    		  else
+    			  curPacketOutPort = -1;
+    	  } else if (!hcaIBuf) {
     		  curPacketOutPort = pktfwd->getPortByLID(dLid);
 			  if (!p_dataMsg->getBeforeAnySwitch() &&
 					(curPacketOutPort == (int)thisPortNum)) {
@@ -312,9 +590,22 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
 		  // to /dev/null
     	  if (curPacketOutPort < 0) {
     		  curPacketOutPort = -1;
+    	  } else if (curPacketMcPorts.size()) {
+    		  // every multicast out port has its own out VL
+    		  curPacketMcVLs.clear();
+    		  for (unsigned int i = 0; i < curPacketMcPorts.size(); i++) {
+    			  pktfwd->repQueuedFlits(thisPortNum, curPacketMcPorts[i],
+    					  dLid, curPacketCredits);
+    			  curPacketMcVLs.push_back(getOutVL(p_dataMsg,
+    					  curPacketMcPorts[i]));
+    		  }
     	  } else {
     		  // get the current inbuf index in the switch
     		  pktfwd->repQueuedFlits(thisPortNum, curPacketOutPort, p_dataMsg->getDstLid(), curPacketCredits);
+
+    		  // the out VL by the SL2VL table of this in and out ports
+    		  if (!hcaIBuf)
+    			  curPacketOutVL = getOutVL(p_dataMsg, curPacketOutPort);
     	  }
       } else {
         curPacketOutPort = 0;
@@ -346,8 +637,7 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
     }
     
     // Now consume a credit
-	 staticFree[curPacketVL]--;
-    staticUsageHist[curPacketVL].collect(staticFree[curPacketVL]);
+    consumeCredit(curPacketVL);
     ABR[curPacketVL]++;
     EV << "-I- " << getFullPath() << " New Static ABR[" 
        << curPacketVL << "]:" << ABR[curPacketVL] << endl;
@@ -356,8 +646,20 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
        << ". still free:" << staticFree[curPacketVL] << endl;
 
     // For every DATA "credit" (not only first one)
-    // - Queue the Data in the Q[V]
-    Q[curPacketOutPort][curPacketVL].insert(p_dataMsg);
+    // - Queue the Data in the Q[OutPort][OutVL] remembering its in VL
+    p_dataMsg->setInVL(curPacketVL);
+    if (curPacketMcPorts.size()) {
+      queueMcFlit(p_dataMsg);
+    } else {
+      p_dataMsg->setVL(curPacketOutVL);
+      Q[curPacketOutPort][curPacketOutVL].insert(p_dataMsg);
+    }
+    curPacketFlitsRcvd++;
+
+    // a held head is released by the FLIT completing its required FLITs
+    if (!hcaIBuf && (curPacketFlitsRcvd > 1) &&
+        (curPacketFlitsRcvd == getHeadFlitsRequired(curPacketHead)))
+      curPacketHead->setFwdTime(simTime() + ISWDelay*1e-9);
     
     // - Send RxCred with updated ABR[VL] and FREE[VL] - only if the sum has
     //   changed which becomes the FCCL of the sent flow control
@@ -366,7 +668,12 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
     // - If HoQ in the target VLA is empty - send the push event out.
     //   when the last packet is sent the "done" event has to be sent to 
     //   all output ports, Note this also dequeue and send
-    updateVLAHoQ(curPacketOutPort, curPacketVL);
+    if (curPacketMcPorts.size()) {
+      for (unsigned int i = 0; i < curPacketMcPorts.size(); i++)
+        updateVLAHoQ(curPacketMcPorts[i], curPacketMcVLs[i]);
+    } else {
+      updateVLAHoQ(curPacketOutPort, curPacketOutVL);
+    }
   } else {
     ev << "-E- " << getFullPath() << " push does not know how to handle message:"
        << msgType << endl;
@@ -377,8 +684,21 @@ void IBInBuf::handlePush(IBWireMsg *p_msg)
 // simple free static credits as reqired
 void IBInBuf::simpleCredFree(int vl)
 {
-  // simply return the static credit first
-  if (staticFree[vl] < maxStatic[vl]) {
+  // shared credits are returned to the pool first
+  if (sharedUsed[vl]) {
+    sharedUsed[vl]--;
+    totalSharedUsed--;
+    sharedFree++;
+    usedSharedCredits.record(totalSharedUsed);
+    sharedUsageStat.collect(totalSharedUsed);
+    sendRxCred(vl);
+
+    // VLs left without a grant by a busy pool may now get one
+    for (unsigned int ovl = 0; ovl < maxVL+1; ovl++)
+      if ((ovl != (unsigned int)vl) && !sharedGrant[ovl] &&
+          grantSharedCredits(ovl))
+        sendRxCred(ovl);
+  } else if (staticFree[vl] < maxStatic[vl]) {
     staticFree[vl]++;
     // need to update the OBUF we have one free... 
     sendRxCred(vl);
@@ -399,10 +719,18 @@ void IBInBuf::handleSent(IBSentMsg *p_msg)
   
   usedStaticCredits.record( totalUsedStatics );
   
-  // update the free credits accordingly:
+  // update the free credits accordingly - of the in VL of the sent HoQ
   int vl = p_msg->getVL();
-
-  simpleCredFree(vl);
+  if (!hcaIBuf) {
+    int pn = p_msg->getArrivalGate()->getIndex();
+    // a multicast FLIT credit is freed by its last copy
+    if ((hoqMcRef[pn][vl] < 0) || isLastMcCopySent(hoqMcRef[pn][vl]))
+      simpleCredFree(hoqInVL[pn][vl]);
+    hoqInVL[pn][vl] = -1;
+    hoqMcRef[pn][vl] = -1;
+  } else {
+    simpleCredFree(vl);
+  }
   
   // Only on switch ibuf we need to do the following...
   if (! hcaIBuf) {
@@ -458,6 +786,7 @@ void IBInBuf::handleTQLoadMsg(IBTQLoadUpdateMsg *p_msg)
 
 void IBInBuf::handleMessage(cMessage *p_msg)
 {
+    IB_PROF_EVENT(p_msg);
     int msgType = p_msg->getKind();
     if ( msgType == IB_SENT_MSG ) {
         handleSent((IBSentMsg *)p_msg);
@@ -465,6 +794,9 @@ void IBInBuf::handleMessage(cMessage *p_msg)
         handlePush((IBWireMsg*)p_msg);
     } else if (msgType == IB_TQ_LOAD_MSG) {
         handleTQLoadMsg((IBTQLoadUpdateMsg*)p_msg);
+    } else if (msgType == IB_FWD_TIMER_MSG) {
+        IBFwdTimerMsg *p_timer = (IBFwdTimerMsg *)p_msg;
+        updateVLAHoQ(p_timer->getPortNum(), p_timer->getVL());
     } else {
         ev << "-E- " << getFullPath() << " does not know how to handle message:" << msgType << endl;
         if (p_msg->isSelfMessage())
@@ -485,6 +817,76 @@ void IBInBuf::finish()
              << " / " << staticUsageHist[vl].getStddev()
              << endl;
   } 
+  if (sharedBuffer) {
+    ev << "STAT: " << getFullPath()
+       << " Used Shared Credits num/avg/max/std:"
+       << sharedUsageStat.getCount()
+       << " / " << sharedUsageStat.getMean()
+       << " / " << sharedUsageStat.getMax()
+       << " / " << sharedUsageStat.getStddev()
+       << endl;
+    recordScalar("Shared-Credits-Used-Mean", sharedUsageStat.getMean());
+    recordScalar("Shared-Credits-Used-Max", sharedUsageStat.getMax());
+  }
   if (lossyMode)
 	 recordScalar("numDroppedCredits", numDroppedCredits);
+  if (numMcPackets) {
+    recordScalar("Multicast-Packets", numMcPackets);
+    recordScalar("Multicast-FLIT-Copies", numMcFlitCopies);
+  }
+}
+
+void IBInBuf::snapshotState(stateSnapshot &s)
+{
+  snap(s, numBeingSent);
+  for (int pn = 0; pn < gateSize("out"); pn++) {
+    for (unsigned int vl = 0; vl < maxVL+1; vl++) {
+      s.queue(Q[pn][vl]);
+      bool hasTimer = (fwdTimers[pn][vl] != NULL);
+      snap(s, hasTimer);
+      if (hasTimer) s.timer(getFwdTimer(pn, vl));
+    }
+  }
+  snap(s, hoqInVL);
+  snap(s, hoqMcRef);
+  snap(s, staticFree);
+  snap(s, ABR);
+  snap(s, sharedFree);
+  snap(s, sharedGrant);
+  snap(s, sharedUsed);
+  snap(s, totalSharedUsed);
+
+  snap(s, curPacketId);
+  snap(s, curPacketSrcLid);
+  snap(s, curPacketName);
+  snap(s, curPacketCredits);
+  snap(s, curPacketFlitsRcvd);
+  snap(s, curPacketVL);
+  snap(s, curPacketOutVL);
+  snap(s, curPacketOutPort);
+  snap(s, curPacketMcPorts);
+  snap(s, curPacketMcVLs);
+  // the head is only kept while it is held in a Q
+  s.ref(curPacketHead);
+
+  // the multicast FLITs are all in the Qs
+  unsigned long n = mcQueued.size();
+  snap(s, n);
+  std::map<IBDataMsg *, McFlitState>::iterator mI = mcQueued.begin();
+  for (unsigned long i = 0; i < n; i++) {
+    IBDataMsg *p_msg = s.isLoading() ? NULL : (*mI).first;
+    s.ref(p_msg);
+    McFlitState &state = s.isLoading() ? mcQueued[p_msg] : (*mI++).second;
+    snap(s, state.ref);
+    snap(s, state.queued);
+  }
+  snap(s, mcUnsent);
+  snap(s, lastMcRef);
+}
+
+IBInBuf::~IBInBuf()
+{
+  for (unsigned int pn = 0; pn < fwdTimers.size(); pn++)
+    for (unsigned int vl = 0; vl < fwdTimers[pn].size(); vl++)
+      if (fwdTimers[pn][vl]) cancelAndDelete(fwdTimers[pn][vl]);
 }
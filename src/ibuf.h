@@ -33,6 +33,47 @@
 // Parameters:
 // MaxStatic[vl]  - max static credits allocated for each VL
 // BufferSize     - the input buffer size in bytes
+// staticByBDP    - size every VL by the link bandwidth delay product:
+//                  (2 * delay + credit update period) * rate in flitSize
+//                  credits plus bdpSlackCredits (covering a packet and
+//                  the internal delays). The buffer size grows to fit.
+// flitSize       - the credit size in bytes
+// sharedBuffer   - the buffer space above the static credits is a pool
+//                  shared by all VLs
+// sharedAlpha    - dynamic threshold per VL: a VL may hold up to alpha
+//                  times the free shared credits (last value repeats)
+// sharedGrantCredits - max shared credits granted ahead to a VL
+//
+// Forwarding Mode (Switch fwdMode parameter):
+// cut_through - the packet head may leave once it arrived
+// store_and_forward - the packet head waits for the entire packet
+// cut_through_threshold - the packet head waits for ctMinFlits FLITs
+// (or the entire packet if shorter)
+// The head of the packet being received is held in its queue until the
+// mode allows it - its release time. Other FLITs are released as they
+// arrive. A FLIT leaves its queue ISWDelay (the switch pipeline) after its
+// release: the front FLIT of a queue that is not due yet arms the timer of
+// the queue. The queues are FIFO so the FLITs are never reordered.
+//
+// Shared Buffer:
+// A FLIT consumes a static credit of its VL if any is free and otherwise
+// a shared credit granted to the VL. Freed FLITs return shared credits
+// first. Since advertised credits can not be taken back, shared credits
+// are granted (removed from the pool) before they are advertised in the
+// FCCL: ABR + FREE + GRANTED. The grant of a VL is topped up to
+// sharedGrantCredits while its held (used + granted) shared credits stay
+// below alpha times the free pool.
+//
+// Multicast:
+// A packet to a multicast LID (MLID) is routed by the switch MFT to all
+// its member ports but the in port, each on its own SL2VL out VL. Every
+// FLIT is stored once and queued in the Q of every out port. Only as it
+// moves into the HoQ of a VLA a copy of its per hop header is made which
+// shares the packet fields of the stored FLIT (see ib_data_msg.h). The last
+// port takes the stored FLIT itself so no copies are kept in the buffer.
+// The in VL credit of the FLIT is freed once the sent of its last copy
+// is reported by the VLAs. A multicast packet takes a busy port of the
+// IBUF on each out port.
 //
 // External Events:
 // * push - data is available on the input (either flow control or credit)
@@ -51,9 +92,12 @@
 //     - Make sure enough credits exists for this VL (inspecting the
 //       FREE[VL]). If there are not enough credits ASSERT.
 //       FREE[VL] = MaxStatic[VL] - UsedStatic[VL]
+//     - Lookup the out VL by the switch SL2VL table of this in port and
+//       the out port. Credits are consumed on the in VL but the packet
+//       is queued and arbitrated on the out VL.
 //
 //   For every DATA "credit" (not only first one)
-//     - Queue the Data in the Q[V]
+//     - Queue the Data in the Q[OutPort][OutVL]
 //          staticFree[VL]++
 //          ABR[VL]++
 //     - Send RxCred with updated ARB[VL] and FREE[VL] - only if sum changed
@@ -63,7 +107,8 @@
 //       ports
 //
 // * On Sent:
-//   - Decrease UsedStatic[VL] and update FREE[VL]
+//   - Decrease UsedStatic[VL] and update FREE[VL] of the in VL of the
+//     credit that was in the VLA HoQ
 //   - If the message that was sent is the last in the packet we need to
 //     send the "done" message to all connected ports.
 // 
@@ -88,6 +133,7 @@
 #include <map>
 #include <vector>
 #include <pktfwd.h>
+#include "snapshot.h"
 #define MAX_LIDS 10
 
 // Store packet specific information to store the packet state  
@@ -100,11 +146,21 @@ class PacketState {
   };
 };
 
+// A multicast FLIT queued to several out ports
+class McFlitState {
+ public:
+  long ref;            // identifies the FLIT credit until all copies are sent
+  unsigned int queued; // number of Qs still holding the FLIT
+};
+
 //
 // Input Buffer for Receiving IB FLITs and VL credit updates
 //
-class IBInBuf : public cSimpleModule
+class IBInBuf : public cSimpleModule, public snapshotModule
 {
+  // the micro benchmarks drive the private handlers (microbench.h)
+  friend class IBMicroBench;
+
  private:
   cMessage *p_popMsg;
   cMessage *p_minTimeMsg;
@@ -119,13 +175,23 @@ class IBInBuf : public cSimpleModule
   unsigned int width;           // the width of the incoming port 1/4/8/12
   int hcaIBuf;                  // > 0 if an HCA port IBuf
   bool lossyMode;               // if true make this port lossy
+  enum { FWD_CUT_THROUGH, FWD_STORE_AND_FORWARD, FWD_CT_THRESHOLD } fwdMode;
+  unsigned int ctMinFlits;      // FLITs required by cut_through_threshold
 
   // data strcture
   int numBeingSent;   // Number of packets being currently sent
   cQueue **Q;         // Incoming packets Q per VL per out port
   int hoqOutPort[8];  // The output port the packet at the HOQ is targetted to
+  std::vector<std::vector<int> > hoqInVL; // in VL of the HoQ by out port, VL
   std::vector<unsigned int> staticFree;  // number of free credits per VL
   std::vector<long> ABR;    // total number of received credits per VL
+  bool sharedBuffer;        // use the space above static as a shared pool
+  std::vector<double> sharedAlpha; // dynamic threshold alpha per VL
+  unsigned int sharedGrantCredits; // max shared credits granted ahead
+  unsigned int sharedFree;  // free shared credits (not granted or used)
+  std::vector<unsigned int> sharedGrant; // shared credits granted per VL
+  std::vector<unsigned int> sharedUsed;  // shared credits used per VL
+  unsigned int totalSharedUsed; // shared credits used by all VLs
   unsigned int thisPortNum; // holds the port num this is part of
 
   // there is only one packet stream allowed on the input so we track its
@@ -135,9 +201,20 @@ class IBInBuf : public cSimpleModule
   int curPacketSrcLid;
   std::string curPacketName;
   unsigned int curPacketCredits;
+  unsigned int curPacketFlitsRcvd; // FLITs of the current packet queued
+  IBDataMsg *curPacketHead;        // the head FLIT of the current packet
   int curPacketVL;
+  int curPacketOutVL;
   int curPacketOutPort;
-  simtime_t lastSendTime;
+  std::vector<int> curPacketMcPorts; // out ports of a multicast packet
+  std::vector<int> curPacketMcVLs;   // the out VL on each of these ports
+  std::vector<std::vector<IBFwdTimerMsg *> > fwdTimers; // by out port, VL
+
+  // multicast FLITs by the stored FLIT and their unsent copies by ref
+  std::map<IBDataMsg *, McFlitState> mcQueued;
+  std::map<long, unsigned int> mcUnsent;
+  std::vector<std::vector<long> > hoqMcRef; // ref of the HoQ by out port, VL
+  long lastMcRef;
 
   // as we might have multiple sends we need to track the "active sends"
   // given the packet ID we track various state variables.
@@ -150,14 +227,19 @@ class IBInBuf : public cSimpleModule
   // statistics
   cLongHistogram staticUsageHist[8];
   cOutVector usedStaticCredits;
+  cOutVector usedSharedCredits;
+  cStdDev sharedUsageStat;
   cOutVector CredChosenPort;
   cOutVector dsLidDR;
   cOutVector outPortDR;
   cOutVector pktidDR;
   unsigned int numDroppedCredits;
+  unsigned int numMcPackets;   // multicast packets received
+  unsigned int numMcFlitCopies; // FLIT copies made for multicast
 
   // methods
   long getDoneMsgId();
+  int getBDPCredits();
   void parseIntListParam(char *parName, int numEntries, std::vector<int> &out);
   void sendOutMessage(IBWireMsg *p_msg);
   void qMessage(IBWireMsg *p_msg);
@@ -165,7 +247,17 @@ class IBInBuf : public cSimpleModule
   void sendRxCred(int vl, double delay); // send a RxCred message to the OBUF
   void sendTxCred(int vl, long FCCS); // send a TxCred message to the VLA
   void updateVLAHoQ(short int portNum, short vl); // send the HoQ if you can
+  int getOutVL(IBDataMsg *p_msg, int outPort); // by the SL2VL table
+  void queueMcFlit(IBDataMsg *p_msg); // queue to all multicast out ports
+  bool isLastMcCopySent(long mcRef);   // count a sent multicast copy
+  bool isHeadForwardable(IBDataMsg *p_msg); // check the forwarding mode
+  unsigned int getHeadFlitsRequired(IBDataMsg *p_head); // by the mode
+  IBFwdTimerMsg *getFwdTimer(short int portNum, short vl);
+  void armFwdTimer(short int portNum, short vl, simtime_t t);
   void simpleCredFree(int vl); // perform a simple credit free flow
+  void initSharedBuffer(unsigned int totStatic);
+  unsigned int grantSharedCredits(int vl); // top up the VL shared grant
+  void consumeCredit(int vl);  // a FLIT takes a static or shared credit
 
   // return 1 if the HoQ at the given port and VL is free
   int isHoqFree(int portNum, int vl);
@@ -178,6 +270,9 @@ class IBInBuf : public cSimpleModule
  public:
   // return 1 if incremented the number of parallel sends
   int incrBusyUsedPorts();
+  // the queues, credits and the packet being received
+  virtual void snapshotState(stateSnapshot &s);
+  virtual ~IBInBuf();
   
 };
 
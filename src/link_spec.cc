@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "link_spec.h"
+#include <sstream>
+#include <stdio.h>
+
+using namespace std;
+
+double
+linkSpec::speedByName(const string &s)
+{
+  const char *names[] = {"SDR", "DDR", "QDR", "FDR", "EDR", "HDR"};
+  double speeds[] = {2.5, 5, 10, 14.0625, 25.78125, 53.125};
+  for (int i = 0; i < 6; i++)
+    if (s == names[i]) return speeds[i];
+  double speed;
+  char unit;
+  if ((sscanf(s.c_str(), "%lf%c", &speed, &unit) != 2) || (unit != 'G'))
+    return 0;
+  // the data rates of FDR, EDR and HDR are used as their names
+  if (speed == 14) return 14.0625;
+  if (speed == 25) return 25.78125;
+  if (speed == 50) return 53.125;
+  return speed;
+}
+
+int
+linkSpec::parse(const string &arrow)
+{
+  width = 0;
+  speed_Gbps = 0;
+  length_m = 0;
+  errStr.clear();
+  if (arrow == "->")
+    return 0;
+
+  if ((arrow.size() < 3) || (arrow[0] != '-') ||
+      (arrow.substr(arrow.size() - 2) != "->")) {
+    errStr = "unknown link spec: " + arrow;
+    return 1;
+  }
+
+  stringstream fields(arrow.substr(1, arrow.size() - 3));
+  string f;
+  while (getline(fields, f, '-')) {
+    char unit = 0;
+    double val = 0;
+    if (f.empty()) {
+      errStr = "empty field in link spec: " + arrow;
+      return 1;
+    } else if ((sscanf(f.c_str(), "%lf%c", &val, &unit) == 2) &&
+               (unit == 'x')) {
+      width = val;
+    } else if (unit == 'm') {
+      length_m = val;
+    } else if (speedByName(f) > 0) {
+      speed_Gbps = speedByName(f);
+    } else {
+      errStr = "unknown field: " + f + " in link spec: " + arrow;
+      return 1;
+    }
+  }
+  return 0;
+}
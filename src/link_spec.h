@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBDM link specs of .topo files, shared by the IBFabric and ibdm2ned.
+//
+// A link between two ports is written as "->" or carries a spec:
+//   -<w>x-<speed>[-<len>m]->
+// where speed is in Gbps (like 10G) or one of SDR/DDR/QDR/FDR/EDR/HDR and
+// the optional cable length is in meters, e.g. "-4x-EDR-5m->". The 14G,
+// 25G and 50G speeds stand for the FDR, EDR and HDR lane data rates.
+//   linkSpec s;
+//   if (s.parse("-4x-EDR-5m->")) error(s.getError());
+// A field may be missing - width, speed_Gbps and length_m are 0 then.
+//
+
+#ifndef __LINK_SPEC__
+#define __LINK_SPEC__
+
+#include <string>
+
+class linkSpec
+{
+ private:
+  std::string errStr;
+
+ public:
+  double width;      // number of lanes or 0 if not given
+  double speed_Gbps; // lane signaling rate or 0 if not given
+  double length_m;   // cable length or 0 if not given
+
+  linkSpec() : width(0), speed_Gbps(0), length_m(0) {};
+
+  // parse an arrow like -4x-10G-5m-> return 1 on error
+  int parse(const std::string &arrow);
+  const std::string &getError() const { return errStr; };
+
+  // the lane speed of a named or numeric (like 10G) speed - 0 if unknown
+  static double speedByName(const std::string &s);
+};
+
+#endif /* __LINK_SPEC__ */
@@ -0,0 +1,568 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBMicroBench drives the model kernels by google benchmark micro
+// benchmarks. See functional description in the header file.
+//
+#include "ib_m.h"
+#include "microbench.h"
+#include "vlarb.h"
+#include "ibuf.h"
+#include "obuf.h"
+#include "pktfwd.h"
+#include "sink.h"
+#ifdef WITH_MICROBENCH
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <new>
+#include <stdlib.h>
+#endif
+
+Define_Module( IBMicroBench );
+
+#ifdef WITH_MICROBENCH
+
+// the credits provided to the VLA such that credits never block it
+#define IB_BENCH_CREDITS 1000000
+
+// count every allocation so the benchmarks report allocs/op. The operators
+// are not inlined such that the compiler pairs new and delete expressions
+// with them and not with malloc and free (-Wmismatched-new-delete)
+static unsigned long long numAllocs = 0;
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+  numAllocs++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) throw()
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) throw()
+{
+  free(p);
+}
+
+// accumulate the time and allocations of the timed kernel calls
+class benchTimer {
+  std::chrono::steady_clock::time_point startTime;
+  unsigned long long startAllocs;
+  double iterTime_s;          // time of the kernel calls of this iteration
+  unsigned long long allocs;  // allocations of all the kernel calls
+ public:
+  benchTimer() : startAllocs(0), iterTime_s(0), allocs(0) {};
+  void start() {
+    startAllocs = numAllocs;
+    startTime = std::chrono::steady_clock::now();
+  };
+  void stop() {
+    std::chrono::steady_clock::time_point end =
+      std::chrono::steady_clock::now();
+    iterTime_s += std::chrono::duration<double>(end - startTime).count();
+    allocs += numAllocs - startAllocs;
+  };
+  // the manual time of the iteration
+  void endIteration(benchmark::State &state) {
+    state.SetIterationTime(iterTime_s);
+    iterTime_s = 0;
+  };
+  void report(benchmark::State &state) {
+    state.counters["allocs/op"] =
+      benchmark::Counter(allocs, benchmark::Counter::kAvgIterations);
+  };
+};
+
+typedef void (IBMicroBench::*benchFn)(benchmark::State &state);
+
+static void runBench(benchmark::State &state, IBMicroBench *p_bench,
+                     benchFn fn)
+{
+  (p_bench->*fn)(state);
+}
+
+#endif // WITH_MICROBENCH
+
+void IBMicroBench::initialize()
+{
+  p_startMsg = NULL;
+#ifndef WITH_MICROBENCH
+  opp_error("-E- %s requires the simulator built with WITH_MICROBENCH"
+            " (make makefiles-microbench)", getFullPath().c_str());
+#else
+  cModule *p_sys = simulation.getSystemModule();
+  p_switch = p_sys->getSubmodule(par("switchName"));
+  if (!p_switch) {
+    opp_error("-E- %s fail to find switch: %s", getFullPath().c_str(),
+              par("switchName").stringValue());
+  }
+  numPorts = (int)p_switch->par("numSwitchPorts");
+  p_pktfwd = dynamic_cast<Pktfwd *>(p_switch->getSubmodule("pktfwd"));
+  if (!p_pktfwd) {
+    opp_error("-E- %s switch: %s has no Pktfwd", getFullPath().c_str(),
+              p_switch->getFullPath().c_str());
+  }
+  cModule *p_hca = p_sys->getSubmodule(par("hcaName"));
+  p_sink = p_hca ? dynamic_cast<IBSink *>(p_hca->getSubmodule("sink")) : NULL;
+  if (!p_sink) {
+    opp_error("-E- %s fail to find the sink of HCA: %s",
+              getFullPath().c_str(), par("hcaName").stringValue());
+  }
+
+  p_startMsg = new cMessage("start");
+  scheduleAt(par("startTime").doubleValue(), p_startMsg);
+#endif
+}
+
+// get a submodule of the given switch port
+cModule *IBMicroBench::getPortSubmodule(unsigned int pn, const char *name)
+{
+  cModule *p_port = p_switch->getSubmodule("port", pn);
+  cModule *p_mod = p_port ? p_port->getSubmodule(name) : NULL;
+  if (!p_mod) {
+    opp_error("-E- %s fail to get %s of switch port: %d",
+              getFullPath().c_str(), name, pn);
+  }
+  return p_mod;
+}
+
+// remove from the FES the messages the module sent at this time. They are
+// owned by the context module then.
+void IBMicroBench::takeSentMsgs(cModule *p_mod, std::vector<cMessage *> &msgs)
+{
+  msgs.clear();
+  for (int i = 0; i < simulation.msgQueue.getLength(); i++) {
+    cMessage *p_msg = simulation.msgQueue.peek(i);
+    if (!p_msg->isSelfMessage() &&
+        (p_msg->getSenderModuleId() == p_mod->getId()) &&
+        (p_msg->getSendingTime() == simTime()))
+      msgs.push_back(p_msg);
+  }
+  for (unsigned int i = 0; i < msgs.size(); i++)
+    simulation.msgQueue.remove(msgs[i]);
+}
+
+void IBMicroBench::deleteSentMsgs(cModule *p_mod)
+{
+  std::vector<cMessage *> msgs;
+  takeSentMsgs(p_mod, msgs);
+  for (unsigned int i = 0; i < msgs.size(); i++)
+    delete msgs[i];
+}
+
+// a single FLIT data packet as created by the generator
+IBDataMsg *IBMicroBench::newFlit(int vl, unsigned int dLid)
+{
+  IBDataMsg *p_flit = new IBDataMsg("bench", IB_DATA_MSG);
+  p_flit->setBitLength(p_sink->flitSize*8);
+  p_flit->setByteLength(p_sink->flitSize);
+  p_flit->setSrcLid(p_sink->lid);
+  p_flit->setDstLid(dLid);
+  p_flit->setVL(vl);
+  p_flit->setFlitSn(0);
+  p_flit->setPacketLength(1);
+  p_flit->setPacketLengthBytes(p_sink->flitSize);
+  p_flit->setMsgLen(1);
+  p_flit->setBarrierStage(-1);
+  p_flit->setTransportOp(IB_TRANS_DATA);
+  p_flit->setBeforeAnySwitch(true);
+  p_flit->setInjectionTime(simTime());
+  p_flit->setSwTimeStamp(simTime());
+  p_flit->setStageTime(simTime());
+  p_flit->setTimestamp(simTime());
+  return p_flit;
+}
+
+#ifdef WITH_MICROBENCH
+
+// IBVLArb::arbitrate with the VLs HoQs of all the in ports filled by the
+// occupancy. The granted FLIT is returned to its HoQ.
+// Args: number of VLs, table configuration, HoQs occupancy percent
+// Tables: 0 - a low table entry per VL, 1 - even VLs in the high table and
+// odd in the low, 2 - a low table of 64 entries cycling the VLs
+void IBMicroBench::benchArbitrate(benchmark::State &state)
+{
+  IBVLArb *p_vla = (IBVLArb *)getPortSubmodule(0, "vlarb");
+  cContextSwitcher context(p_vla);
+  unsigned int numVLs = state.range(0);
+  int table = state.range(1);
+  unsigned int occupancy = state.range(2);
+  if (p_vla->p_popMsg->isScheduled()) {
+    state.SkipWithError("the VLA is sending");
+    return;
+  }
+
+  std::string high, low;
+  for (unsigned int i = 0; i < IB_VLARB_TBL_SIZE; i++) {
+    unsigned int vl = i % numVLs;
+    if ((table != 2) && (i == numVLs))
+      break;
+    char entry[16];
+    sprintf(entry, "%d:%d ", vl, (table == 1) ? 4 : 1);
+    if ((table == 1) && !(vl % 2))
+      high += entry;
+    else
+      low += entry;
+  }
+  p_vla->numHighEntries = p_vla->setVLArbParams(high.c_str(), p_vla->HighTbl);
+  p_vla->numLowEntries = p_vla->setVLArbParams(low.c_str(), p_vla->LowTbl);
+  p_vla->HighIndex = 0;
+  p_vla->LowIndex = 0;
+  p_vla->SentHighCounter = p_vla->vlHighLimit*4096;
+  p_vla->InsidePacket = 0;
+
+  // fill the HoQs evenly by the occupancy
+  for (unsigned int i = 0; i < p_vla->numInPorts * numVLs; i++) {
+    if ((i * occupancy / 100) == ((i + 1) * occupancy / 100))
+      continue;
+    unsigned int pn = i / numVLs;
+    unsigned int vl = i % numVLs;
+    if (p_vla->inPktHoqPerVL[pn][vl]) {
+      state.SkipWithError("the VLA HoQs are in use");
+      return;
+    }
+    p_vla->inPktHoqPerVL[pn][vl] = newFlit(vl, 1);
+  }
+
+  // the credits never block and the in ports are never busy
+  std::vector<long> FCCL = p_vla->FCCL;
+  for (unsigned int vl = 0; vl < numVLs; vl++)
+    p_vla->FCCL[vl] = p_vla->FCTBS[vl] + IB_BENCH_CREDITS;
+  std::vector<IBInBuf *> inBufs;
+  for (unsigned int pn = 0; pn < p_vla->numInPorts; pn++) {
+    cGate *p_gate = p_vla->gate("in", pn)->getPathStartGate();
+    inBufs.push_back((IBInBuf *)p_gate->getOwnerModule());
+  }
+
+  benchTimer timer;
+  std::vector<cMessage *> sent;
+  for (auto _ : state) {
+    timer.start();
+    p_vla->arbitrate();
+    timer.stop();
+    timer.endIteration(state);
+    if (!p_vla->p_popMsg->isScheduled())
+      continue;
+
+    // the FLIT left - return it to its HoQ
+    p_vla->cancelEvent(p_vla->p_popMsg);
+    unsigned int vl = p_vla->LastSentVL;
+    unsigned int pn = p_vla->LastSentPort[vl];
+    takeSentMsgs(p_vla, sent);
+    for (unsigned int i = 0; i < sent.size(); i++) {
+      if (sent[i]->getKind() == IB_DATA_MSG)
+        p_vla->inPktHoqPerVL[pn][vl] = (IBDataMsg *)sent[i];
+      else
+        delete sent[i];
+    }
+    p_vla->FCCL[vl] = p_vla->FCTBS[vl] + IB_BENCH_CREDITS;
+    inBufs[pn]->numBeingSent--;
+  }
+  timer.report(state);
+
+  for (unsigned int pn = 0; pn < p_vla->numInPorts; pn++) {
+    for (unsigned int vl = 0; vl < numVLs; vl++) {
+      delete p_vla->inPktHoqPerVL[pn][vl];
+      p_vla->inPktHoqPerVL[pn][vl] = NULL;
+    }
+  }
+  p_vla->FCCL = FCCL;
+}
+
+// IBInBuf::handlePush of a single FLIT packet into switch port 0 and the
+// IBInBuf::handleSent once the VLA of its out port sent it. Only one of
+// them is timed.
+// Args: number of VLs the packets use
+void IBMicroBench::benchInBuf(benchmark::State &state, bool timePush)
+{
+  IBInBuf *p_ibuf = (IBInBuf *)getPortSubmodule(0, "ibuf");
+  cContextSwitcher context(p_ibuf);
+  unsigned int numVLs = state.range(0);
+
+  // the destinations routed to the other switch ports
+  std::vector<unsigned int> dLids;
+  for (unsigned int lid = 1;
+       (lid < p_pktfwd->FDB->size()) && (lid < IB_MC_LID_BASE); lid++) {
+    int pn = (*p_pktfwd->FDB)[lid];
+    if ((pn > 0) && ((unsigned int)pn < numPorts))
+      dLids.push_back(lid);
+  }
+  if (dLids.empty()) {
+    state.SkipWithError("no LID is routed to the switch ports");
+    return;
+  }
+
+  benchTimer timer;
+  std::vector<cMessage *> sent;
+  unsigned int i = 0;
+  for (auto _ : state) {
+    IBDataMsg *p_flit = newFlit(i % numVLs, dLids[i % dLids.size()]);
+    i++;
+    if (timePush) timer.start();
+    p_ibuf->handlePush(p_flit);
+    if (timePush) timer.stop();
+
+    // the FLIT is sent to the VLA of its out port
+    IBDataMsg *p_vlaFlit = NULL;
+    takeSentMsgs(p_ibuf, sent);
+    for (unsigned int m = 0; m < sent.size(); m++) {
+      if (sent[m]->getKind() == IB_DATA_MSG)
+        p_vlaFlit = (IBDataMsg *)sent[m];
+      else
+        delete sent[m];
+    }
+    if (!p_vlaFlit) {
+      state.SkipWithError("the FLIT was not sent to the VLA");
+      break;
+    }
+
+    // which arbitrates and sends it
+    cGate *p_gate = p_vlaFlit->getArrivalGate();
+    IBVLArb *p_vla = (IBVLArb *)p_gate->getOwnerModule();
+    int vl = p_vlaFlit->getVL();
+    delete p_vlaFlit;
+    p_ibuf->incrBusyUsedPorts();
+    {
+      cContextSwitcher vlaContext(p_vla);
+      p_vla->sendSentMessage(p_gate->getIndex(), vl, 1);
+    }
+    takeSentMsgs(p_vla, sent);
+    if (sent.size() != 1) {
+      state.SkipWithError("the VLA did not send the sent message");
+      break;
+    }
+
+    if (!timePush) timer.start();
+    p_ibuf->handleSent((IBSentMsg *)sent[0]);
+    if (!timePush) timer.stop();
+    timer.endIteration(state);
+    deleteSentMsgs(p_ibuf);
+  }
+  timer.report(state);
+}
+
+// IBOutBuf::sendFlowControl of switch port 0 when the credits of the
+// given VL changed (the VLs below it are scanned)
+// Args: the VL
+void IBMicroBench::benchFlowControl(benchmark::State &state)
+{
+  IBOutBuf *p_obuf = (IBOutBuf *)getPortSubmodule(0, "obuf");
+  cContextSwitcher context(p_obuf);
+  int vl = state.range(0);
+  if (p_obuf->p_popMsg->isScheduled() || !p_obuf->queue.empty() ||
+      !p_obuf->mgtQ.empty()) {
+    state.SkipWithError("the OBUF is sending");
+    return;
+  }
+
+  // only the given VL requires a flow control
+  std::vector<long> FCCL = p_obuf->FCCL;
+  std::vector<long> prevSentFCCL = p_obuf->prevSentFCCL;
+  std::vector<long> prevSentFCTBS = p_obuf->prevSentFCTBS;
+  p_obuf->prevSentFCCL = p_obuf->FCCL;
+  p_obuf->prevSentFCTBS = p_obuf->FCTBS;
+  cDatarateChannel *p_chan = p_obuf->getLinkChannel();
+
+  benchTimer timer;
+  for (auto _ : state) {
+    p_obuf->curFlowCtrVL = 0;
+    p_obuf->isMinTimeUpdate = 1;
+    p_obuf->FCCL[vl]++;
+    timer.start();
+    int sentUpdate = p_obuf->sendFlowControl();
+    timer.stop();
+    timer.endIteration(state);
+    if (!sentUpdate) {
+      state.SkipWithError("no flow control was sent");
+      break;
+    }
+
+    // drop the flow control from the wire
+    p_obuf->cancelEvent(p_obuf->p_popMsg);
+    p_chan->forceTransmissionFinishTime(simTime());
+    deleteSentMsgs(p_obuf);
+  }
+  timer.report(state);
+
+  p_obuf->FCCL = FCCL;
+  p_obuf->prevSentFCCL = prevSentFCCL;
+  p_obuf->prevSentFCTBS = prevSentFCTBS;
+}
+
+// Pktfwd::getPortByLID over all the LIDs of the switch FDB
+// Args: 0 - sequential LIDs, 1 - random LIDs
+void IBMicroBench::benchGetPortByLID(benchmark::State &state)
+{
+  std::vector<unsigned int> lids;
+  for (unsigned int lid = 1;
+       (lid < p_pktfwd->FDB->size()) && (lid < IB_MC_LID_BASE); lid++)
+    lids.push_back(lid);
+  if (lids.empty()) {
+    state.SkipWithError("the FDB holds no destination LIDs");
+    return;
+  }
+  if (state.range(0)) {
+    std::mt19937 rng(1);
+    std::shuffle(lids.begin(), lids.end(), rng);
+  }
+
+  unsigned int i = 0;
+  unsigned long long start = numAllocs;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(p_pktfwd->getPortByLID(lids[i]));
+    if (++i == lids.size())
+      i = 0;
+  }
+  state.counters["allocs/op"] =
+    benchmark::Counter(numAllocs - start, benchmark::Counter::kAvgIterations);
+}
+
+// IBSink::handleData of single packet messages from many sources. The sink
+// queue is drained at once.
+// Args: number of sources
+void IBMicroBench::benchSinkData(benchmark::State &state)
+{
+  cContextSwitcher context(p_sink);
+  unsigned int numSrcs = state.range(0);
+  if (p_sink->p_drainMsg->isScheduled() || !p_sink->queue.empty()) {
+    state.SkipWithError("the sink is draining");
+    return;
+  }
+
+  benchTimer timer;
+  unsigned int i = 0;
+  for (auto _ : state) {
+    // the next packet of the source in sequence
+    unsigned int srcLid = p_sink->lid + 1 + (i++ % numSrcs);
+    std::map<unsigned int, unsigned int>::iterator sI =
+      p_sink->lastPktSnPerSrc.find(srcLid);
+    unsigned int sn = (sI == p_sink->lastPktSnPerSrc.end()) ? 1 :
+      (*sI).second + 1;
+    IBDataMsg *p_msg = newFlit(0, p_sink->lid);
+    p_msg->setSrcLid(srcLid);
+    p_msg->setPacketSn(sn);
+    p_msg->setMsgIdx(sn);
+
+    timer.start();
+    p_sink->handleData(p_msg);
+    timer.stop();
+    timer.endIteration(state);
+
+    p_sink->cancelEvent(p_sink->p_drainMsg);
+    while (!p_sink->queue.empty())
+      delete p_sink->queue.pop();
+  }
+  timer.report(state);
+}
+
+// register the benchmarks with their args. The names carry the switch
+// port count as it is set by the network.
+void IBMicroBench::registerBenchmarks()
+{
+  char ports[32];
+  sprintf(ports, "/ports:%d", numPorts);
+  std::string name;
+  benchmark::internal::Benchmark *p_bm;
+
+  IBVLArb *p_vla = (IBVLArb *)getPortSubmodule(0, "vlarb");
+  name = std::string("VLArb-arbitrate") + ports;
+  p_bm = benchmark::RegisterBenchmark(name.c_str(), runBench, this,
+                                      &IBMicroBench::benchArbitrate);
+  p_bm->ArgNames({"vls", "table", "occ"})->UseManualTime();
+  int vlsSet[] = {1, 4, 8};
+  int occSet[] = {0, 10, 50, 100};
+  for (int v = 0; v < 3; v++) {
+    if (vlsSet[v] > (int)p_vla->maxVL + 1)
+      continue;
+    for (int table = 0; table < 3; table++)
+      for (int o = 0; o < 4; o++)
+        p_bm->Args({vlsSet[v], table, occSet[o]});
+  }
+
+  IBInBuf *p_ibuf = (IBInBuf *)getPortSubmodule(0, "ibuf");
+  int numVLs = p_ibuf->maxVL + 1;
+  name = std::string("InBuf-handlePush") + ports;
+  p_bm = benchmark::RegisterBenchmark(name.c_str(), runBench, this,
+                                      &IBMicroBench::benchInBufPush);
+  p_bm->ArgName("vls")->Arg(1)->UseManualTime();
+  if (numVLs > 1) p_bm->Arg(numVLs);
+  name = std::string("InBuf-handleSent") + ports;
+  p_bm = benchmark::RegisterBenchmark(name.c_str(), runBench, this,
+                                      &IBMicroBench::benchInBufSent);
+  p_bm->ArgName("vls")->Arg(1)->UseManualTime();
+  if (numVLs > 1) p_bm->Arg(numVLs);
+
+  IBOutBuf *p_obuf = (IBOutBuf *)getPortSubmodule(0, "obuf");
+  name = std::string("OutBuf-sendFlowControl") + ports;
+  p_bm = benchmark::RegisterBenchmark(name.c_str(), runBench, this,
+                                      &IBMicroBench::benchFlowControl);
+  p_bm->ArgName("vl")->Arg(0)->UseManualTime();
+  if (p_obuf->maxVL) p_bm->Arg(p_obuf->maxVL);
+
+  name = std::string("Pktfwd-getPortByLID") + ports;
+  p_bm = benchmark::RegisterBenchmark(name.c_str(), runBench, this,
+                                      &IBMicroBench::benchGetPortByLID);
+  p_bm->ArgName("random")->Arg(0)->Arg(1);
+
+  benchmark::RegisterBenchmark("Sink-handleData", runBench, this,
+                               &IBMicroBench::benchSinkData)
+    ->ArgName("srcs")->Arg(1)->Arg(64)->Arg(1944)->UseManualTime();
+}
+
+#endif // WITH_MICROBENCH
+
+// run all the benchmarks in the event and end the simulation
+void IBMicroBench::handleMessage(cMessage *p_msg)
+{
+#ifdef WITH_MICROBENCH
+  // google benchmark takes its flags from a command line
+  std::vector<std::string> args;
+  args.push_back(getFullPath());
+  cStringTokenizer tokens(par("benchmarkArgs"));
+  while (tokens.hasMoreTokens())
+    args.push_back(tokens.nextToken());
+  std::vector<char *> argv;
+  for (unsigned int i = 0; i < args.size(); i++)
+    argv.push_back(&args[i][0]);
+  argv.push_back(NULL);
+  int argc = args.size();
+  benchmark::Initialize(&argc, &argv[0]);
+  if (benchmark::ReportUnrecognizedArguments(argc, &argv[0])) {
+    opp_error("-E- %s unknown benchmarkArgs: %s", getFullPath().c_str(),
+              par("benchmarkArgs").stringValue());
+  }
+
+  registerBenchmarks();
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::ClearRegisteredBenchmarks();
+#endif
+  endSimulation();
+}
+
+IBMicroBench::~IBMicroBench()
+{
+  if (p_startMsg)
+    cancelAndDelete(p_startMsg);
+}
@@ -0,0 +1,115 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Micro Benchmarks of the Model Kernels
+//
+// Overview:
+// =========
+// Google benchmark micro benchmarks of the hot event handlers of the model
+// driven inside a running simulation. The network (see
+// examples/microbench) holds a single switch and quiet HCAs. Once the
+// initial credits were exchanged the bench module calls the real kernel
+// methods of these modules again and again within a single event:
+// * VLArb-arbitrate - IBVLArb::arbitrate of switch port 0 by the number of
+//   VLs, the VLA table configuration and the occupancy of its HoQs
+// * InBuf-handlePush, InBuf-handleSent - IBInBuf::handlePush of a single
+//   FLIT packet into switch port 0 and the IBInBuf::handleSent of its
+//   credit by the number of VLs the packets use
+// * OutBuf-sendFlowControl - IBOutBuf::sendFlowControl of switch port 0 by
+//   the VL whose credits changed (the VLs scanned)
+// * Pktfwd-getPortByLID - the switch FDB lookup over all the FDB LIDs in
+//   sequence or at random
+// * Sink-handleData - IBSink::handleData of the HCA by the number of
+//   sources the packets come from
+// The switch port count is a parameter of the network so every run of the
+// ini benchmarks one port count. The benchmark names carry it.
+//
+// Each benchmark iteration sets the state, times the kernel call only and
+// then removes the events it produced from the FES such that the network
+// state is the same for the next iteration. Every benchmark reports ns/op
+// and allocs/op (operator new calls within the kernel call). The time of
+// the kernel call is measured by the steady clock (manual time) so it
+// includes a clock read of a few tens of ns. The FDB lookup has no state
+// to restore and is timed by the benchmark loop.
+//
+// The module requires the simulator be built with WITH_MICROBENCH and
+// google benchmark (make makefiles-microbench). Otherwise it fails on
+// initialize.
+//
+// Parameters:
+// startTime - the time the benchmarks run, after the credits exchange
+// benchmarkArgs - google benchmark flags like "--benchmark_filter=VLArb"
+// switchName, hcaName - the network switch and HCA driven
+//
+
+#ifndef __MICROBENCH_H
+#define __MICROBENCH_H
+
+#include <omnetpp.h>
+#include <vector>
+#include <string>
+#ifdef WITH_MICROBENCH
+#include <benchmark/benchmark.h>
+#endif
+
+class IBDataMsg;
+class IBVLArb;
+class IBInBuf;
+class IBOutBuf;
+class IBSink;
+class Pktfwd;
+
+//
+// Drives the model kernels by micro benchmarks; see NED for more info.
+//
+class IBMicroBench : public cSimpleModule
+{
+ private:
+  cMessage *p_startMsg;
+
+  // the driven modules
+  cModule *p_switch;
+  Pktfwd *p_pktfwd;
+  IBSink *p_sink;
+  unsigned int numPorts;     // the switch port count
+
+  // methods
+  cModule *getPortSubmodule(unsigned int pn, const char *name);
+  void takeSentMsgs(cModule *p_mod, std::vector<cMessage *> &msgs);
+  void deleteSentMsgs(cModule *p_mod);
+  IBDataMsg *newFlit(int vl, unsigned int dLid);
+#ifdef WITH_MICROBENCH
+  void registerBenchmarks();
+  void benchArbitrate(benchmark::State &state);
+  void benchInBuf(benchmark::State &state, bool timePush);
+  void benchInBufPush(benchmark::State &state) { benchInBuf(state, true); };
+  void benchInBufSent(benchmark::State &state) { benchInBuf(state, false); };
+  void benchFlowControl(benchmark::State &state);
+  void benchGetPortByLID(benchmark::State &state);
+  void benchSinkData(benchmark::State &state);
+#endif
+
+ protected:
+  virtual void initialize();
+  virtual void handleMessage(cMessage *msg);
+  virtual ~IBMicroBench();
+};
+
+#endif
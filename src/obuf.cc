@@ -23,18 +23,25 @@
 //
 #include "ib_m.h"
 #include "obuf.h"
+#include "vlarb.h"
+#include "profiler.h"
 
 Define_Module( IBOutBuf );
 
 void IBOutBuf::initialize()
 {
+  IB_PROF_CALL("IBOutBuf::initialize");
   // read parameters
   qSize = par("size");
   maxVL = par("maxVL");
 
   Enabled = par("enabled");
+  linkUp = true;
+  numDiscardedFlits = 0;
 
-  credMinTime_us = par("credMinTime");
+  credMinTime_us = getCredMinTime_us();
+  EV << "-I- " << getFullPath() << " credMinTime = " << credMinTime_us
+     << " [usec]" << endl;
 
   // Initiazlize the statistical collection elements
   qDepthHist.setName("Queue Usage");
@@ -84,11 +91,42 @@ void IBOutBuf::initialize()
   }
 } // initialize
 
+// the channel of the link driven by this port
+cDatarateChannel *IBOutBuf::getLinkChannel()
+{
+  cDatarateChannel *p_chan =
+    dynamic_cast<cDatarateChannel *>(gate("out")->getTransmissionChannel());
+  if (!p_chan) {
+    opp_error("-E- %s fail to get the out port channel", getFullPath().c_str());
+  }
+  return p_chan;
+}
+
+// the configured time between credit updates or the one derived from
+// the link delay and rate
+double IBOutBuf::getCredMinTime_us()
+{
+  if (!par("credMinTimeByBDP").boolValue())
+    return par("credMinTime");
+
+  cDatarateChannel *p_chan = getLinkChannel();
+  double minTime_us = p_chan->getDelay().dbl() * 1e6;
+  double pktTime_us = 4096.0 * 8 / p_chan->getDatarate() * 1e6;
+  if (minTime_us < pktTime_us)
+    minTime_us = pktTime_us;
+  return minTime_us;
+}
+
 // places a new allocated IBTQLoadUpdateMsg on the buffer
 void IBOutBuf::sendOrQueuePortLoadUpdateMsg(unsigned int rank, unsigned int firstLid, unsigned int lastLid, int load) {
 	Enter_Method("sendOrQueuePortLoadUpdateMsg lid-range:[%d,%d] load:%d",
 			firstLid, lastLid, load);
 
+	if (!linkUp) {
+		EV << "-I- " << getFullPath() << " link down - no port-load msg" << endl;
+		return;
+	}
+
 	IBTQLoadUpdateMsg *p_msg = new IBTQLoadUpdateMsg("load-update", IB_TQ_LOAD_MSG);
 	p_msg->setSrcRank(rank);
 	p_msg->setLoad(load);
@@ -128,6 +166,7 @@ void IBOutBuf::sendOutMessage(IBWireMsg *p_msg) {
     FCTBS[p_msg->getVL()]++;
 
     flitsSources.collect(p_dataMsg->getSrcLid());
+    chargeLatencyStage(p_dataMsg, IB_LAT_OUT_QUEUE);
   }
   send(p_msg, "out");
 
@@ -148,6 +187,13 @@ void
 IBOutBuf::qMessage(IBDataMsg *p_msg) {
   // we stamp it to know how much time it stayed with us
   //p_msg->setTimestamp(simTime());
+  chargeLatencyStage(p_msg, IB_LAT_XBAR);
+
+  // a down link only completes the packet on the wire
+  if (!linkUp && !insidePacket) {
+    discardFlit(p_msg);
+    return;
+  }
 
   if ( p_popMsg->isScheduled() ) {
     if ( qSize <= queue.length() ) {
@@ -172,6 +218,53 @@ IBOutBuf::qMessage(IBDataMsg *p_msg) {
   }
 } // qMessage
 
+// drop a data FLIT of a down link and let the VLA send the next one
+void IBOutBuf::discardFlit(IBDataMsg *p_msg)
+{
+  EV << "-I- " << getFullPath() << " link down - discarding:"
+     << p_msg->getName() << endl;
+  FCTBS[p_msg->getVL()]++;
+  numDiscardedFlits++;
+  delete p_msg;
+  send(new cMessage("free", IB_FREE_MSG), "free");
+}
+
+// drop all the queued messages of a down link
+void IBOutBuf::flushQueues()
+{
+  while (!mgtQ.empty())
+    delete mgtQ.pop();
+  while (!queue.empty())
+    discardFlit((IBDataMsg *)queue.pop());
+  qDepth.record(0);
+}
+
+// fail or recover the link. A recovered link sends flow control at once.
+void IBOutBuf::setLinkUp(bool up)
+{
+  Enter_Method("setLinkUp %d", up);
+  if (!Enabled || (linkUp == up))
+    return;
+
+  EV << "-I- " << getFullPath() << " link " << (up ? "UP" : "DOWN") << endl;
+  linkUp = up;
+  if (!up) {
+    if (!insidePacket && !p_popMsg->isScheduled())
+      flushQueues();
+  } else {
+    curFlowCtrVL = 0;
+    isMinTimeUpdate = 1;
+    if (!p_popMsg->isScheduled())
+      scheduleAt(simTime(), p_popMsg);
+  }
+
+  // the VLA ignores the credits of a down link
+  cGate *p_gate = gate("in")->getPathStartGate();
+  IBVLArb *p_vla = dynamic_cast<IBVLArb *>(p_gate->getOwnerModule());
+  if (p_vla)
+    p_vla->setLinkUp(up);
+}
+
 // check if need to send a flow control and send it if required.
 // return 1 if sent or 0 if not
 // this function should be called by the pop event to check if flow control
@@ -192,6 +285,10 @@ int IBOutBuf::sendFlowControl()
   if (! isMinTimeUpdate && ! queue.empty())
     return(0);
 
+  // no flow control on a down link
+  if (!linkUp)
+    return(0);
+
   if (curFlowCtrVL >= maxVL+1) {
     return(0);
   }
@@ -263,6 +360,13 @@ void IBOutBuf::handlePop()
     send(p_msg, "free");
   }
 
+  // once the packet on the wire completed a down link sends nothing
+  if (!linkUp && !insidePacket) {
+    flushQueues();
+    prevPopWasDataCredit = 0;
+    return;
+  }
+
   // first send mgt msg then try sending a flow control if required:
   if (!mgtQ.empty()) {
 	  IBWireMsg *p_msg = (IBWireMsg*)mgtQ.pop();
@@ -340,6 +444,7 @@ void IBOutBuf::handleRxCred(IBRxCredMsg *p_msg)
 
 void IBOutBuf::handleMessage(cMessage *p_msg)
 {
+  IB_PROF_EVENT(p_msg);
   int msgType = p_msg->getKind();
   if ( msgType == IB_POP_MSG ) {
     handlePop();
@@ -376,10 +481,41 @@ void IBOutBuf::finish()
 
 	double oBW = totalBytesSent / (simTime() - firstPktSendTime);
 	recordScalar("Output BW (Byte/Sec)", oBW);
+	if (numDiscardedFlits)
+		recordScalar("Link-Down-Discarded-FLITs", numDiscardedFlits);
 	flitsSources.record();
 	// EV << "STAT: " << getFullPath() << " Flit Sources:" << endl << flitsSources.detailedInfo() << endl;
 }
 
+void IBOutBuf::snapshotState(stateSnapshot &s)
+{
+  snap(s, curFlowCtrVL);
+  snap(s, isMinTimeUpdate);
+  snap(s, linkUp);
+  s.queue(queue);
+  s.queue(mgtQ);
+  snap(s, prevPopWasDataCredit);
+  snap(s, insidePacket);
+  snap(s, prevFCTime);
+  snap(s, prevSentFCCL);
+  snap(s, prevSentFCTBS);
+  snap(s, FCTBS);
+  snap(s, FCCL);
+  snap(s, packetHeadTimeStamp);
+  s.timer(p_popMsg);
+  if (Enabled)
+    s.timer(p_minTimeMsg);
+
+  // the FLIT being transmitted keeps the link busy
+  cChannel *p_chan = gate("out")->findTransmissionChannel();
+  simtime_t busyUntil = 0;
+  if (p_chan)
+    busyUntil = p_chan->getTransmissionFinishTime();
+  snap(s, busyUntil);
+  if (p_chan && s.isLoading())
+    p_chan->forceTransmissionFinishTime(busyUntil);
+}
+
 IBOutBuf::~IBOutBuf() {
   if (p_popMsg) cancelAndDelete(p_popMsg);
 }
@@ -27,6 +27,9 @@
 //
 // Parameters
 // * CreditMinRate - the time between credit updates
+// * credMinTimeByBDP - derive the time between credit updates from the
+//   link: half the round trip propagation delay but no less than the wire
+//   time of a 4KB packet (keeps the flow control overhead low)
 // * OutRate - the rate by which flits leave the buffer
 //
 // Internal Events
@@ -38,6 +41,7 @@
 // External Events
 // * Push - new credit is provided in
 // * RxCred - information regarding the IBUF credits
+// * setLinkUp - a method call by the failures controller
 //
 // Function
 // * FCTBS is a local parameter incremented on every data packet sent
@@ -48,6 +52,11 @@
 // * Each MinTime a "credit update" packet is placed in the Q if
 //   needed by comparing to previous FCCL and FCTBS update
 // * On "Pop" send a "Push" with one credit through OUT
+// * While the link is down (after the packet on the wire completes) data
+//   FLITs are discarded as they arrive and no flow control is sent.
+//   Discarded FLITs still count in FCTBS such that the receiver ABR
+//   resyncs by the first flow control once the link is up. The driving
+//   VLA is told to ignore credits while the link is down so it drains.
 // 
 
 #ifndef __OBUF_H
@@ -56,11 +65,15 @@
 #include <omnetpp.h>
 #include <vector>
 #include "ib_m.h"
+#include "snapshot.h"
 //
 // Output Buffer for sending IB FLITs and VL credit updates
 //
-class IBOutBuf : public cSimpleModule
+class IBOutBuf : public cSimpleModule, public snapshotModule
 {
+  // the micro benchmarks drive the private handlers (microbench.h)
+  friend class IBMicroBench;
+
  private:
   cMessage *p_popMsg;
   cMessage *p_minTimeMsg;
@@ -74,6 +87,8 @@ class IBOutBuf : public cSimpleModule
   int curFlowCtrVL;    // The VL to sent FC on. If == 8 loop back to 0
   int isMinTimeUpdate; // set by minTime event. flag updates caused by minTime
   bool Enabled;        // Is this port enabled or is it part of a 8x/12x
+  bool linkUp;         // cleared while the link is failed
+  unsigned int numDiscardedFlits; // data FLITs discarded on a down link
   cQueue queue;             // holds the outstanding data
   cQueue mgtQ;              // holds outstanding management packets
   int numDataCreditsQueued; // needed to make sure we do not overflow the qSize
@@ -88,6 +103,8 @@ class IBOutBuf : public cSimpleModule
   // Methods
   void sendOutMessage(IBWireMsg *p_msg);
   void qMessage(IBDataMsg *p_msg);
+  void discardFlit(IBDataMsg *p_msg);
+  void flushQueues();
   int  sendFlowControl();
   void handlePop();
   void handleMinTime();
@@ -122,6 +139,18 @@ public:
    // send or queue a message about port utilization into the obuf
    void sendOrQueuePortLoadUpdateMsg(unsigned int rank, unsigned int firstLid, unsigned int lastLid, int load);
 
+   // the channel of the link driven by this port
+   cDatarateChannel *getLinkChannel();
+
+   // the time between credit updates - may be called before initialize
+   double getCredMinTime_us();
+
+   // fail or recover the link driven by this port
+   void setLinkUp(bool up);
+
+   // the queues, FCTBS/FCCL and the busy time of the link
+   virtual void snapshotState(stateSnapshot &s);
+
 };
 
 #endif
@@ -17,13 +17,16 @@
 // SOFTWARE.
 //
 ///////////////////////////////////////////////////////////////////////////
+#include "ib_m.h"
 #include "pktfwd.h"
 #include <vec_file.h>
 #include "obuf.h"
+#include "profiler.h"
 
 Define_Module(Pktfwd);
 
 void Pktfwd::initialize() {
+	IB_PROF_CALL("Pktfwd::initialize");
 
 	Switch = getParentModule();
 	if (!Switch) {
@@ -35,18 +38,74 @@ void Pktfwd::initialize() {
 	const char *fdbsFile = par("fdbsVecFile");
 	int fdbIdx = par("fdbIndex");
 	vecFiles *vecMgr = vecFiles::get();
-	FDB = vecMgr->getIntVec(fdbsFile, fdbIdx);
+	{
+		IB_PROF_CALL("vecFiles::getIntVec");
+		FDB = vecMgr->getIntVec(fdbsFile, fdbIdx);
+	}
 	if (FDB == NULL) {
 		opp_error("-E- Failed to obtain an FDB %s, %d", fdbsFile, fdbIdx);
 	} else {
 		EV<< "-I- " << getFullPath() << " Obtained FDB of size:"
 		<< FDB->size() << endl;
 	}
+
+	// the SL2VL table may hold 16 entries used by all port pairs,
+	// 16 entries per out port or 16 entries per in port and out port pair
+	const char *sl2vlFile = par("sl2vlVecFile");
+	SL2VL = NULL;
+	if (strlen(sl2vlFile)) {
+		int sl2vlIdx = par("sl2vlIndex");
+		SL2VL = vecMgr->getIntVec(sl2vlFile, sl2vlIdx);
+		if (SL2VL == NULL) {
+			opp_error("-E- Failed to obtain an SL2VL table %s, %d", sl2vlFile,
+					sl2vlIdx);
+		}
+		unsigned int size = SL2VL->size();
+		if ((size != 16) && (size != 16 * (unsigned int)numPorts) &&
+				(size != 16 * (unsigned int)(numPorts * numPorts))) {
+			opp_error("-E- SL2VL table %s, %d size: %d is not 16, 16*%d or 16*%d^2",
+					sl2vlFile, sl2vlIdx, size, numPorts, numPorts);
+		}
+		EV<< "-I- " << getFullPath() << " Obtained SL2VL table of size:"
+		<< size << endl;
+	}
+
+	// the MFT is optional - multicast packets require it
+	const char *mftFile = par("mftVecFile");
+	MFT = NULL;
+	mftBlocks = (numPorts + 15) / 16;
+	if (strlen(mftFile)) {
+		int mftIdx = par("mftIndex");
+		MFT = vecMgr->getIntVec(mftFile, mftIdx);
+		if (MFT == NULL) {
+			opp_error("-E- Failed to obtain an MFT %s, %d", mftFile, mftIdx);
+		}
+		if (MFT->size() % mftBlocks) {
+			opp_error("-E- MFT %s, %d size: %d is not a multiple of %d port masks",
+					mftFile, mftIdx, MFT->size(), mftBlocks);
+		}
+		EV<< "-I- " << getFullPath() << " Obtained MFT of "
+		<< MFT->size() / mftBlocks << " MLIDs" << endl;
+	}
+}
+
+// replace the FDB by a precomputed one from a vec file
+void Pktfwd::loadFDB(const char *fdbsFile, int fdbIdx) {
+	Enter_Method("loadFDB %s %d", fdbsFile, fdbIdx);
+	std::vector<int> *newFDB = vecFiles::get()->getIntVec(fdbsFile, fdbIdx);
+	if (newFDB == NULL) {
+		opp_error("-E- %s Failed to obtain an FDB %s, %d",
+				getFullPath().c_str(), fdbsFile, fdbIdx);
+	}
+	FDB = newFDB;
+	EV<< "-I- " << getFullPath() << " Loaded FDB " << fdbsFile << ", "
+	<< fdbIdx << " of size:" << FDB->size() << endl;
 }
 
 // get the output port for the given LID - the actual AR or deterministic routing
 int Pktfwd::getPortByLID(unsigned int lid) {
 	Enter_Method("getPortByLID LID: %d", lid);
+	IB_PROF_CALL("Pktfwd::getPortByLID");
 	unsigned int outPort; // the resulting output port
 	if (lid >= FDB->size()) {
 		opp_error("-E- getPortByLID: LID %d is out of available FDB range %d",
@@ -57,6 +116,53 @@ int Pktfwd::getPortByLID(unsigned int lid) {
 	return(outPort);
 }
 
+// get the output ports of the MLID by its MFT port masks. The packet is
+// never sent back through its in port.
+int Pktfwd::getPortsByMLID(unsigned int mlid, unsigned int inPort,
+		std::vector<int> &outPorts) {
+	outPorts.clear();
+	if (!MFT) {
+		opp_error("-E- %s getPortsByMLID: MLID %d with no MFT (mftVecFile)",
+				getFullPath().c_str(), mlid);
+	}
+	if ((mlid < IB_MC_LID_BASE) || (mlid > IB_MC_LID_TOP)) {
+		opp_error("-E- getPortsByMLID: LID %d is not a multicast LID", mlid);
+	}
+
+	// MLIDs beyond the MFT have no members
+	unsigned int base = (mlid - IB_MC_LID_BASE) * mftBlocks;
+	if (base >= MFT->size())
+		return(0);
+
+	for (int pn = 0; pn < numPorts; pn++) {
+		if ((unsigned int)pn == inPort)
+			continue;
+		if ((*MFT)[base + pn / 16] & (1 << (pn % 16)))
+			outPorts.push_back(pn);
+	}
+	return(outPorts.size());
+}
+
+// get the out VL by the SL2VL table - keep the in VL if no table is given
+int Pktfwd::getVLBySL(unsigned int inPort, unsigned int outPort,
+		unsigned int sl, int inVL) {
+	if (!SL2VL)
+		return(inVL);
+	if (sl > 15) {
+		opp_error("-E- getVLBySL: SL %d is out of range", sl);
+	}
+
+	unsigned int idx;
+	if (SL2VL->size() == 16) {
+		idx = sl;
+	} else if (SL2VL->size() == 16 * (unsigned int)numPorts) {
+		idx = 16 * outPort + sl;
+	} else {
+		idx = 16 * (inPort * numPorts + outPort) + sl;
+	}
+	return((*SL2VL)[idx]);
+}
+
 // report queuing of flits on TQ for DLID (can be negative for arb)
 int Pktfwd::repQueuedFlits(unsigned int rq, unsigned int tq, unsigned int dlid, int numFlits) {
 	Enter_Method("repQueuedFlits tq:%d flits:%d", tq, numFlits);
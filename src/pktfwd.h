@@ -25,6 +25,11 @@
 //
 // The packet forwarder is responsible for output port selection
 //
+// Unicast DLIDs are routed by the FDB (LFT). Multicast DLIDs (MLIDs) are
+// routed by the MFT given in the optional mftVecFile vector mftIndex.
+// Like the IB MFT it holds 16 bit port masks: ceil(numPorts/16) masks per
+// MLID starting at IB_MC_LID_BASE, the first masking ports 0-15 and so on.
+//
 class Pktfwd : public cSimpleModule
 {
 public:
@@ -35,11 +40,27 @@ public:
   // state
   int numPorts;          // number of switch ports
   std::vector<int> *FDB; // deterministic routing out port by dlid from vec file
+  std::vector<int> *SL2VL; // out VL by in port, out port and SL or NULL
+  std::vector<int> *MFT;   // multicast port masks by MLID or NULL
+  unsigned int mftBlocks;  // number of 16 ports masks per MLID
   cModule* Switch;
 
 public:
   // get the output port for the given LID
   virtual int getPortByLID(unsigned int lid);
+
+  // get the output ports of the given MLID other than the in port
+  // return the number of ports
+  virtual int getPortsByMLID(unsigned int mlid, unsigned int inPort,
+                             std::vector<int> &outPorts);
+
+  // replace the FDB by the given one - packets already routed keep
+  // their out port
+  virtual void loadFDB(const char *fdbsFile, int fdbIdx);
+
+  // get the out VL for the given in port, out port and SL
+  virtual int getVLBySL(unsigned int inPort, unsigned int outPort,
+                        unsigned int sl, int inVL);
   
   // report queuing of flits on TQ for DLID (can be negative for arb)
   virtual int repQueuedFlits(unsigned int rq, unsigned int tq, unsigned int dlid, int numFlits);
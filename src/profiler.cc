@@ -0,0 +1,218 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBProfiler accumulates the model self profiling call tree and dumps
+// it on finish. See functional description in the header file.
+//
+#include "ib_m.h"
+#include "profiler.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+Define_Module( IBProfiler );
+
+IBProfiler *IBProfiler::active = NULL;
+std::vector<std::pair<const char *, double> > IBProfiler::startupMarks;
+
+// taken when the model library is loaded - before the NED files load
+static struct timespec getTime()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t;
+}
+static struct timespec processStart = getTime();
+
+void IBProfiler::markStartup(const char *phase)
+{
+  struct timespec t = getTime();
+  startupMarks.push_back(std::make_pair(phase,
+    (t.tv_sec - processStart.tv_sec)*1e9 + (t.tv_nsec - processStart.tv_nsec)));
+}
+
+void IBProfiler::initialize(int stage)
+{
+  // all modules have completed their single stage initialize
+  if (stage == 1) {
+    if (active != this)
+      return;
+    markStartup("initialize");
+    double prevNs = 0;
+    for (unsigned int i = 0; i < startupMarks.size(); i++) {
+      EV << "-I- " << getFullPath() << " startup phase: "
+         << startupMarks[i].first << " took: "
+         << (startupMarks[i].second - prevNs)*1e-6 << "ms" << endl;
+      prevNs = startupMarks[i].second;
+    }
+    return;
+  }
+
+  p_root = new ProfNode("all", NULL);
+  p_cur = p_root;
+  reportFile = par("reportFile").stdstringValue();
+  foldedFile = par("foldedFile").stdstringValue();
+  if (!par("enabled").boolValue()) {
+    EV << "-I- " << getFullPath() << " profiler disabled" << endl;
+    return;
+  }
+
+  if (active) {
+    opp_error("-E- %s only one IBProfiler may be enabled", getFullPath().c_str());
+  }
+  active = this;
+  markStartup("network-setup");
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+// message kinds are named by the IB_MSGS enum of ib.msg
+const char *IBProfiler::kindName(short kind)
+{
+  if (kind < 0)
+    return "NEGATIVE_KIND";
+  if ((unsigned short)kind >= kindNames.size()) {
+    cEnum *p_enum = cEnum::get("IB_MSGS");
+    for (unsigned short k = kindNames.size(); k <= (unsigned short)kind; k++) {
+      const char *name = p_enum->getStringFor(k);
+      kindNames.push_back(name ? name : "OTHER_KIND");
+    }
+  }
+  return kindNames[kind];
+}
+
+void IBProfiler::handleMessage(cMessage *p_msg)
+{
+  opp_error("-E- %s does not expect any message: %s",
+            getFullPath().c_str(), p_msg->getName());
+  delete p_msg;
+}
+
+// walk the tree writing the folded stacks and collecting the frames by path
+void IBProfiler::collectFrames(ProfNode *p_node, std::string path,
+                               std::map<std::string, ProfNode> &byFrame,
+                               std::ostream &folded)
+{
+  if (p_node != p_root) {
+    path = path.empty() ? p_node->name : path + ";" + p_node->name;
+    std::map<std::string, ProfNode>::iterator fI = byFrame.find(path);
+    if (fI == byFrame.end())
+      fI = byFrame.insert(std::make_pair(path, ProfNode(p_node->name, NULL))).first;
+    (*fI).second.calls += p_node->calls;
+    (*fI).second.totalNs += p_node->totalNs;
+    (*fI).second.childNs += p_node->childNs;
+
+    double selfNs = p_node->totalNs - p_node->childNs;
+    if (selfNs >= 1)
+      folded << path << " " << (unsigned long long)selfNs << "\n";
+  }
+
+  std::map<const char *, ProfNode *>::iterator cI;
+  for (cI = p_node->children.begin(); cI != p_node->children.end(); cI++)
+    collectFrames((*cI).second, path, byFrame, folded);
+}
+
+// sort frames by self time
+static bool bySelfTime(const std::pair<std::string, IBProfiler::ProfNode *> &a,
+                       const std::pair<std::string, IBProfiler::ProfNode *> &b)
+{
+  return ((a.second->totalNs - a.second->childNs) >
+          (b.second->totalNs - b.second->childNs));
+}
+
+void IBProfiler::finish()
+{
+  if (active != this)
+    return;
+  active = NULL;
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wallNs = (end.tv_sec - startTime.tv_sec)*1e9 +
+    (end.tv_nsec - startTime.tv_nsec);
+
+  std::ofstream folded(foldedFile.c_str());
+  if (!folded.good()) {
+    opp_error("-E- %s can not write foldedFile: %s",
+              getFullPath().c_str(), foldedFile.c_str());
+  }
+  std::map<std::string, ProfNode> byFrame;
+  collectFrames(p_root, "", byFrame, folded);
+  folded.close();
+
+  std::vector<std::pair<std::string, ProfNode *> > frames;
+  std::map<std::string, ProfNode>::iterator fI;
+  for (fI = byFrame.begin(); fI != byFrame.end(); fI++)
+    frames.push_back(std::make_pair((*fI).first, &(*fI).second));
+  std::sort(frames.begin(), frames.end(), bySelfTime);
+
+  std::ofstream report(reportFile.c_str());
+  if (!report.good()) {
+    opp_error("-E- %s can not write reportFile: %s",
+              getFullPath().c_str(), reportFile.c_str());
+  }
+  char buf[256];
+  double prevNs = 0;
+  report << "# startup phase ms (since process start ms)\n";
+  for (unsigned int i = 0; i < startupMarks.size(); i++) {
+    sprintf(buf, "  %-24s %12.3f (%.3f)\n", startupMarks[i].first,
+            (startupMarks[i].second - prevNs)*1e-6, startupMarks[i].second*1e-6);
+    report << buf;
+    sprintf(buf, "Startup-%s-ms", startupMarks[i].first);
+    recordScalar(buf, (startupMarks[i].second - prevNs)*1e-6);
+    prevNs = startupMarks[i].second;
+  }
+
+  sprintf(buf, "# wallclock: %.3f ms profiled: %.3f ms\n",
+          wallNs*1e-6, p_root->childNs*1e-6);
+  report << buf;
+  sprintf(buf, "# %12s %7s %12s %12s %10s  %s\n",
+          "self-ms", "self-%", "total-ms", "calls", "ns/call", "frame");
+  report << buf;
+  for (unsigned int i = 0; i < frames.size(); i++) {
+    ProfNode *p_node = frames[i].second;
+    double selfNs = p_node->totalNs - p_node->childNs;
+    sprintf(buf, "  %12.3f %7.2f %12.3f %12llu %10.1f  ",
+            selfNs*1e-6,
+            p_root->childNs ? 100.0*selfNs/p_root->childNs : 0.0,
+            p_node->totalNs*1e-6, p_node->calls,
+            p_node->calls ? p_node->totalNs/p_node->calls : 0.0);
+    report << buf << frames[i].first << "\n";
+  }
+  report.close();
+
+  EV << "-I- " << getFullPath() << " written profile: " << reportFile
+     << " and folded stacks: " << foldedFile << endl;
+  recordScalar("Profiled-Wallclock-ms", p_root->childNs*1e-6);
+}
+
+void IBProfiler::deleteTree(ProfNode *p_node)
+{
+  std::map<const char *, ProfNode *>::iterator cI;
+  for (cI = p_node->children.begin(); cI != p_node->children.end(); cI++)
+    deleteTree((*cI).second);
+  delete p_node;
+}
+
+IBProfiler::~IBProfiler() {
+  if (active == this)
+    active = NULL;
+  if (p_root)
+    deleteTree(p_root);
+}
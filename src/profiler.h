@@ -0,0 +1,183 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Model Self Profiler - where does the simulator spend its time
+//
+// Overview:
+// =========
+// An opt-in profiler built into the model. Every module handleMessage and
+// the hot direct method calls open a profiling scope. The scopes form a
+// call tree: the module type, then the message kind it handles, then any
+// direct method calls made while handling it, e.g.:
+//   IBInBuf;IB_DATA_MSG;IBVLArb::isHoQFree
+// For each node the number of calls and the wallclock time (monotonic
+// clock) are accumulated.
+//
+// The module initialize methods are profiled too (with the vector files
+// parsing they trigger). In addition the startup phases are marked by
+// markStartup() with the wallclock since the process started:
+// ned-load       - till the fabric build starts (fast build only)
+// fabric-*       - the fast build topo parsing, creation and connection
+// network-setup  - till the first initialize (incl. NED load and build if
+//                  the network is a static NED)
+// initialize     - all modules initialize
+//
+// At finish two files are written:
+// * reportFile - the startup phases and the frames sorted by self time
+//   with calls and ns/call
+// * foldedFile - flamegraph compatible folded stacks with self time in ns
+//   (feed to flamegraph.pl)
+//
+// Connectivity:
+// =============
+// None. Instantiate one IBProfiler in the network. Modules use the
+// IB_PROF_EVENT/IB_PROF_CALL macros which are no-ops unless it is enabled.
+//
+// Parameters:
+// enabled - if false nothing is measured
+// reportFile - the sorted report file name
+// foldedFile - the folded stacks file name
+//
+
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <omnetpp.h>
+#include <map>
+#include <vector>
+#include <time.h>
+
+//
+// Accumulate per module type, message kind and direct call wallclock times
+//
+class IBProfiler : public cSimpleModule
+{
+ public:
+  // a node in the call tree
+  class ProfNode {
+  public:
+    const char *name;
+    ProfNode *parent;
+    std::map<const char *, ProfNode *> children;
+    unsigned long long calls;
+    double totalNs;   // including children
+    double childNs;   // time spent in children
+    ProfNode(const char *n, ProfNode *p) {
+      name = n; parent = p; calls = 0; totalNs = 0; childNs = 0;
+    };
+  };
+
+  // the enabled profiler or NULL
+  static IBProfiler *active;
+
+  // mark the end of a startup phase - always recorded as it is cheap
+  static void markStartup(const char *phase);
+
+ private:
+  // parameters
+  std::string reportFile;
+  std::string foldedFile;
+
+  // data
+  ProfNode *p_root;
+  ProfNode *p_cur;
+  std::vector<const char *> kindNames; // message kind names by kind
+  struct timespec startTime;
+  static std::vector<std::pair<const char *, double> > startupMarks;
+
+  void deleteTree(ProfNode *p_node);
+  void collectFrames(ProfNode *p_node, std::string path,
+                     std::map<std::string, ProfNode> &byFrame,
+                     std::ostream &folded);
+
+ public:
+  // enter a new scope under the current one
+  ProfNode *enter(const char *name) {
+    std::map<const char *, ProfNode *>::iterator cI = p_cur->children.find(name);
+    if (cI == p_cur->children.end()) {
+      ProfNode *p_node = new ProfNode(name, p_cur);
+      p_cur->children[name] = p_node;
+      p_cur = p_node;
+    } else {
+      p_cur = (*cI).second;
+    }
+    return p_cur;
+  };
+
+  // leave the current scope accounting for the time spent in it
+  void leave(ProfNode *p_node, double ns) {
+    p_node->calls++;
+    p_node->totalNs += ns;
+    p_node->parent->childNs += ns;
+    p_cur = p_node->parent;
+  };
+
+  // the static name of a message kind
+  const char *kindName(short kind);
+
+ protected:
+  virtual int numInitStages() const { return 2; };
+  virtual void initialize(int stage);
+  virtual void handleMessage(cMessage *msg);
+  virtual void finish();
+ public:
+  IBProfiler() { p_root = NULL; p_cur = NULL; };
+  virtual ~IBProfiler();
+};
+
+//
+// A profiling scope - measures from construction to destruction
+//
+class IBProfScope {
+  IBProfiler::ProfNode *p_outer;
+  IBProfiler::ProfNode *p_inner;
+  struct timespec start;
+ public:
+  IBProfScope(const char *frame, const char *subFrame = NULL) {
+    if (!IBProfiler::active) {
+      p_outer = NULL;
+      return;
+    }
+    p_outer = IBProfiler::active->enter(frame);
+    p_inner = subFrame ? IBProfiler::active->enter(subFrame) : NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+  };
+  ~IBProfScope() {
+    if (!p_outer || !IBProfiler::active)
+      return;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = (end.tv_sec - start.tv_sec)*1e9 + (end.tv_nsec - start.tv_nsec);
+    if (p_inner)
+      IBProfiler::active->leave(p_inner, ns);
+    IBProfiler::active->leave(p_outer, ns);
+  };
+};
+
+// profile a handleMessage by module type and message kind
+#define IB_PROF_EVENT(p_msg) \
+  IBProfScope __ibProfScope(getClassName(), \
+    IBProfiler::active ? IBProfiler::active->kindName((p_msg)->getKind()) : NULL)
+
+// profile a direct method call
+#define IB_PROF_CALL(name) \
+  IBProfScope __ibProfScope(name)
+
+#endif
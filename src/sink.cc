@@ -24,19 +24,56 @@
 // hiccup message alternate between an ON and OFF state. During ON state any
 // drain message is ignored. On transition to OFF a new drain message can
 // be generated
+// When the HCA generator runs a reliable transport the sink checks the PSN
+// of every data packet and returns ACK/NAK packets (see sink.h). Packets
+// that are not delivered are still drained to release their credits.
 //
 #include "ib_m.h"
 #include "sink.h"
+#include "app.h"
+#include "gen.h"
+#include "steady.h"
+#include "failures.h"
+#include "profiler.h"
+
+std::map<unsigned int, IBGenerator *> IBSink::gensByLid;
 
 Define_Module( IBSink );
 
 void IBSink::initialize()
 {
+  IB_PROF_CALL("IBSink::initialize");
   waitStats.setName("Waiting time statistics");
   hiccupStats.setName("Hiccup Statistics");
   maxVL = par("maxVL");
   startStatCol_sec = par("startStatCol");
   lid = getParentModule()->par("srcLid");
+  lidMask = (1 << (int)getParentModule()->par("lmc")) - 1;
+  pathCongThreshold = par("pathCongThreshold");
+  pathCongMarks = 0;
+  gensByLid.clear();
+  p_app = dynamic_cast<IBApp *>(getParentModule()->getSubmodule("app"));
+  p_gen = dynamic_cast<IBGenerator *>(getParentModule()->getSubmodule("gen"));
+
+  // the transport mode is a parameter of the HCA generator
+  transport = IB_TRANSPORT_NONE;
+  if (p_gen) {
+    const char *mode = p_gen->par("transport");
+    if (!strcmp(mode, "gbn"))
+      transport = IB_TRANSPORT_GBN;
+    else if (!strcmp(mode, "sr"))
+      transport = IB_TRANSPORT_SR;
+  }
+  ackCoalesce = par("ackCoalesce");
+  if (!ackCoalesce) ackCoalesce = 1;
+  goodputBytes = 0;
+  wireBytes = 0;
+  dupPackets = 0;
+  oosDiscards = 0;
+  acksSent = 0;
+  naksSent = 0;
+  mcPackets = 0;
+  mcBytes = 0;
   PakcetFabricTime.setName("Packet Fabric Time");
   PakcetFabricTime.setRangeAutoUpper(0, 10, 1.5);
 
@@ -60,8 +97,10 @@ void IBSink::initialize()
   scheduleAt(simTime()+1e-9, p_hiccupMsg);
 
   // we track number of packets per VL:
-  for (int vl = 0; vl < maxVL+1; vl++)
+  for (int vl = 0; vl < maxVL+1; vl++) {
     VlFlits.push_back(0);
+    skipPktOnVL.push_back(false);
+  }
 
   WATCH_VECTOR(VlFlits);
 
@@ -75,6 +114,74 @@ void IBSink::initialize()
   msgF2FLatency.setName("Msg-First2First-Network-Latency");
   enoughPktsLatency.setName("Enough-Pkts-Network-Latency");
   enoughToLastPktLatencyStat.setName("Last-to-Enough-Pkt-Arrival");
+  pktInQueueTime.setName("Pkt-InQueue-Time");
+  pktXbarTime.setName("Pkt-Xbar-Time");
+  pktArbWaitTime.setName("Pkt-Arb-Wait-Time");
+  pktOutQueueTime.setName("Pkt-OutQueue-Time");
+  pktWireTime.setName("Pkt-Wire-Time");
+
+  // register with the steady state controller if there is one
+  batchBytes = 0;
+  batchLatSum = 0;
+  batchLatCnt = 0;
+  cModule *p_ssMod = simulation.getSystemModule()->getSubmodule("steadyState");
+  IBSteadyState *p_ss = dynamic_cast<IBSteadyState *>(p_ssMod);
+  if (p_ss)
+    p_ss->registerSink(this);
+
+  // and with the failures controller
+  totDeliveredBytes = 0;
+  cModule *p_failMod = simulation.getSystemModule()->getSubmodule("failures");
+  IBFailures *p_fail = dynamic_cast<IBFailures *>(p_failMod);
+  if (p_fail)
+    p_fail->registerSink(this);
+}
+
+void IBSink::takeBatchCounters(double &bytes, double &latSum, unsigned int &latCnt)
+{
+  Enter_Method_Silent();
+  bytes += batchBytes;
+  latSum += batchLatSum;
+  latCnt += batchLatCnt;
+  batchBytes = 0;
+  batchLatSum = 0;
+  batchLatCnt = 0;
+}
+
+void IBSink::resetStats()
+{
+  Enter_Method("resetStats()");
+  startStatCol_sec = simTime().dbl();
+  waitStats.clearResult();
+  PakcetFabricTime.clearResult();
+  msgLatency.clearResult();
+  smallMsgLatency.clearResult();
+  msgF2FLatency.clearResult();
+  enoughPktsLatency.clearResult();
+  enoughToLastPktLatencyStat.clearResult();
+  oooWindow.clearResult();
+  pktInQueueTime.clearResult();
+  pktXbarTime.clearResult();
+  pktArbWaitTime.clearResult();
+  pktOutQueueTime.clearResult();
+  pktWireTime.clearResult();
+  for (unsigned int i = 0; i < hopStageTime.size(); i++)
+    hopStageTime[i]->clearResult();
+  AccBytesRcv = 0;
+  goodputBytes = 0;
+  wireBytes = 0;
+  dupPackets = 0;
+  oosDiscards = 0;
+  acksSent = 0;
+  naksSent = 0;
+  mcPackets = 0;
+  mcBytes = 0;
+  pathCongMarks = 0;
+  for (int vl = 0; vl < maxVL+1; vl++)
+    VlFlits[vl] = 0;
+  totOOOPackets = 0;
+  totOOPackets = 0;
+  totIOPackets = 0;
 }
 
 // Init a new drain message and schedule it after delay
@@ -84,6 +191,23 @@ void IBSink::newDrainMessage(double delay_us) {
   scheduleAt(simTime()+delay_us*1e-6, p_drainMsg);
 }
 
+// collect the latency decomposition of every hop of the packet head
+void IBSink::collectHopTimes(IBDataMsg *p_msg)
+{
+  static const char *stageNames[IB_LAT_NUM_STAGES] =
+    {"InQueue", "Xbar", "Arb-Wait", "OutQueue", "Wire"};
+  unsigned int n = p_msg->getHopTimeArraySize();
+  while (hopStageTime.size() < n) {
+    char name[64];
+    unsigned int i = hopStageTime.size();
+    sprintf(name, "Hop-%d-%s-Time", i / IB_LAT_NUM_STAGES,
+            stageNames[i % IB_LAT_NUM_STAGES]);
+    hopStageTime.push_back(new cStdDev(name));
+  }
+  for (unsigned int i = 0; i < n; i++)
+    hopStageTime[i]->collect(p_msg->getHopTime(i));
+}
+
 // track consumed messages and send "sent" event to the IBUF
 void IBSink::consumeDataMsg(IBDataMsg *p_msg)
 {
@@ -104,6 +228,16 @@ void IBSink::consumeDataMsg(IBDataMsg *p_msg)
 		d = simTime() - p_msg->getTimestamp();
 		PakcetFabricTime.collect( d );
 	 }
+
+	 // the latency breakdown is carried by the packet head
+	 if (p_msg->getFlitSn() == 0) {
+		pktInQueueTime.collect( p_msg->getInQueueTime() );
+		pktXbarTime.collect( p_msg->getXbarTime() );
+		pktArbWaitTime.collect( p_msg->getArbWaitTime() );
+		pktOutQueueTime.collect( p_msg->getOutQueueTime() );
+		pktWireTime.collect( p_msg->getWireTime() );
+		collectHopTimes(p_msg);
+	 }
   }
 
   int vl = p_msg->getVL();
@@ -116,25 +250,155 @@ void IBSink::consumeDataMsg(IBDataMsg *p_msg)
   delete p_msg;
 }
 
-void IBSink::handleData(IBDataMsg *p_msg)
+// send an ACK/NAK of the last PSN received in sequence to the packet source
+void IBSink::sendTransportAck(IBDataMsg *p_msg, rcRecvQP &qp, int op)
 {
-  double delay_us;
+  if (op == IB_TRANS_NAK) {
+    naksSent++;
+    qp.nakSent = true;
+  } else {
+    acksSent++;
+  }
+  qp.pktsToAck = 0;
+  p_gen->queueTransportAck(p_msg->getSrcLid(), p_msg->getSL(), op,
+                           qp.ePSN - 1);
+}
 
-  // make sure was correctly received (no routing bug)
-  if (p_msg->getDstLid() != (int)lid) {
+// check the PSN of the data packet head. return true if the packet is
+// delivered
+bool IBSink::acceptTransportPkt(IBDataMsg *p_msg)
+{
+  rcRecvQP &qp = recvQPs[p_msg->getSrcLid()];
+  unsigned int psn = p_msg->getPacketSn();
+
+  if ((psn < qp.ePSN) || qp.oosPSNs.count(psn)) {
+    EV << "-I- " << getFullPath() << " duplicate packet:" << p_msg->getName()
+       << " psn:" << psn << " expected:" << qp.ePSN << endl;
+    dupPackets++;
+    sendTransportAck(p_msg, qp, IB_TRANS_ACK);
+    return false;
+  }
+
+  if (psn > qp.ePSN) {
+    EV << "-I- " << getFullPath() << " out of sequence packet:"
+       << p_msg->getName() << " psn:" << psn << " expected:" << qp.ePSN
+       << endl;
+    if (!qp.nakSent)
+      sendTransportAck(p_msg, qp, IB_TRANS_NAK);
+    if (transport == IB_TRANSPORT_GBN) {
+      oosDiscards++;
+      return false;
+    }
+    qp.oosPSNs.insert(psn);
+    return true;
+  }
+
+  // in sequence - skip the packets already delivered out of sequence
+  qp.ePSN++;
+  while (qp.oosPSNs.erase(qp.ePSN))
+    qp.ePSN++;
+  qp.nakSent = false;
+  if ((++qp.pktsToAck >= ackCoalesce) ||
+      (p_msg->getPktIdx() + 1 == p_msg->getMsgLen()))
+    sendTransportAck(p_msg, qp, IB_TRANS_ACK);
+  return true;
+}
+
+// report the path of a packet head queued for too long to its source
+void IBSink::checkPathCongestion(IBDataMsg *p_msg)
+{
+  if (pathCongThreshold <= 0)
+    return;
+
+  simtime_t queued = p_msg->getInQueueTime() + p_msg->getArbWaitTime() +
+    p_msg->getOutQueueTime();
+  if (queued < pathCongThreshold)
+    return;
+
+  // collect the generators on first use
+  if (gensByLid.empty()) {
+    cModule *p_sys = simulation.getSystemModule();
+    for (cModule::SubmoduleIterator i(p_sys); !i.end(); i++) {
+      cModule *p_hca = i();
+      if (!p_hca->hasPar("srcLid"))
+        continue;
+      IBGenerator *p_srcGen =
+        dynamic_cast<IBGenerator *>(p_hca->getSubmodule("gen"));
+      if (!p_srcGen)
+        continue;
+      // the LID ranges are found by masking so all HCAs share the lmc
+      if (((1 << (int)p_hca->par("lmc")) - 1) != (int)lidMask)
+        opp_error("-E- %s HCA: %s lmc: %d differs from this HCA lmc",
+                  getFullPath().c_str(), p_hca->getFullPath().c_str(),
+                  (int)p_hca->par("lmc"));
+      gensByLid[(int)p_hca->par("srcLid")] = p_srcGen;
+    }
+  }
+
+  std::map<unsigned int, IBGenerator *>::iterator gI =
+    gensByLid.find(p_msg->getSrcLid());
+  if (gI == gensByLid.end())
+    return;
+
+  pathCongMarks++;
+  EV << "-I- " << getFullPath() << " packet from:" << p_msg->getSrcLid()
+     << " to:" << p_msg->getDstLid() << " queued:" << queued
+     << " marks its path congested" << endl;
+  (*gI).second->pathCongested(p_msg->getDstLid());
+}
+
+void IBSink::handleData(IBDataMsg *p_msg)
+{
+  // make sure was correctly received (no routing bug) - multicast packets
+  // are received by all the members of the MLID
+  bool isMc = (p_msg->getDstLid() >= IB_MC_LID_BASE);
+  if (!isMc && ((p_msg->getDstLid() & ~lidMask) != lid)) {
 	  opp_error("-E- Received packet to %d while self lid is %d",
 			  p_msg->getDstLid() , lid);
   }
 
-  // for head of packet calculate out of order
+  // the packet head decides if the packet is delivered
+  int vl = p_msg->getVL();
+  if (p_msg->getFlitSn() == 0) {
+	  if (p_msg->getTransportOp() != IB_TRANS_DATA) {
+		  if (p_gen)
+			  p_gen->transportAckReceived(p_msg->getSrcLid(),
+			                              p_msg->getTransportOp(),
+			                              p_msg->getAckPsn());
+		  skipPktOnVL[vl] = true;
+	  } else if ((transport != IB_TRANSPORT_NONE) && p_gen && !isMc) {
+		  skipPktOnVL[vl] = !acceptTransportPkt(p_msg);
+	  } else {
+		  skipPktOnVL[vl] = false;
+	  }
+	  if ((p_msg->getTransportOp() == IB_TRANS_DATA) && !isMc)
+		  checkPathCongestion(p_msg);
+  }
+
+  if (simTime() >= startStatCol_sec)
+	  wireBytes += p_msg->getByteLength();
+
+  // skipped packets are not data delivered to the HCA
+  if (skipPktOnVL[vl]) {
+	  queueDataMsg(p_msg);
+	  return;
+  }
+
+  // for head of packet calculate out of order. The source numbers the
+  // packets of each MLID apart from its unicast ones.
   if (p_msg->getFlitSn() == 0) {
 	  unsigned int srcLid = p_msg->getSrcLid();
 	  unsigned int srcPktSn = p_msg->getPacketSn();
-	 if (lastPktSnPerSrc.find(srcLid) != lastPktSnPerSrc.end()) {
-		  unsigned int curSn = lastPktSnPerSrc[srcLid];
+	  unsigned int snKey = srcLid;
+	  if (isMc) {
+		  snKey |= (unsigned int)p_msg->getDstLid() << 16;
+		  mcPackets++;
+	  }
+	 if (lastPktSnPerSrc.find(snKey) != lastPktSnPerSrc.end()) {
+		  unsigned int curSn = lastPktSnPerSrc[snKey];
 		  if (srcPktSn == 1+curSn) {
 			  // OK case
-			  lastPktSnPerSrc[srcLid]++;
+			  lastPktSnPerSrc[snKey]++;
 			  totIOPackets++;
 		  } else if (srcPktSn < curSn) {
 			  // We do not count tail as OOO
@@ -143,7 +407,7 @@ void IBSink::handleData(IBDataMsg *p_msg)
 			  totOOOPackets++;
 			  totOOPackets += srcPktSn - curSn;
 			  oooPackets.record(totOOOPackets);
-			  lastPktSnPerSrc[srcLid] = srcPktSn;
+			  lastPktSnPerSrc[snKey] = srcPktSn;
 			  oooWindow.collect(srcPktSn-curSn);
 		  } else if (srcPktSn == curSn) {
 			  // this is a BUG!
@@ -155,7 +419,7 @@ void IBSink::handleData(IBDataMsg *p_msg)
 					  curSn, srcPktSn);
 		 }
 	 } else {
-		 lastPktSnPerSrc[srcLid] = srcPktSn;
+		 lastPktSnPerSrc[snKey] = srcPktSn;
 		 totIOPackets++;
 	 }
   }
@@ -212,17 +476,35 @@ void IBSink::handleData(IBDataMsg *p_msg)
 		    smallMsgLatency.collect(simTime() - (*mI).second.firstFlitTime);
 		  }
 		  msgLatency.collect(simTime() - (*mI).second.firstFlitTime);
+		  batchLatSum += (simTime() - (*mI).second.firstFlitTime).dbl();
+		  batchLatCnt++;
 		  EV << "-I- " << getFullPath() << " received last flit of message from src: "
 				 <<  p_msg->getSrcLid() << " app:" << p_msg->getAppIdx() << " msg: " << p_msg->getMsgIdx() << endl;
 		  outstandingMsgsData.erase(mt);
+		  if (p_app && !isMc)
+			  p_app->msgReceived(p_msg->getSrcLid(), p_msg->getTag(),
+			                     p_msg->getRpcType(), p_msg->getBarrierStage());
 	  }
   }
 
   // for iBW calculations
+  batchBytes += p_msg->getByteLength();
+  totDeliveredBytes += p_msg->getByteLength();
   if (simTime() >= startStatCol_sec) {
 	 AccBytesRcv += p_msg->getByteLength(); // p_msg->getBitLength()/8;
+	 goodputBytes += p_msg->getByteLength();
+	 if (isMc)
+		 mcBytes += p_msg->getByteLength();
   }
 
+  queueDataMsg(p_msg);
+}
+
+// queue the FLIT for the drain
+void IBSink::queueDataMsg(IBDataMsg *p_msg)
+{
+  double delay_us;
+
   // we might be arriving on empty buffer:
   if ( ! p_drainMsg->isScheduled() ) {
     EV << "-I- " << getFullPath() << " data:" << p_msg->getName()
@@ -292,6 +574,7 @@ void IBSink::handleHiccup(cMessage *p_msg)
 
 void IBSink::handleMessage(cMessage *p_msg)
 {
+  IB_PROF_EVENT(p_msg);
   simtime_t delay;
   int kind = p_msg->getKind();
 
@@ -328,6 +611,13 @@ void IBSink::finish()
   msgF2FLatency.record();
   enoughPktsLatency.record();
   enoughToLastPktLatencyStat.record();
+  pktInQueueTime.record();
+  pktXbarTime.record();
+  pktArbWaitTime.record();
+  pktOutQueueTime.record();
+  pktWireTime.record();
+  for (unsigned int i = 0; i < hopStageTime.size(); i++)
+    hopStageTime[i]->record();
 
   double iBW = AccBytesRcv / (simTime() - startStatCol_sec);
   recordScalar("Sink-BW-MBps", iBW/1e6);
@@ -337,11 +627,74 @@ void IBSink::finish()
   }
   oooWindow.record();
   recordScalar("OO-IO-Packets-Ratio", 1.0*totOOPackets/totIOPackets);
+  if (transport != IB_TRANSPORT_NONE) {
+    recordScalar("Goodput-MBps",
+                 goodputBytes / (simTime() - startStatCol_sec) / 1e6);
+    recordScalar("Wire-BW-MBps",
+                 wireBytes / (simTime() - startStatCol_sec) / 1e6);
+    recordScalar("Duplicate-Packets", dupPackets);
+    recordScalar("OOS-Discarded-Packets", oosDiscards);
+    recordScalar("ACKs-Sent", acksSent);
+    recordScalar("NAKs-Sent", naksSent);
+  }
+  if (mcPackets) {
+    recordScalar("Multicast-Packets-Received", mcPackets);
+    recordScalar("Multicast-MBps",
+                 mcBytes / (simTime() - startStatCol_sec) / 1e6);
+  }
+  if (pathCongThreshold > 0)
+    recordScalar("Path-Congestion-Marks", pathCongMarks);
   recordScalar("Num-SRCs", lastPktSnPerSrc.size());
   lastPktSnPerSrc.clear();
 }
 
+static void snap(stateSnapshot &s, rcRecvQP &qp)
+{
+  snap(s, qp.ePSN);
+  snap(s, qp.nakSent);
+  snap(s, qp.pktsToAck);
+  snap(s, qp.oosPSNs);
+}
+
+static void snap(stateSnapshot &s, OutstandingMsgData &d)
+{
+  snap(s, d.firstFlitTime);
+  snap(s, d.enoughPktsLastFlitTime);
+  snap(s, d.numPktsReceived);
+}
+
+void IBSink::snapshotState(stateSnapshot &s)
+{
+  snap(s, duringHiccup);
+  s.queue(queue);
+  snap(s, lastConsumedPakcet);
+  snap(s, recvQPs);
+  snap(s, skipPktOnVL);
+  snap(s, lastPktSnPerSrc);
+
+  // the message tuple has no default constructor
+  unsigned long n = outstandingMsgsData.size();
+  snap(s, n);
+  std::map<MsgTupple, OutstandingMsgData, MsgTuppleLess>::iterator mI =
+    outstandingMsgsData.begin();
+  if (s.isLoading()) outstandingMsgsData.clear();
+  for (unsigned long i = 0; i < n; i++) {
+    MsgTupple key = s.isLoading() ? MsgTupple(0, 0, 0) : (*mI).first;
+    snap(s, key.srcId);
+    snap(s, key.appIdx);
+    snap(s, key.msgIdx);
+    snap(s, s.isLoading() ? outstandingMsgsData[key] : (*mI++).second);
+  }
+
+  s.timer(p_drainMsg);
+  s.timer(p_hiccupMsg);
+  if (s.isLoading() && (startStatCol_sec < s.getTime().dbl()))
+    startStatCol_sec = s.getTime().dbl();
+}
+
 IBSink::~IBSink() {
 	if (p_drainMsg)
 		cancelAndDelete(p_drainMsg);
+	for (unsigned int i = 0; i < hopStageTime.size(); i++)
+		delete hopStageTime[i];
 }
@@ -24,6 +24,8 @@
 #define __SINK_H
 
 #include <omnetpp.h>
+#include <set>
+#include "snapshot.h"
 
 // we use this to track each message
 class MsgTupple {
@@ -60,11 +62,33 @@ public:
 	OutstandingMsgData() { numPktsReceived = 0; };
 };
 
+// the receiver side of a reliable transport QP (one per source).
+// The packet head decides if the packet is delivered:
+// * PSN == ePSN - delivered, ePSN advances. An ACK of ePSN-1 is sent every
+//   ackCoalesce delivered packets and on the last packet of a message.
+// * PSN < ePSN - a duplicate. It is dropped and an ACK is sent.
+// * PSN > ePSN - out of sequence. A single NAK of ePSN-1 is sent until ePSN
+//   advances. gbn drops the packet, sr delivers it and keeps its PSN such
+//   that ePSN skips it once the missing packets arrive.
+// The ACK/NAK packets are sent by the HCA generator and the received ones
+// are passed to it.
+class rcRecvQP {
+public:
+	unsigned int ePSN;            // the expected PSN
+	bool nakSent;                 // a NAK was sent for the current ePSN
+	unsigned int pktsToAck;       // delivered packets not acknowledged yet
+	std::set<unsigned int> oosPSNs; // sr: delivered out of sequence PSNs
+	rcRecvQP() { ePSN = 1; nakSent = false; pktsToAck = 0; };
+};
+
 //
 // Consumes IB Credits; see NED file for more info.
 //
-class IBSink : public cSimpleModule
+class IBSink : public cSimpleModule, public snapshotModule
 {
+  // the micro benchmarks drive the private handlers (microbench.h)
+  friend class IBMicroBench;
+
  private:
   cMessage *p_hiccupMsg;
   cMessage *p_drainMsg;
@@ -75,12 +99,20 @@ class IBSink : public cSimpleModule
   int flitSize;   // size in bytes of single flit
   double startStatCol_sec; // time to start co
   unsigned int repFirstPackets; // if not zero declare a message as done after first repFirstPackets arrived
+  int transport;          // the IBTransportMode of the HCA generator
+  unsigned int ackCoalesce; // delivered packets per ACK
+  simtime_t pathCongThreshold; // queuing time of a packet marking its path congested
 
   // data structure
   int     duringHiccup;                  // set to 1 if during a hiccup
   cQueue  queue;
   simtime_t lastConsumedPakcet;          // the last time a packet was consumed
   unsigned int lid;                      // the HCA LID
+  unsigned int lidMask;                  // the LMC bits of the HCA LIDs
+  class IBApp *p_app;                    // the HCA app notified on every message
+  class IBGenerator *p_gen;              // the HCA generator sending ACKs
+  std::map<unsigned int, rcRecvQP> recvQPs; // transport QPs by source
+  std::vector<bool> skipPktOnVL;         // current packet of VL is not delivered
   std::map<unsigned int, unsigned int> lastPktSnPerSrc; // last packet serial number per SRC
   // in order to calculate the message latencies we track outstanding messages,
   // first pkt arrival and number of rec packets
@@ -91,7 +123,16 @@ class IBSink : public cSimpleModule
   void consumeDataMsg(IBDataMsg *p_msg);
   void handlePop(cMessage *p_msg);
   void handleData(IBDataMsg *p_msg);
+  void queueDataMsg(IBDataMsg *p_msg);
+  bool acceptTransportPkt(IBDataMsg *p_msg);
+  void sendTransportAck(IBDataMsg *p_msg, rcRecvQP &qp, int op);
   void handleHiccup(cMessage *p_msg);
+  void checkPathCongestion(IBDataMsg *p_msg);
+  void collectHopTimes(IBDataMsg *p_msg);
+
+  // the generators by their HCA LID - the path congestion is reported
+  // directly to the source generator (no feedback packets are modeled)
+  static std::map<unsigned int, class IBGenerator *> gensByLid;
 
   // statistics
   cDoubleHistogram PakcetFabricTime;
@@ -99,6 +140,16 @@ class IBSink : public cSimpleModule
   cStdDev hiccupStats;        // statistics about hiccups
   std::vector<int> VlFlits;   // total number of FLITs per VL
   int  AccBytesRcv;           // total number of bytes received
+  double goodputBytes;        // bytes of delivered data packets
+  double wireBytes;           // all the received bytes - including the
+                              // ACK/NAK, duplicate and discarded packets
+  unsigned int dupPackets;    // duplicate packets dropped by the transport
+  unsigned int oosDiscards;   // out of sequence packets dropped (gbn)
+  unsigned int acksSent;      // number of ACKs sent
+  unsigned int naksSent;      // number of NAKs sent
+  unsigned int mcPackets;     // multicast packets received
+  double mcBytes;             // bytes of multicast packets received
+  unsigned int pathCongMarks; // packets that marked their path congested
   cOutVector oooPackets;      // vector of number of total OOO packets received
   unsigned int totOOOPackets; // total number of OOO packets received
   cStdDev oooWindow;          // in packets
@@ -115,6 +166,32 @@ class IBSink : public cSimpleModule
                                      // flit of the first repFirstPackets was received
   cStdDev enoughToLastPktLatencyStat; // statistics about the time difference from enough pkts to last pkt
 
+  // latency breakdown of the packet head FLIT along its path
+  cStdDev pktInQueueTime;     // time waiting in input buffers
+  cStdDev pktXbarTime;        // time crossing the switch crossbars
+  cStdDev pktArbWaitTime;     // time waiting for the VL arbiters
+  cStdDev pktOutQueueTime;    // time waiting in output buffers
+  cStdDev pktWireTime;        // propagation time on the links
+  // the same per hop (source HCA, 1st switch...) IB_LAT_NUM_STAGES each
+  std::vector<cStdDev *> hopStageTime;
+
+  // steady state batch counters - pulled by the IBSteadyState controller
+  double batchBytes;          // bytes received in current batch
+  double totDeliveredBytes;   // bytes delivered since the start - never reset
+  double batchLatSum;         // sum of message latencies completed in batch
+  unsigned int batchLatCnt;   // number of messages completed in batch
+
+ public:
+  // add and zero the batch counters
+  void takeBatchCounters(double &bytes, double &latSum, unsigned int &latCnt);
+  // restart all statistics collection - called on warmup end
+  void resetStats();
+  // the bytes delivered since the start - pulled by the IBFailures
+  double getDeliveredBytes() { return totDeliveredBytes; };
+  // the drain queue, transport QPs and messages being received. On load
+  // the statistics collection starts no earlier than the snapshot
+  virtual void snapshotState(stateSnapshot &s);
+
  protected:
   virtual void initialize();
   virtual void handleMessage(cMessage *msg);
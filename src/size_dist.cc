@@ -0,0 +1,219 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "size_dist.h"
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+int
+sizeDist::addBucket(unsigned int l, unsigned int h, double w)
+{
+  if ((h < l) || (w < 0)) {
+    ostringstream s;
+    s << "bad bucket " << l << "-" << h << " with weight " << w;
+    errStr = s.str();
+    return 1;
+  }
+  lo.push_back(l);
+  hi.push_back(h);
+  weight.push_back(w);
+  return 0;
+}
+
+// Vose's construction of the alias table in O(n)
+int
+sizeDist::buildAlias()
+{
+  unsigned int n = weight.size();
+  double total = 0;
+  for (unsigned int i = 0; i < n; i++)
+    total += weight[i];
+  if (!n || (total <= 0)) {
+    errStr = "no buckets with positive weight";
+    return 1;
+  }
+
+  vector<double> scaled(n);
+  vector<unsigned int> small, large;
+  for (unsigned int i = 0; i < n; i++) {
+    scaled[i] = weight[i] * n / total;
+    if (scaled[i] < 1.0)
+      small.push_back(i);
+    else
+      large.push_back(i);
+  }
+
+  prob.assign(n, 1.0);
+  alias.resize(n);
+  for (unsigned int i = 0; i < n; i++)
+    alias[i] = i;
+  while (!small.empty() && !large.empty()) {
+    unsigned int s = small.back();
+    unsigned int l = large.back();
+    small.pop_back();
+    large.pop_back();
+    prob[s] = scaled[s];
+    alias[s] = l;
+    scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+    if (scaled[l] < 1.0)
+      small.push_back(l);
+    else
+      large.push_back(l);
+  }
+  // left overs are 1 up to rounding errors
+  return 0;
+}
+
+int
+sizeDist::parseSet(const string &sizes, const string &weights)
+{
+  istringstream sizeStr(sizes);
+  istringstream weightStr(weights);
+  string sizeTok;
+  double w;
+  while (sizeStr >> sizeTok) {
+    if (!(weightStr >> w)) {
+      errStr = "fewer weights than sizes";
+      return 1;
+    }
+    unsigned int l, h;
+    char c;
+    int n = sscanf(sizeTok.c_str(), "%u%c%u", &l, &c, &h);
+    if (n == 1) {
+      h = l;
+    } else if ((n != 3) || (c != '-')) {
+      errStr = "bad size: " + sizeTok + " expected N or LO-HI";
+      return 1;
+    }
+    if (addBucket(l, h, w))
+      return 1;
+  }
+  if (weightStr >> w) {
+    errStr = "more weights than sizes";
+    return 1;
+  }
+  return buildAlias();
+}
+
+int
+sizeDist::parseCdf(const string &fileName, int continuous)
+{
+  FILE *f = fopen(fileName.c_str(), "r");
+  if (f == NULL) {
+    errStr = "can not open file: " + fileName;
+    return 1;
+  }
+
+  char buf[256];
+  int lineNum = 0;
+  unsigned int prevSize = 0;
+  double prevCdf = 0;
+  bool first = true;
+  while (fgets(buf, sizeof(buf), f) != NULL) {
+    lineNum++;
+    char *p = buf + strspn(buf, " \t");
+    if ((*p == '#') || (*p == '\n') || (*p == '\r') || !*p)
+      continue;
+
+    unsigned int size;
+    double cdf;
+    if ((sscanf(p, "%u %lf", &size, &cdf) != 2) ||
+        (cdf < prevCdf) || (cdf > 1.0 + 1e-9) ||
+        (!first && (size <= prevSize))) {
+      ostringstream s;
+      s << fileName << " line:" << lineNum
+        << " expected '<size> <cdf>' with increasing size and cdf <= 1";
+      errStr = s.str();
+      fclose(f);
+      return 1;
+    }
+
+    // the first point carries its own mass
+    unsigned int l = (continuous && !first) ? prevSize + 1 : size;
+    if ((cdf > prevCdf) && addBucket(l, size, cdf - prevCdf)) {
+      fclose(f);
+      return 1;
+    }
+    prevSize = size;
+    prevCdf = cdf;
+    first = false;
+  }
+  fclose(f);
+  return buildAlias();
+}
+
+unsigned int
+sizeDist::sample(double u1, double u2) const
+{
+  // the integer part of u1*n picks the bucket and the fraction the coin
+  unsigned int n = prob.size();
+  double x = u1 * n;
+  unsigned int i = (unsigned int)x;
+  if (i >= n) i = n - 1;
+  unsigned int b = ((x - i) < prob[i]) ? i : alias[i];
+
+  unsigned int size = lo[b] + (unsigned int)(u2 * (hi[b] - lo[b] + 1.0));
+  return (size > hi[b]) ? hi[b] : size;
+}
+
+double
+sizeDist::getMean() const
+{
+  double total = 0, sum = 0;
+  for (unsigned int i = 0; i < weight.size(); i++) {
+    total += weight[i];
+    sum += weight[i] * (lo[i] + hi[i]) / 2.0;
+  }
+  return total ? sum / total : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+sizeDists* sizeDists::singleton = 0;
+
+sizeDists *sizeDists::get() {
+  if (singleton == 0) {
+    singleton = new sizeDists;
+  }
+  return singleton;
+}
+
+sizeDist *
+sizeDists::getCdf(const string &fileName, int continuous) {
+  string key = fileName + (continuous ? ":c" : ":d");
+  map<string, sizeDist *>::iterator dI = cdfs.find(key);
+  if (dI != cdfs.end())
+    return (*dI).second;
+
+  sizeDist *p_dist = new sizeDist;
+  if (p_dist->parseCdf(fileName, continuous)) {
+    cerr << "-E- size_dist: " << p_dist->getError() << endl;
+    delete p_dist;
+    return NULL;
+  }
+  cout << "-I- parsed:" << fileName << " with "
+       << p_dist->getNumBuckets() << " buckets" << endl;
+  cdfs[key] = p_dist;
+  return p_dist;
+}
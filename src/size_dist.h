@@ -0,0 +1,86 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Empirical size distributions sampled in O(1) by Walker's alias method.
+//
+// A distribution is a set of buckets [lo,hi] with real weights. A sample
+// selects a bucket through the alias table and a uniform size within it,
+// so the cost does not depend on the number of buckets.
+//
+// Distributions are defined by:
+// 1. A set of sizes and a matching list of weights. Each size may be a
+//    single value "N" or a range "LO-HI":
+//      sizeDist d;
+//      d.parseSet("64 512-4096 65536", "0.5 0.4 0.1");
+// 2. An empirical CDF file - one "<size> <cumulative probability>" per
+//    line in increasing order ('#' lines are comments). Each point is a
+//    bucket of the sizes above the previous point (or a single size if
+//    continuous is 0). The file is shared by all users:
+//      sizeDist *p_d = sizeDists::get()->getCdf(fileName, 1);
+//
+// Sampling takes two uniform [0,1) values, so the caller keeps control of
+// the random number streams:
+//   unsigned int size = d.sample(uniform(0,1), uniform(0,1));
+//
+
+#ifndef __SIZE_DIST__
+#define __SIZE_DIST__
+
+#include <map>
+#include <string>
+#include <vector>
+
+class sizeDist
+{
+ private:
+  std::vector<unsigned int> lo;    // bucket first size
+  std::vector<unsigned int> hi;    // bucket last size
+  std::vector<double> weight;      // bucket relative weight
+  std::vector<double> prob;        // alias table: probability to keep
+  std::vector<unsigned int> alias; // alias table: the other bucket
+  std::string errStr;
+
+  int addBucket(unsigned int l, unsigned int h, double w);
+  int buildAlias();
+
+ public:
+  int parseSet(const std::string &sizes, const std::string &weights);
+  int parseCdf(const std::string &fileName, int continuous);
+  unsigned int sample(double u1, double u2) const;
+  unsigned int getNumBuckets() const { return lo.size(); };
+  double getMean() const;
+  // the reason of the last parse failure
+  const std::string &getError() const { return errStr; };
+};
+
+class sizeDists
+{
+ private:
+  static sizeDists *singleton;
+  std::map<std::string, sizeDist *> cdfs;
+  sizeDists() {};
+
+ public:
+  // parse the CDF file on first use - NULL on failure
+  sizeDist *getCdf(const std::string &fileName, int continuous);
+  static sizeDists *get();
+};
+
+#endif /* __SIZE_DIST__ */
@@ -0,0 +1,479 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The warm state snapshot stream - see snapshot.h
+//
+
+#include "ib_m.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+stateSnapshot::stateSnapshot(const char *name, bool load)
+{
+  fileName = name;
+  loading = load;
+  lastId = 0;
+  time = simTime();
+  if (loading) {
+    in.open(fileName.c_str());
+    if (!in.good())
+      opp_error("-E- snapshot: %s can not be opened", fileName.c_str());
+  } else {
+    out.open(fileName.c_str());
+    if (!out.good())
+      opp_error("-E- snapshot: %s can not be created", fileName.c_str());
+  }
+}
+
+void stateSnapshot::header()
+{
+  tag(IB_SNAPSHOT_MAGIC);
+
+  long long version = IB_SNAPSHOT_VERSION;
+  num(version);
+  if (version != IB_SNAPSHOT_VERSION)
+    opp_error("-E- snapshot: %s is of version: %lld this model reads: %d",
+              fileName.c_str(), version, IB_SNAPSHOT_VERSION);
+
+  long long scaleExp = SimTime::getScaleExp();
+  num(scaleExp);
+  if (scaleExp != SimTime::getScaleExp())
+    opp_error("-E- snapshot: %s was taken with simtime-scale: %lld",
+              fileName.c_str(), scaleExp);
+
+  std::string network = simulation.getSystemModule()->getNedTypeName();
+  token(network);
+  if (network != simulation.getSystemModule()->getNedTypeName())
+    opp_error("-E- snapshot: %s was taken of network: %s",
+              fileName.c_str(), network.c_str());
+
+  simtime(time);
+}
+
+void stateSnapshot::close()
+{
+  if (loading) {
+    in.close();
+    return;
+  }
+  out << "\n";
+  out.close();
+  if (out.fail())
+    opp_error("-E- snapshot: %s failed to write", fileName.c_str());
+}
+
+void stateSnapshot::tag(const char *name)
+{
+  if (!loading) {
+    out << "\n" << name << " ";
+    return;
+  }
+  std::string w;
+  token(w);
+  if (w != name)
+    opp_error("-E- snapshot: %s expected: %s but found: %s",
+              fileName.c_str(), name, w.c_str());
+}
+
+// a white space delimited word
+void stateSnapshot::token(std::string &w)
+{
+  if (!loading) {
+    out << w << " ";
+    return;
+  }
+  in >> w;
+  if (in.fail())
+    opp_error("-E- snapshot: %s is truncated", fileName.c_str());
+}
+
+void stateSnapshot::num(long long &v)
+{
+  if (!loading) {
+    out << v << " ";
+    return;
+  }
+  std::string w;
+  token(w);
+  char *p_end;
+  v = strtoll(w.c_str(), &p_end, 10);
+  if (*p_end)
+    opp_error("-E- snapshot: %s expected a number but found: %s",
+              fileName.c_str(), w.c_str());
+}
+
+void stateSnapshot::real(double &v)
+{
+  if (!loading) {
+    char buf[32];
+    sprintf(buf, "%.17g ", v);
+    out << buf;
+    return;
+  }
+  std::string w;
+  token(w);
+  char *p_end;
+  v = strtod(w.c_str(), &p_end);
+  if (*p_end)
+    opp_error("-E- snapshot: %s expected a real but found: %s",
+              fileName.c_str(), w.c_str());
+}
+
+// strings are written as <length>:<chars> so they may hold any char
+void stateSnapshot::str(std::string &v)
+{
+  if (!loading) {
+    out << v.size() << ":" << v << " ";
+    return;
+  }
+  unsigned long n;
+  in >> n;
+  if (in.fail() || (in.get() != ':'))
+    opp_error("-E- snapshot: %s expected a string", fileName.c_str());
+  v.resize(n);
+  if (n) in.read(&v[0], n);
+  if (in.fail())
+    opp_error("-E- snapshot: %s is truncated", fileName.c_str());
+}
+
+void stateSnapshot::simtime(simtime_t &t)
+{
+  long long raw = t.raw();
+  num(raw);
+  t.setRaw(raw);
+}
+
+void stateSnapshot::module(cModule *&p_mod)
+{
+  std::string path = p_mod ? p_mod->getFullPath() : "-";
+  token(path);
+  if (!loading) return;
+  p_mod = NULL;
+  if (path == "-") return;
+  p_mod = simulation.getModuleByPath(path.c_str());
+  if (!p_mod)
+    opp_error("-E- snapshot: %s module: %s is not in the network",
+              fileName.c_str(), path.c_str());
+}
+
+// gates are written by name and index - the ids are not kept
+void stateSnapshot::gate(cModule *p_mod, int &gateId)
+{
+  std::string name = "-";
+  long long index = -1;
+  if (!loading && p_mod && (gateId >= 0)) {
+    cGate *p_gate = p_mod->gate(gateId);
+    name = p_gate->getName();
+    if (p_gate->isVector()) index = p_gate->getIndex();
+  }
+  token(name);
+  num(index);
+  if (!loading) return;
+  gateId = -1;
+  if (name == "-") return;
+  if (p_mod) gateId = p_mod->findGate(name.c_str(), index);
+  if (gateId < 0)
+    opp_error("-E- snapshot: %s gate: %s[%lld] is not in the network",
+              fileName.c_str(), name.c_str(), index);
+}
+
+cMessage *stateSnapshot::findLoaded(long id)
+{
+  std::map<long, cMessage *>::iterator I = loaded.find(id);
+  if (I == loaded.end())
+    opp_error("-E- snapshot: %s refers to unknown message: %ld",
+              fileName.c_str(), id);
+  return (*I).second;
+}
+
+// save or load a message field by its getter and setter
+#define IB_SNAPSHOT_FIELD(p, type, Name) \
+  { type v = (p)->get##Name(); snap(*this, v); if (loading) (p)->set##Name(v); }
+
+void stateSnapshot::msgFields(cMessage *p_msg)
+{
+  if (IBWireMsg *p_wire = dynamic_cast<IBWireMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p_wire, short, VL);
+    if (IBDataMsg *p = dynamic_cast<IBDataMsg *>(p_msg)) {
+      IB_SNAPSHOT_FIELD(p, int, AppIdx);
+      IB_SNAPSHOT_FIELD(p, int, MsgIdx);
+      IB_SNAPSHOT_FIELD(p, int, MsgLen);
+      IB_SNAPSHOT_FIELD(p, int, PktIdx);
+      IB_SNAPSHOT_FIELD(p, int, Tag);
+      IB_SNAPSHOT_FIELD(p, int, RpcType);
+      IB_SNAPSHOT_FIELD(p, int, BarrierStage);
+      IB_SNAPSHOT_FIELD(p, int, PacketId);
+      IB_SNAPSHOT_FIELD(p, int, PacketSn);
+      IB_SNAPSHOT_FIELD(p, int, TransportOp);
+      IB_SNAPSHOT_FIELD(p, int, AckPsn);
+      IB_SNAPSHOT_FIELD(p, int, FlitSn);
+      IB_SNAPSHOT_FIELD(p, int, PacketLength);
+      IB_SNAPSHOT_FIELD(p, int, PacketLengthBytes);
+      IB_SNAPSHOT_FIELD(p, int, DstLid);
+      IB_SNAPSHOT_FIELD(p, int, SrcLid);
+      IB_SNAPSHOT_FIELD(p, int, SL);
+      IB_SNAPSHOT_FIELD(p, int, UseStatic);
+      IB_SNAPSHOT_FIELD(p, simtime_t, InjectionTime);
+      IB_SNAPSHOT_FIELD(p, simtime_t, SwTimeStamp);
+      IB_SNAPSHOT_FIELD(p, int, InVL);
+      IB_SNAPSHOT_FIELD(p, simtime_t, FwdTime);
+      IB_SNAPSHOT_FIELD(p, simtime_t, StageTime);
+      IB_SNAPSHOT_FIELD(p, simtime_t, InQueueTime);
+      IB_SNAPSHOT_FIELD(p, simtime_t, XbarTime);
+      IB_SNAPSHOT_FIELD(p, simtime_t, ArbWaitTime);
+      IB_SNAPSHOT_FIELD(p, simtime_t, OutQueueTime);
+      IB_SNAPSHOT_FIELD(p, simtime_t, WireTime);
+      IB_SNAPSHOT_FIELD(p, bool, BeforeAnySwitch);
+      unsigned long n = p->getHopTimeArraySize();
+      snap(*this, n);
+      if (loading) p->setHopTimeArraySize(n);
+      for (unsigned long i = 0; i < n; i++) {
+        simtime_t t = p->getHopTime(i);
+        simtime(t);
+        if (loading) p->setHopTime(i, t);
+      }
+    } else if (IBFlowControl *p = dynamic_cast<IBFlowControl *>(p_msg)) {
+      IB_SNAPSHOT_FIELD(p, long, FCTBS);
+      IB_SNAPSHOT_FIELD(p, long, FCCL);
+    } else if (IBTQLoadUpdateMsg *p = dynamic_cast<IBTQLoadUpdateMsg *>(p_msg)) {
+      IB_SNAPSHOT_FIELD(p, int, Load);
+      IB_SNAPSHOT_FIELD(p, int, SrcRank);
+      IB_SNAPSHOT_FIELD(p, int, FirstLid);
+      IB_SNAPSHOT_FIELD(p, int, LastLid);
+    }
+  } else if (IBTxCredMsg *p = dynamic_cast<IBTxCredMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p, int, VL);
+    IB_SNAPSHOT_FIELD(p, long, FCCL);
+    IB_SNAPSHOT_FIELD(p, long, FCTBS);
+  } else if (IBRxCredMsg *p = dynamic_cast<IBRxCredMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p, int, VL);
+    IB_SNAPSHOT_FIELD(p, long, FCCL);
+  } else if (IBSentMsg *p = dynamic_cast<IBSentMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p, short, VL);
+    IB_SNAPSHOT_FIELD(p, short, UsedStatic);
+    IB_SNAPSHOT_FIELD(p, short, WasLast);
+  } else if (IBFreeMsg *p = dynamic_cast<IBFreeMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p, short, VL);
+  } else if (IBDoneMsg *p = dynamic_cast<IBDoneMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p, short, VL);
+  } else if (IBFwdTimerMsg *p = dynamic_cast<IBFwdTimerMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p, short, PortNum);
+    IB_SNAPSHOT_FIELD(p, short, VL);
+  } else if (IBAppMsg *p = dynamic_cast<IBAppMsg *>(p_msg)) {
+    IB_SNAPSHOT_FIELD(p, unsigned int, AppIdx);
+    IB_SNAPSHOT_FIELD(p, unsigned int, MsgIdx);
+    IB_SNAPSHOT_FIELD(p, unsigned int, SQ);
+    IB_SNAPSHOT_FIELD(p, unsigned int, LenBytes);
+    IB_SNAPSHOT_FIELD(p, unsigned int, LenPkts);
+    IB_SNAPSHOT_FIELD(p, unsigned int, DstLid);
+    IB_SNAPSHOT_FIELD(p, unsigned int, MtuBytes);
+    IB_SNAPSHOT_FIELD(p, int, Tag);
+    IB_SNAPSHOT_FIELD(p, int, RpcType);
+    IB_SNAPSHOT_FIELD(p, int, BarrierStage);
+    IB_SNAPSHOT_FIELD(p, unsigned int, PktLenFlits);
+    IB_SNAPSHOT_FIELD(p, unsigned int, PktLenBytes);
+    IB_SNAPSHOT_FIELD(p, unsigned int, PktIdx);
+    IB_SNAPSHOT_FIELD(p, unsigned int, FlitIdx);
+    IB_SNAPSHOT_FIELD(p, unsigned int, VL);
+    IB_SNAPSHOT_FIELD(p, unsigned int, PathLid);
+  } else if (strcmp(p_msg->getClassName(), "cMessage")) {
+    opp_error("-E- snapshot: %s can not hold message class: %s",
+              fileName.c_str(), p_msg->getClassName());
+  }
+}
+
+#undef IB_SNAPSHOT_FIELD
+
+// write the message record or its reference - or load it. Return the
+// loaded message
+cMessage *stateSnapshot::msgRecord(cMessage *p_msg)
+{
+  std::string w;
+  long long id;
+  if (!loading) {
+    if (!p_msg) {
+      out << "- ";
+      return NULL;
+    }
+    std::map<cMessage *, long>::iterator I = savedIds.find(p_msg);
+    if (I != savedIds.end()) {
+      out << "@" << (*I).second << " ";
+      return p_msg;
+    }
+    id = savedIds[p_msg] = ++lastId;
+    out << "M " << id << " " << p_msg->getClassName() << " ";
+  } else {
+    token(w);
+    if (w == "-") return NULL;
+    if (w[0] == '@') return findLoaded(atol(w.c_str() + 1));
+    if (w != "M")
+      opp_error("-E- snapshot: %s expected a message but found: %s",
+                fileName.c_str(), w.c_str());
+    num(id);
+    token(w);
+    p_msg = dynamic_cast<cMessage *>(createOne(w.c_str()));
+    if (!p_msg)
+      opp_error("-E- snapshot: %s class: %s is not a message",
+                fileName.c_str(), w.c_str());
+    loaded[id] = p_msg;
+  }
+
+  std::string name = p_msg->getName() ? p_msg->getName() : "";
+  str(name);
+  long long kind = p_msg->getKind();
+  num(kind);
+  long long priority = p_msg->getSchedulingPriority();
+  num(priority);
+  simtime_t timestamp = p_msg->getTimestamp();
+  simtime(timestamp);
+
+  cModule *p_sender = p_msg->getSenderModule();
+  int senderGate = p_msg->getSenderGateId();
+  simtime_t sendingTime = p_msg->getSendingTime();
+  module(p_sender);
+  gate(p_sender, senderGate);
+  simtime(sendingTime);
+
+  cModule *p_arrival = p_msg->getArrivalModule();
+  int arrivalGate = p_msg->getArrivalGateId();
+  simtime_t arrivalTime = p_msg->getArrivalTime();
+  module(p_arrival);
+  gate(p_arrival, arrivalGate);
+  simtime(arrivalTime);
+
+  if (loading) {
+    p_msg->setName(name.c_str());
+    p_msg->setKind(kind);
+    p_msg->setSchedulingPriority(priority);
+    p_msg->setTimestamp(timestamp);
+    p_msg->setSentFrom(p_sender, senderGate, sendingTime);
+    p_msg->setArrival(p_arrival, arrivalGate, arrivalTime);
+  }
+
+  if (cPacket *p_pkt = dynamic_cast<cPacket *>(p_msg)) {
+    long long bits = p_pkt->getBitLength();
+    num(bits);
+    simtime_t duration = p_pkt->getDuration();
+    simtime(duration);
+    bool rxStart = p_pkt->isReceptionStart();
+    snap(*this, rxStart);
+    if (loading) {
+      p_pkt->setBitLength(bits);
+      p_pkt->setDuration(duration);
+      p_pkt->setIsReceptionStart(rxStart);
+    }
+  }
+
+  msgFields(p_msg);
+  return p_msg;
+}
+
+void stateSnapshot::queue(cQueue &q)
+{
+  unsigned long n = q.length();
+  snap(*this, n);
+  if (!loading) {
+    for (cQueue::Iterator qI(q); !qI.end(); qI++)
+      msgRecord(check_and_cast<cMessage *>(qI()));
+    return;
+  }
+  q.clear();
+  for (unsigned long i = 0; i < n; i++) {
+    cMessage *p_msg = msgRecord(NULL);
+    if (!p_msg)
+      opp_error("-E- snapshot: %s holds a NULL queue entry",
+                fileName.c_str());
+    q.insert(p_msg);
+  }
+}
+
+void stateSnapshot::timer(cMessage *p_timer)
+{
+  long long id;
+  if (!loading) {
+    id = savedIds[p_timer] = ++lastId;
+    out << "T " << id << " ";
+  } else {
+    std::string w;
+    token(w);
+    if (w != "T")
+      opp_error("-E- snapshot: %s expected a timer but found: %s",
+                fileName.c_str(), w.c_str());
+    num(id);
+    loaded[id] = p_timer;
+  }
+  timers.insert(p_timer);
+}
+
+// a claimed timer is written by its id - any other event as a record
+void stateSnapshot::event(cMessage *p_msg)
+{
+  tag("event");
+  if (!timers.count(p_msg)) {
+    out << "R ";
+    msgRecord(p_msg);
+    return;
+  }
+
+  out << "T " << savedIds[p_msg] << " ";
+  cModule *p_mod = p_msg->getArrivalModule();
+  simtime_t sendingTime = p_msg->getSendingTime();
+  simtime_t arrivalTime = p_msg->getArrivalTime();
+  long long priority = p_msg->getSchedulingPriority();
+  module(p_mod);
+  simtime(sendingTime);
+  simtime(arrivalTime);
+  num(priority);
+}
+
+cMessage *stateSnapshot::event()
+{
+  tag("event");
+  std::string w;
+  token(w);
+  if (w == "R") {
+    cMessage *p_msg = msgRecord(NULL);
+    if (!p_msg)
+      opp_error("-E- snapshot: %s holds a NULL event", fileName.c_str());
+    return p_msg;
+  }
+  if (w != "T")
+    opp_error("-E- snapshot: %s expected an event but found: %s",
+              fileName.c_str(), w.c_str());
+
+  long long id;
+  num(id);
+  cMessage *p_msg = findLoaded(id);
+  if (!timers.count(p_msg))
+    opp_error("-E- snapshot: %s timer: %lld was not claimed by its module",
+              fileName.c_str(), id);
+  cModule *p_mod = NULL;
+  simtime_t sendingTime, arrivalTime;
+  long long priority;
+  module(p_mod);
+  simtime(sendingTime);
+  simtime(arrivalTime);
+  num(priority);
+  p_msg->setSentFrom(p_mod, -1, sendingTime);
+  p_msg->setArrival(p_mod, -1, arrivalTime);
+  p_msg->setSchedulingPriority(priority);
+  return p_msg;
+}
@@ -0,0 +1,251 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Warm State Snapshot - save and load the model state to a file
+//
+// The snapshot holds the state of every module implementing snapshotModule
+// (IBUF, VLA, OBUF, generator, application and sink) and the future events
+// destined to them - including the FLITs and credits on the wires. It is
+// saved by the IBCheckpoint at checkpointTime and loaded by a later run
+// that continues from that time (see checkpoint.h).
+//
+// Format:
+// The file is text: white space separated tokens that are read in the
+// order they were written. A module state is written and read by the same
+// code (snapshotState) so the two never diverge:
+//
+//   IBFLITSIM-SNAPSHOT <version> <scale exp> <network> <raw time>
+//   modules <n>
+//   module <full path> <state tokens...>
+//   ...
+//   fes <n> <event>...
+//   end
+//
+// A message is written once as a record:
+//   M <id> <class> <name> <kind> <priority> <timestamp>
+//     <sender module> <sender gate> <sender index> <sending time>
+//     <arrival module> <arrival gate> <arrival index> <arrival time>
+//     [<bit length> <duration> <reception start>] <class fields...>
+// Further references to it are "@<id>" and NULL is "-". Multicast FLITs
+// held by several queues are therefore restored as a single FLIT.
+//
+// The timers (self messages) held by a module are claimed by it with
+// timer() - they are not written as records but by their id, and the
+// FES entry of a claimed timer is "T <id> <sending time> <arrival time>
+// <priority>". On load the timers the modules created on initialize are
+// claimed by the same ids and scheduled by the FES entries.
+//
+// Times are written as raw integers of the simtime scale, so the loaded
+// times are exact. The version is bumped on every change of the format or
+// of a module state - a snapshot of another version is rejected.
+//
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <omnetpp.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+
+#define IB_SNAPSHOT_MAGIC "IBFLITSIM-SNAPSHOT"
+#define IB_SNAPSHOT_VERSION 1
+
+class stateSnapshot
+{
+ private:
+  std::string fileName;
+  bool loading;
+  std::ifstream in;
+  std::ofstream out;
+  simtime_t time;                       // the time the snapshot was taken
+  long lastId;                          // the last id given to a message
+  std::map<cMessage *, long> savedIds;  // ids of the saved messages
+  std::set<cMessage *> timers;          // the claimed timers
+  std::map<long, cMessage *> loaded;    // loaded messages and timers by id
+
+  void token(std::string &w);
+  void module(cModule *&p_mod);
+  void gate(cModule *p_mod, int &gateId);
+  void msgFields(cMessage *p_msg);
+  cMessage *msgRecord(cMessage *p_msg);
+  cMessage *findLoaded(long id);
+
+ public:
+  stateSnapshot(const char *fileName, bool loading);
+  bool isLoading() const { return loading; };
+  simtime_t getTime() const { return time; };
+  const char *getFileName() const { return fileName.c_str(); };
+
+  // write or verify the header - the time is set by the loaded header
+  void header();
+  // close the file - a failed write is an error
+  void close();
+  // write or verify a section tag
+  void tag(const char *name);
+
+  // the basic tokens
+  void num(long long &v);
+  void real(double &v);
+  void str(std::string &v);
+  void simtime(simtime_t &t);
+
+  // a message record (or reference) and a reference only: a pointer that
+  // is not in the snapshot is saved as NULL and is never dereferenced
+  template<class T> void msg(T *&p_msg) {
+    cMessage *p = msgRecord(p_msg);
+    if (loading) p_msg = p ? check_and_cast<T *>(p) : NULL;
+  };
+  template<class T> void ref(T *&p_msg);
+
+  // the messages of a queue - owning or not
+  void queue(cQueue &q);
+
+  // claim a timer of the module
+  void timer(cMessage *p_timer);
+  bool isClaimed(cMessage *p_timer) const { return timers.count(p_timer); };
+
+  // an FES entry - save the given event or load one to be inserted
+  void event(cMessage *p_msg);
+  cMessage *event();
+};
+
+// implemented by the modules whose state is kept in the snapshot
+class snapshotModule
+{
+ public:
+  virtual ~snapshotModule() {};
+  // save or load the module state (s.isLoading()) - on load it is called
+  // on the initialized module in its context
+  virtual void snapshotState(stateSnapshot &s) = 0;
+};
+
+//
+// save or load a value - the struct overloads are defined by the modules
+//
+inline void snap(stateSnapshot &s, long long &v) { s.num(v); }
+inline void snap(stateSnapshot &s, double &v) { s.real(v); }
+inline void snap(stateSnapshot &s, std::string &v) { s.str(v); }
+inline void snap(stateSnapshot &s, simtime_t &v) { s.simtime(v); }
+
+#define IB_SNAPSHOT_INT(type) \
+  inline void snap(stateSnapshot &s, type &v) { \
+    long long n = v; s.num(n); v = (type)n; \
+  }
+IB_SNAPSHOT_INT(bool)
+IB_SNAPSHOT_INT(short)
+IB_SNAPSHOT_INT(int)
+IB_SNAPSHOT_INT(unsigned int)
+IB_SNAPSHOT_INT(long)
+IB_SNAPSHOT_INT(unsigned long)
+#undef IB_SNAPSHOT_INT
+
+template<class T> void snap(stateSnapshot &s, T *&p_msg) { s.msg(p_msg); }
+
+inline void snap(stateSnapshot &s, std::vector<bool> &v) {
+  unsigned long n = v.size();
+  snap(s, n);
+  v.resize(n);
+  for (unsigned long i = 0; i < n; i++) {
+    bool b = v[i];
+    snap(s, b);
+    v[i] = b;
+  }
+}
+
+template<class T> void snap(stateSnapshot &s, std::vector<T> &v) {
+  unsigned long n = v.size();
+  snap(s, n);
+  v.resize(n);
+  for (unsigned long i = 0; i < n; i++) snap(s, v[i]);
+}
+
+template<class T> void snap(stateSnapshot &s, std::deque<T> &v) {
+  unsigned long n = v.size();
+  snap(s, n);
+  v.resize(n);
+  for (unsigned long i = 0; i < n; i++) snap(s, v[i]);
+}
+
+template<class T> void snap(stateSnapshot &s, std::list<T> &v) {
+  unsigned long n = v.size();
+  snap(s, n);
+  v.resize(n);
+  for (typename std::list<T>::iterator I = v.begin(); I != v.end(); I++)
+    snap(s, *I);
+}
+
+template<class T> void snap(stateSnapshot &s, std::set<T> &v) {
+  unsigned long n = v.size();
+  snap(s, n);
+  if (!s.isLoading()) {
+    for (typename std::set<T>::iterator I = v.begin(); I != v.end(); I++) {
+      T k = *I;
+      snap(s, k);
+    }
+    return;
+  }
+  v.clear();
+  for (unsigned long i = 0; i < n; i++) {
+    T k;
+    snap(s, k);
+    v.insert(k);
+  }
+}
+
+// the values are loaded in place so their addresses are final
+template<class K, class V, class C>
+void snap(stateSnapshot &s, std::map<K, V, C> &m) {
+  unsigned long n = m.size();
+  snap(s, n);
+  if (!s.isLoading()) {
+    for (typename std::map<K, V, C>::iterator I = m.begin(); I != m.end(); I++) {
+      K k = (*I).first;
+      snap(s, k);
+      snap(s, (*I).second);
+    }
+    return;
+  }
+  m.clear();
+  for (unsigned long i = 0; i < n; i++) {
+    K k;
+    snap(s, k);
+    snap(s, m[k]);
+  }
+}
+
+template<class T> void stateSnapshot::ref(T *&p_msg) {
+  if (!loading) {
+    std::map<cMessage *, long>::iterator I = savedIds.find(p_msg);
+    if (I == savedIds.end()) out << "- ";
+    else out << "@" << (*I).second << " ";
+    return;
+  }
+  std::string w;
+  token(w);
+  p_msg = (w == "-") ? NULL :
+    check_and_cast<T *>(findLoaded(atol(w.c_str() + 1)));
+}
+
+#endif
@@ -0,0 +1,251 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// The IBSteadyState detects the end of the warmup period by MSER-5 and
+// ends the run once the batch means confidence intervals are tight enough.
+// See functional description in the header file.
+//
+#include "ib_m.h"
+#include "steady.h"
+#include "sink.h"
+#include <math.h>
+
+Define_Module( IBSteadyState );
+
+// two sided 95% Student-t quantiles by degrees of freedom 1..30
+static const double tQuant95[30] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+void IBSteadyState::initialize()
+{
+  enabled = par("enabled");
+  batchTime_s = par("batchTime");
+  minBatches = par("minBatches");
+  targetRelCI = par("targetRelCI");
+
+  const char *metricsStr = par("metrics");
+  cStringTokenizer tokenizer(metricsStr);
+  useMetric[SS_BW] = useMetric[SS_LAT] = false;
+  while (tokenizer.hasMoreTokens()) {
+    std::string m = tokenizer.nextToken();
+    if (m == "bw") {
+      useMetric[SS_BW] = true;
+    } else if (m == "lat") {
+      useMetric[SS_LAT] = true;
+    } else {
+      opp_error("-E- %s unknown metric: %s (use bw or lat)",
+                getFullPath().c_str(), m.c_str());
+    }
+  }
+
+  inSteadyState = 0;
+  firstSteadyBatch = 0;
+  warmupEndTime = 0;
+  for (int m = 0; m < SS_NUM_METRICS; m++)
+    relCI[m] = -1;
+  WATCH(inSteadyState);
+
+  bwVec.setName("Batch-BW-MBps");
+  latVec.setName("Batch-Msg-Latency");
+
+  p_batchMsg = new cMessage("batch");
+  if (!enabled) {
+    EV << "-I- " << getFullPath() << " steady state detection disabled" << endl;
+    return;
+  }
+
+  if ((batchTime_s <= 0) || (minBatches < 10)) {
+    opp_error("-E- %s requires positive batchTime and minBatches >= 10",
+              getFullPath().c_str());
+  }
+  scheduleAt(simTime() + batchTime_s, p_batchMsg);
+}
+
+void IBSteadyState::registerSink(IBSink *p_sink)
+{
+  sinks.push_back(p_sink);
+}
+
+// MSER-5: average the series in groups of 5 and find the truncation
+// point d minimizing the variance of the remaining mean:
+//   MSER(d) = sum_{j>d} (Z_j - mean_d)^2 / (m - d)^2
+// Return the truncation point in batches or -1 (as unsigned) if the
+// minimum is not in the first half of the series.
+unsigned int IBSteadyState::mser5(const std::vector<double> &series)
+{
+  unsigned int m = series.size() / 5;
+  std::vector<double> z(m, 0);
+  for (unsigned int j = 0; j < m; j++) {
+    for (unsigned int k = 0; k < 5; k++)
+      z[j] += series[5*j + k];
+    z[j] /= 5;
+  }
+
+  // scan d from the end accumulating sums of the tail
+  double sum = 0, sumSq = 0;
+  double bestMser = -1;
+  unsigned int bestD = 0;
+  for (int d = m - 1; d >= 0; d--) {
+    sum += z[d];
+    sumSq += z[d]*z[d];
+    unsigned int n = m - d;
+    if (n < 2) continue;
+    double mean = sum / n;
+    double mser = (sumSq - n*mean*mean) / ((double)n*n);
+    if ((bestMser < 0) || (mser <= bestMser)) {
+      bestMser = mser;
+      bestD = d;
+    }
+  }
+
+  if (bestD >= m/2)
+    return (unsigned int)-1;
+  return 5*bestD;
+}
+
+// return the relative 95% CI half width of the batch means from first on
+double IBSteadyState::batchMeansRelCI(const std::vector<double> &series,
+                                      unsigned int first, double &mean)
+{
+  unsigned int n = series.size() - first;
+  double sum = 0, sumSq = 0;
+  for (unsigned int i = first; i < series.size(); i++) {
+    sum += series[i];
+    sumSq += series[i]*series[i];
+  }
+  mean = sum / n;
+  double var = (sumSq - n*mean*mean) / (n - 1);
+  if (var < 0) var = 0;
+  double t = (n - 1 <= 30) ? tQuant95[n - 2] : 1.960;
+  if (mean == 0)
+    return (var == 0) ? 0 : 1e9;
+  return t * sqrt(var / n) / fabs(mean);
+}
+
+// warmup is over once every selected metric passes MSER-5
+void IBSteadyState::detectWarmup()
+{
+  unsigned int n = batches[SS_BW].size();
+  if (n < minBatches)
+    return;
+
+  unsigned int trunc = 0;
+  for (int m = 0; m < SS_NUM_METRICS; m++) {
+    if (!useMetric[m]) continue;
+    unsigned int d = mser5(batches[m]);
+    if (d == (unsigned int)-1)
+      return;
+    if (d > trunc) trunc = d;
+  }
+
+  inSteadyState = 1;
+  firstSteadyBatch = trunc;
+  warmupEndTime = simTime();
+  EV << "-I- " << getFullPath() << " warmup ended at:" << simTime()
+     << " truncating " << trunc << " of " << n << " batches" << endl;
+
+  // the sinks collect from now on
+  for (unsigned int s = 0; s < sinks.size(); s++)
+    sinks[s]->resetStats();
+}
+
+// return 1 if all selected metrics converged
+int IBSteadyState::checkConvergence()
+{
+  unsigned int n = batches[SS_BW].size() - firstSteadyBatch;
+  if (n < minBatches)
+    return 0;
+
+  int converged = 1;
+  for (int m = 0; m < SS_NUM_METRICS; m++) {
+    if (!useMetric[m]) continue;
+    double mean;
+    relCI[m] = batchMeansRelCI(batches[m], firstSteadyBatch, mean);
+    if (relCI[m] > targetRelCI)
+      converged = 0;
+  }
+  return converged;
+}
+
+// close the current batch: pull the sinks counters and decide
+void IBSteadyState::handleBatch()
+{
+  double bytes = 0, latSum = 0;
+  unsigned int latCnt = 0;
+  for (unsigned int s = 0; s < sinks.size(); s++)
+    sinks[s]->takeBatchCounters(bytes, latSum, latCnt);
+
+  double bw = bytes / batchTime_s;
+  // a batch with no completed message repeats the previous latency
+  double lat;
+  if (latCnt)
+    lat = latSum / latCnt;
+  else if (!batches[SS_LAT].empty())
+    lat = batches[SS_LAT].back();
+  else
+    lat = 0;
+
+  batches[SS_BW].push_back(bw);
+  batches[SS_LAT].push_back(lat);
+  bwVec.record(bw/1e6);
+  latVec.record(lat);
+
+  if (!inSteadyState) {
+    detectWarmup();
+  } else if (checkConvergence()) {
+    EV << "-I- " << getFullPath() << " statistics converged at:"
+       << simTime() << " ending simulation" << endl;
+    endSimulation();
+  }
+
+  scheduleAt(simTime() + batchTime_s, p_batchMsg);
+}
+
+void IBSteadyState::handleMessage(cMessage *p_msg)
+{
+  if (p_msg == p_batchMsg) {
+    handleBatch();
+  } else {
+    opp_error("-E- %s does not know what to with msg: %d",
+              getFullPath().c_str(), p_msg->getKind());
+    delete p_msg;
+  }
+}
+
+void IBSteadyState::finish()
+{
+  if (!enabled)
+    return;
+  recordScalar("Steady-State-Reached", inSteadyState);
+  recordScalar("Warmup-End-Time", warmupEndTime);
+  recordScalar("Warmup-Truncated-Batches", firstSteadyBatch);
+  recordScalar("Num-Batches", batches[SS_BW].size());
+  if (useMetric[SS_BW])
+    recordScalar("BW-Rel-CI", relCI[SS_BW]);
+  if (useMetric[SS_LAT])
+    recordScalar("Latency-Rel-CI", relCI[SS_LAT]);
+}
+
+IBSteadyState::~IBSteadyState() {
+  if (p_batchMsg)
+    cancelAndDelete(p_batchMsg);
+}
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// Steady State Controller - detect warmup end and stop on converged stats
+//
+// Overview:
+// =========
+// Instead of running to a fixed sim-time-limit with a hand tuned
+// startStatCol the controller watches the aggregate sink bandwidth and
+// message latency online:
+// * Warmup detection - the aggregate metrics are sampled every batchTime.
+//   The MSER-5 rule is applied to the batch series (grouped by 5). Once the
+//   truncation point falls in the first half of the series the warmup is
+//   declared over and all the sinks statistics are reset.
+// * Run termination - after the warmup the batches form a batch means
+//   estimator. When the relative confidence interval half width of every
+//   selected metric is below targetRelCI the simulation is ended.
+//
+// Connectivity:
+// =============
+// None. The sinks register themselves on initialize and the controller
+// pulls their batch counters by direct method calls at the end of each batch.
+//
+// Parameters:
+// enabled - if false the controller does nothing (sinks use startStatCol)
+// batchTime - the length of each sampling batch
+// minBatches - minimal number of batches before any decision is taken
+// metrics - the metrics that must converge: "bw", "lat" or "bw lat"
+// targetRelCI - the target relative 95% CI half width of the metrics
+//
+
+#ifndef __STEADY_H
+#define __STEADY_H
+
+#include <omnetpp.h>
+#include <vector>
+
+class IBSink;
+
+//
+// Online warmup detection and run length control; see NED for more info.
+//
+class IBSteadyState : public cSimpleModule
+{
+ private:
+  cMessage *p_batchMsg;
+
+  // metrics we track
+  enum ssMetrics { SS_BW, SS_LAT, SS_NUM_METRICS };
+
+  // parameters
+  bool enabled;
+  double batchTime_s;        // the sampling batch length
+  unsigned int minBatches;   // min batches before taking decisions
+  bool useMetric[SS_NUM_METRICS]; // the metrics that must converge
+  double targetRelCI;        // target CI half width relative to the mean
+
+  // state
+  std::vector<IBSink*> sinks;  // registered sinks
+  std::vector<double> batches[SS_NUM_METRICS]; // batch means per metric
+  int inSteadyState;           // 1 once warmup end was detected
+  simtime_t warmupEndTime;     // time the warmup was declared over
+  unsigned int firstSteadyBatch; // index of the first batch after warmup
+  double relCI[SS_NUM_METRICS];  // last calculated relative CI
+
+  // statistics
+  cOutVector bwVec;            // aggregate batch bandwidth
+  cOutVector latVec;           // batch average message latency
+
+  // methods
+  unsigned int mser5(const std::vector<double> &series);
+  double batchMeansRelCI(const std::vector<double> &series,
+                         unsigned int first, double &mean);
+  void detectWarmup();
+  int  checkConvergence();
+  void handleBatch();
+
+ public:
+  // sinks register in their initialize
+  void registerSink(IBSink *p_sink);
+
+ protected:
+  virtual void initialize();
+  virtual void handleMessage(cMessage *msg);
+  virtual void finish();
+  virtual ~IBSteadyState();
+};
+
+#endif
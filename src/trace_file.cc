@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "trace_file.h"
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+traceFile::traceFile()
+{
+  f = NULL;
+  lineNum = 0;
+  readAhead = 0;
+  err = 0;
+}
+
+traceFile::~traceFile()
+{
+  if (f)
+    fclose(f);
+}
+
+int
+traceFile::open(string name, unsigned int numRecords)
+{
+  fileName = name;
+  readAhead = numRecords ? numRecords : 1;
+  f = fopen(fileName.c_str(), "r");
+  if (f == NULL) {
+    cerr << "trace_file: can not open file:" << fileName << endl;
+    err = 1;
+    return 1;
+  }
+  fill();
+  return err;
+}
+
+// parse a single record line - returns 1 if a record was found
+int
+traceFile::parseLine(char *line, traceRecord &rec)
+{
+  char *lasts;
+  char *tok = strtok_r(line, " \t\r\n", &lasts);
+  if (!tok || (tok[0] == '#'))
+    return 0;
+
+  char *args[3] = { NULL, NULL, NULL };
+  int numArgs = 0;
+  char *arg;
+  while ((arg = strtok_r(NULL, " \t\r\n", &lasts)) != NULL) {
+    if (numArgs == 3) {
+      numArgs++;
+      break;
+    }
+    args[numArgs++] = arg;
+  }
+
+  rec.op = tok[0];
+  rec.peer = 0;
+  rec.bytes = 0;
+  rec.tag = 0;
+  rec.delay_ns = 0;
+  if (strlen(tok) != 1) numArgs = -1;
+  switch (rec.op) {
+  case 's':
+    if ((numArgs < 2) || (numArgs > 3)) break;
+    rec.peer = atoi(args[0]);
+    rec.bytes = strtoul(args[1], NULL, 10);
+    if (numArgs == 3) rec.tag = atoi(args[2]);
+    if (rec.peer >= 0) return 1;
+    break;
+  case 'r':
+    if ((numArgs < 1) || (numArgs > 2)) break;
+    rec.peer = atoi(args[0]);
+    rec.tag = (numArgs == 2) ? atoi(args[1]) : -1;
+    return 1;
+  case 'c':
+    if (numArgs != 1) break;
+    rec.delay_ns = atof(args[0]);
+    if (rec.delay_ns >= 0) return 1;
+    break;
+  default:
+    break;
+  }
+
+  cout << "-E- trace file:" << fileName << " line:" << lineNum
+       << " bad format: expected 's <dst> <bytes> [tag]', 'r <src> [tag]'"
+       << " or 'c <ns>'" << endl;
+  err = 1;
+  return 0;
+}
+
+// read records until the buffer holds readAhead of them
+void
+traceFile::fill()
+{
+  char buf[257];
+  traceRecord rec;
+  while (f && !err && (records.size() < readAhead)) {
+    if (fgets(buf, sizeof(buf), f) == NULL) {
+      fclose(f);
+      f = NULL;
+      break;
+    }
+    lineNum++;
+    if (!strchr(buf, '\n') && !feof(f)) {
+      cout << "-E- trace file:" << fileName << " line:" << lineNum
+           << " is too long (>256)" << endl;
+      err = 1;
+      break;
+    }
+    if (parseLine(buf, rec)) {
+      rec.lineNum = lineNum;
+      records.push_back(rec);
+    }
+  }
+}
+
+const traceRecord *
+traceFile::peek()
+{
+  if (records.empty())
+    fill();
+  if (err || records.empty())
+    return NULL;
+  return &records.front();
+}
+
+void
+traceFile::pop()
+{
+  records.pop_front();
+  if (records.size() <= readAhead / 2)
+    fill();
+}
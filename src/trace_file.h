@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////
+//
+//         InfiniBand FLIT (Credit) Level OMNet++ Simulation Model
+//
+// Copyright (c) 2004-2013 Mellanox Technologies, Ltd. All rights reserved.
+// This software is available to you under the terms of the GNU
+// General Public License (GPL) Version 2, available from the file
+// COPYING in the main directory of this source tree.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+///////////////////////////////////////////////////////////////////////////
+//
+// A streaming reader of per rank application trace files.
+//
+// Trace files are text, one record per line. Empty lines and lines
+// starting with '#' are ignored. Ranks are the index of the HCA in the
+// LID sorted list of all HCAs.
+//
+// s <dst rank> <bytes> [tag]  - send a message of bytes to dst rank
+// r <src rank> [tag]          - wait for a message from src rank (-1 any)
+//                               with the given tag (default -1 any)
+// c <ns>                      - compute for the given time before the
+//                               next record
+//
+// Traces may be huge so the file is never loaded: at most readAhead
+// records are buffered and the buffer is refilled once half drained.
+//
+// Usage:
+//   traceFile trace;
+//   if (trace.open(fileName, 1024)) error...
+//   while (const traceRecord *p_rec = trace.peek()) {
+//     ... use *p_rec
+//     trace.pop();
+//   }
+//   if (trace.bad()) error...
+//
+
+#ifndef __TRACE_FILE__
+#define __TRACE_FILE__
+
+#include <deque>
+#include <string>
+#include <stdio.h>
+
+class traceRecord
+{
+ public:
+  char op;            // s(end) r(ecv) or c(ompute)
+  int peer;           // dst rank of send or src rank of recv (-1 is any)
+  unsigned int bytes; // send message length
+  int tag;            // the message tag (-1 is any on recv)
+  double delay_ns;    // compute time
+  unsigned int lineNum; // the trace line of the record
+};
+
+class traceFile
+{
+ private:
+  FILE *f;
+  std::string fileName;
+  unsigned int lineNum;
+  unsigned int readAhead;
+  std::deque<traceRecord> records;
+  int err;
+
+  int parseLine(char *line, traceRecord &rec);
+  void fill();
+
+ public:
+  traceFile();
+  ~traceFile();
+  int open(std::string fileName, unsigned int readAhead);
+  // the next record or NULL on end of trace or error
+  const traceRecord *peek();
+  void pop();
+  // non zero if the file could not be read or parsed
+  int bad() const { return err; };
+  unsigned int getLineNum() const { return lineNum; };
+};
+
+#endif /* __TRACE_FILE__ */
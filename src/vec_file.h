@@ -47,8 +47,8 @@ class vecFile
  private:
   std::vector<std::vector<int> >   intData;
   std::vector<std::vector<float> > floatData;
-  int parse(std::string fileName, int asInt = 1);
  public:
+  int parse(std::string fileName, int asInt = 1);
   std::vector<int>   *getIntVec(  unsigned int objIdx);
   std::vector<float> *getFloatVec(unsigned int objIdx);
   friend class vecFiles;
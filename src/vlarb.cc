@@ -26,22 +26,29 @@
 #include "vlarb.h"
 #include "obuf.h"
 #include "ibuf.h"
+#include "profiler.h"
 #include <iomanip>
+#include <climits>
 using namespace std;
 
 Define_Module( IBVLArb );
 
-void IBVLArb::setVLArbParams(const char *cfgStr, ArbTableEntry *tbl)
+// parse the "vl:weight vl:weight ..." table and return number of entries
+unsigned int IBVLArb::setVLArbParams(const char *cfgStr, ArbTableEntry *tbl)
 {
-  int idx = 0;
+  unsigned int idx = 0;
   char *buf, *p_vl, *p_weight;
   buf = new char[strlen(cfgStr)+1];
   strcpy(buf, cfgStr);
   p_vl = strtok(buf, ":");
-  while (p_vl && (idx < 8)) {
+  while (p_vl) {
+    if (idx == IB_VLARB_TBL_SIZE) {
+      opp_error("-E- %s more than %d entries in VLA: %s",
+                getFullPath().c_str(), IB_VLARB_TBL_SIZE, cfgStr);
+    }
     int vl = atoi(p_vl);
-    if (vl > 8) {
-      opp_error("-E- %s VL: %d > 8 in VLA: %s ",
+    if ((vl < 0) || (vl > 14)) {
+      opp_error("-E- %s VL: %d > 14 in VLA: %s ",
                 getFullPath().c_str(), vl, cfgStr);
     }
 
@@ -65,30 +72,50 @@ void IBVLArb::setVLArbParams(const char *cfgStr, ArbTableEntry *tbl)
   }
 
   // the rest are zeros
-  for (;idx < 8; idx++ ) {
+  unsigned int numEntries = idx;
+  for (;idx < IB_VLARB_TBL_SIZE; idx++ ) {
     tbl[idx].VL = 0;
     tbl[idx].weight = 0;
     tbl[idx].used = 0;
   }
   delete [] buf;
+  return(numEntries);
 }
 
 void IBVLArb::initialize()
 {
+  IB_PROF_CALL("IBVLArb::initialize");
   double coreFreq_hz = par("coreFreq");
   int    busWidth_B = par("busWidth");
   // read parameters
   hcaArb = par("isHcaArbiter");
   maxVL = par("maxVL");
   useFCFSRQArb = par("useFCFSRQArb");
+  linkDown = false;
 
   if (!hcaArb) {
     EV << "-I- " << getFullPath() << " is Switch IBuf " << getId() <<  endl;
     cModule*    sw = getParentModule()->getParentModule();
     VSWDelay = sw->par("VSWDelay");
+    switchLifetime_s = (double)sw->par("switchLifetime") * 1e-6;
+  } else {
+    switchLifetime_s = 0;
+  }
+
+  // HoQ lifetime is only applied by switches
+  std::vector<double> hoqLife_us =
+    cStringTokenizer(par("hoqLife")).asDoubleVector();
+  for (unsigned int vl = 0; vl < maxVL+1; vl++) {
+    double life_us = 0;
+    if (!hcaArb && !hoqLife_us.empty())
+      life_us = hoqLife_us[vl < hoqLife_us.size() ? vl : hoqLife_us.size()-1];
+    if (life_us < 0) {
+      opp_error("-E- %s negative hoqLife: %g", getFullPath().c_str(), life_us);
+    }
+    hoqLife_s.push_back(life_us * 1e-6);
   }
-  setVLArbParams(par("highVLArbEntries"), HighTbl);
-  setVLArbParams(par("lowVLArbEntries"), LowTbl);
+  numHighEntries = setVLArbParams(par("highVLArbEntries"), HighTbl);
+  numLowEntries = setVLArbParams(par("lowVLArbEntries"), LowTbl);
   vlHighLimit = par("vlHighLimit");
   // The internal bus from in-buf to out-bus is assumed to
   // be clocking every coreFreq cycle and with width of busWidth
@@ -130,6 +157,17 @@ void IBVLArb::initialize()
     for (unsigned int vl = 0; vl < maxVL+1; vl++ )
       hoqFreeProvided[pn][vl] = 0;
 
+  hoqDiscardPkt = new short*[numInPorts];
+  for (unsigned int pn = 0; pn < numInPorts; pn++) {
+    hoqDiscardPkt[pn] = new short[maxVL+1];
+    for (unsigned int vl = 0; vl < maxVL+1; vl++ )
+      hoqDiscardPkt[pn][vl] = 0;
+  }
+  nextLifeCheck = MAXTIME;
+  numHoQLifeDiscards = 0;
+  numSwLifeDiscards = 0;
+  numDiscardedFlits = 0;
+
   // Init FCCL and FCTBS and the last sent port...
   for (unsigned int vl = 0; vl < maxVL+1; vl++ ) {
     LastSentPort.push_back(0);
@@ -141,17 +179,19 @@ void IBVLArb::initialize()
   WATCH_VECTOR(FCTBS);
   WATCH_VECTOR(FCCL);
 
-  lastSendTime = 0;
   LastSentVL = 0;
   LastSentWasHigh = 0;
   InsidePacket = 0;
   LowIndex = 0;
   HighIndex = 0;
-  SentHighCounter = vlHighLimit*4096/64;
+  SentHighCounter = vlHighLimit*4096;
 
   // The pop message is set every time we send a packet
   // when it is not scheduled we are ready for arbitration
   p_popMsg = new cMessage("pop", IB_POP_MSG);
+
+  // stale HoQs are discarded on time even if the port is stuck
+  p_lifeMsg = new cMessage("lifetime", IB_LIFE_TIMER_MSG);
 }
 
 // return the FCTBS of the OBUF driven by the VLA
@@ -166,9 +206,28 @@ int IBVLArb::getOBufFCTBS(unsigned int vl)
   return(p_oBuf->getFCTBS(vl));
 }
 
+// the free credits of the VL - the OBUF discards the data of a down link
+// so any packet may be sent then
+int IBVLArb::getFreeCredits(unsigned int vl)
+{
+  if (linkDown)
+    return INT_MAX;
+  return(FCCL[vl] - FCTBS[vl]);
+}
+
+// called by the OBUF when the link fails or recovers. After recovery the
+// FCCL is stale until the first flow control arrives.
+void IBVLArb::setLinkUp(bool up)
+{
+  Enter_Method("setLinkUp %d", up);
+  linkDown = !up;
+  arbitrate();
+}
+
 // return 1 if the HoQ for that port/VL is free
 int IBVLArb::isHoQFree(unsigned int pn, unsigned int vl)
 {
+  IB_PROF_CALL("IBVLArb::isHoQFree");
   if ((pn < 0) || (pn >= numInPorts) ) {
     opp_error("-E- %s got out of range port num: %d",
               getFullPath().c_str(), pn);
@@ -194,6 +253,7 @@ int IBVLArb::isHoQFree(unsigned int pn, unsigned int vl)
 void IBVLArb::sendOutMessage(IBDataMsg *p_msg)
 {
   simtime_t delay = p_msg->getByteLength() * popDelayPerByte_s;
+  chargeLatencyStage(p_msg, IB_LAT_ARB_WAIT);
   // we can only send if there is no such message as we use
   // it to flag the port is clear to send.
   if ( ! p_popMsg->isScheduled() ) {
@@ -207,19 +267,9 @@ void IBVLArb::sendOutMessage(IBDataMsg *p_msg)
   // remember if last send was last of packet:
   LastSentWasLast = (p_msg->getFlitSn() + 1 == p_msg->getPacketLength());
 
-  if (!hcaArb) {
-    simtime_t storeTime = simTime() - p_msg->getArrivalTime();
-    simtime_t extraStoreTime = VSWDelay*1e-9 - storeTime;
-    if (simTime() + extraStoreTime <= lastSendTime) {
-      extraStoreTime = lastSendTime + 1e-9 - simTime();
-    }
-    if (extraStoreTime > 0) {
-      lastSendTime = simTime() + extraStoreTime;
-      sendDelayed(p_msg, extraStoreTime, "out");
-    } else {
-      lastSendTime = simTime();
-      send(p_msg, "out");
-    }
+  // the VLA pipeline delays every granted FLIT alike - so keeps their order
+  if (!hcaArb && VSWDelay) {
+    sendDelayed(p_msg, VSWDelay*1e-9, "out");
   } else {
     send(p_msg, "out");
   }
@@ -228,19 +278,93 @@ void IBVLArb::sendOutMessage(IBDataMsg *p_msg)
 }
 
 // Notify the IBUF that the flit was sent out
-void IBVLArb::sendSentMessage(unsigned int portNum, unsigned int vl)
+void IBVLArb::sendSentMessage(unsigned int portNum, unsigned int vl,
+                              int wasLast)
 {
   EV << "-I- " << getFullPath()
      << " informing ibuf with 'sent' message through:" << portNum
-     << " vl:" << vl << " last:" << LastSentWasLast << endl;
+     << " vl:" << vl << " last:" << wasLast << endl;
   IBSentMsg *p_sentMsg = new IBSentMsg("sent", IB_SENT_MSG);
   p_sentMsg->setVL(vl);
-  p_sentMsg->setWasLast(LastSentWasLast);
+  p_sentMsg->setWasLast(wasLast);
   hoqFreeProvided[portNum][vl] = 0;
 
   send(p_sentMsg, "sent", portNum );
 }
 
+// return the time the packet head in the HoQ expires by either lifetime
+simtime_t IBVLArb::getHoQExpiry(IBDataMsg *p_msg)
+{
+  simtime_t expiry = MAXTIME;
+  unsigned int vl = p_msg->getVL();
+  // the stage time of a HoQ FLIT is the time it entered the HoQ
+  if (hoqLife_s[vl] > 0)
+    expiry = p_msg->getStageTime() + hoqLife_s[vl];
+  if ((switchLifetime_s > 0) &&
+      (p_msg->getSwTimeStamp() + switchLifetime_s < expiry))
+    expiry = p_msg->getSwTimeStamp() + switchLifetime_s;
+  return(expiry);
+}
+
+// Drop the HoQ FLIT and let the IBUF free its credit. The busy port
+// of the IBUF was never taken so the FLIT is never reported as last.
+void IBVLArb::discardFlit(unsigned int portNum, unsigned int vl,
+                          IBDataMsg *p_msg)
+{
+  hoqDiscardPkt[portNum][vl] =
+    (p_msg->getFlitSn() + 1 != p_msg->getPacketLength());
+  inPktHoqPerVL[portNum][vl] = NULL;
+  numDiscardedFlits++;
+  delete p_msg;
+  sendSentMessage(portNum, vl, 0);
+}
+
+// Discard the packets whose heads are waiting in the HoQ beyond their
+// HoQ or switch lifetime. Scans only once the earliest expiry passed.
+void IBVLArb::discardStaleHoQs()
+{
+  if (simTime() < nextLifeCheck) return;
+
+  nextLifeCheck = MAXTIME;
+  for (unsigned int pn = 0; pn < numInPorts; pn++) {
+    for (unsigned int vl = 0; vl < maxVL+1; vl++) {
+      IBDataMsg *p_flit = inPktHoqPerVL[pn][vl];
+      // packets already started are never discarded
+      if (!p_flit || p_flit->getFlitSn()) continue;
+
+      simtime_t expiry = getHoQExpiry(p_flit);
+      if (expiry > simTime()) {
+        if (expiry < nextLifeCheck) nextLifeCheck = expiry;
+        continue;
+      }
+
+      if ((hoqLife_s[vl] > 0) &&
+          (simTime() >= p_flit->getStageTime() + hoqLife_s[vl]))
+        numHoQLifeDiscards++;
+      else
+        numSwLifeDiscards++;
+
+      EV << "-I- " << getFullPath() << " discarding stale packet:"
+         << p_flit->getName() << " from port:" << pn << " vl:" << vl
+         << " in switch:" << simTime() - p_flit->getSwTimeStamp() << endl;
+      discardFlit(pn, vl, p_flit);
+    }
+  }
+  scheduleLifeCheck();
+}
+
+// keep the lifetime timer at the earliest HoQ expiry
+void IBVLArb::scheduleLifeCheck()
+{
+  if (p_lifeMsg->isScheduled()) {
+    if (p_lifeMsg->getArrivalTime() == nextLifeCheck) return;
+    cancelEvent(p_lifeMsg);
+  }
+  if (nextLifeCheck < MAXTIME)
+    scheduleAt(nextLifeCheck > simTime() ? nextLifeCheck : simTime(),
+               p_lifeMsg);
+}
+
 // An arbitration is valid on two conditions:
 // 1. The output port OBUF has free entries
 // 2. The IBUF is not already to busy with other ports
@@ -379,7 +503,7 @@ IBVLArb::firstComeFirstServeNextRQForVL(int numCredits, unsigned int curPortNum,
 // Find the port and VL to be sent next from a High or Low entries.
 // Given:
 // * current index in the table
-// * The table of entries (VL,Weight) pairs
+// * The table of entries (VL,Weight) pairs and its number of entries
 // Return:
 // * 1 if found a port to send data from or 0 if nothing to send
 // * Update the provided entry index
@@ -387,6 +511,7 @@ IBVLArb::firstComeFirstServeNextRQForVL(int numCredits, unsigned int curPortNum,
 // * update the VL
 int
 IBVLArb::findNextSend( unsigned int &curIdx, ArbTableEntry *Tbl,
+                       unsigned int numEntries,
                        unsigned int &curPortNum, unsigned int &curVl )
 {
   int idx;
@@ -395,19 +520,25 @@ IBVLArb::findNextSend( unsigned int &curIdx, ArbTableEntry *Tbl,
   int numCredits = 0;
   int portNum;
 
+  if (!numEntries)
+    return(0);
+
   // we need to scan through all entries starting with last one used
-  for (unsigned int i = 0; i <= maxVL+1 ; i++) {
-    idx = (curIdx + i) % (maxVL+1);
+  for (unsigned int i = 0; i <= numEntries ; i++) {
+    idx = (curIdx + i) % numEntries;
     // if we changed index we need to restat the weight counter
     if (i) Tbl[idx].used = 0;
 
-    // we should skip the entry if it has zero credits (weights) not used
-    if (!Tbl[idx].weight || (Tbl[idx].used > Tbl[idx].weight)) continue;
+    // we should skip the entry if it has zero weight or it was all used
+    // (a packet started while some weight was left is completed anyway)
+    if (!Tbl[idx].weight || (Tbl[idx].used >= 64*Tbl[idx].weight)) continue;
 
+    // VLs that are not supported by the port are skipped
     vl = Tbl[idx].VL;
+    if (vl > (int)maxVL) continue;
 
     // how many credits are available for this VL
-    numCredits = FCCL[vl] - FCTBS[vl];
+    numCredits = getFreeCredits(vl);
 
     if (useFCFSRQArb){
     	found = firstComeFirstServeNextRQForVL(numCredits, curPortNum, vl, portNum);
@@ -439,7 +570,7 @@ IBVLArb::findNextSendOnVL0( unsigned int &curPortNum )
   IBDataMsg *p_flit;
 
   // how many credits are available for this VL
-  numCredits = FCCL[0] - FCTBS[0];
+  numCredits = getFreeCredits(0);
 
   // start with the next port to the last one we sent
   for (unsigned int pn = 1; pn <= numInPorts; pn++) {
@@ -484,14 +615,14 @@ void IBVLArb::displayState()
     ev << "-I- " << getFullPath() << " ARBITER STATE as VL/Used/Weight"
        << endl;
     ev << "-I- High:";
-    for (unsigned int e = 0; e < maxVL+1; e++) {
+    for (unsigned int e = 0; e < numHighEntries; e++) {
       if (LastSentWasHigh && HighIndex == e)
         ev << "*" << HighTbl[e].VL << " "
-           << setw(3) << HighTbl[e].used
+           << setw(3) << (HighTbl[e].used + 63)/64
            << "/" << setw(3) << HighTbl[e].weight << "*";
       else
         ev << "|" << HighTbl[e].VL << " "
-           << setw(3) << HighTbl[e].used
+           << setw(3) << (HighTbl[e].used + 63)/64
            << "/" << setw(3) << HighTbl[e].weight << " ";
     }
     if (LastSentWasHigh)
@@ -500,14 +631,14 @@ void IBVLArb::displayState()
       ev << endl;
 
     ev << "-I- Low: ";
-    for (unsigned int e = 0; e < maxVL+1; e++) {
+    for (unsigned int e = 0; e < numLowEntries; e++) {
       if (!LastSentWasHigh && LowIndex == e)
         ev << "*" << LowTbl[e].VL << " "
-           << setw(3) << LowTbl[e].used
+           << setw(3) << (LowTbl[e].used + 63)/64
            << "/" << setw(3) << LowTbl[e].weight << "*";
       else
         ev << "|" << LowTbl[e].VL << " "
-           << setw(3) << LowTbl[e].used
+           << setw(3) << (LowTbl[e].used + 63)/64
            << "/" << setw(3) << LowTbl[e].weight << " ";
     }
     ev << endl;
@@ -549,7 +680,7 @@ void IBVLArb::displayState()
 // Data Structure:
 // HighIndex, LowIndex - points to the index in the VLArb tables.
 // LastSentPort[VL] - points to the last port that have sent data on a VL
-// SentHighCounter - counts how many credits still needs to be sent from high
+// SentHighCounter - counts how many bytes may still be sent from high
 // LastSentWasHigh - let us know if we were previously sending from
 //    low or high table
 // inPktHoqPerVL[pn][vl] - an array per port and VL pointing to first
@@ -569,8 +700,8 @@ void IBVLArb::displayState()
 //   searched (ignore 0 weight entries).
 // * If found a new index use it and update the credits sent vs the weight.
 // * If not found and we are HighTable - use LowTable and do as above.
-// * Dec the SentHighCounter if we are HighTable. Load it to vlHighLimit*4k/64
-//   otherwise.
+// * Dec the SentHighCounter by the sent bytes if we are HighTable. Load it to
+//   vlHighLimit*4k otherwise.
 //
 void IBVLArb::arbitrate()
 {
@@ -581,6 +712,9 @@ void IBVLArb::arbitrate()
   unsigned int portNum;
   unsigned int vl;
 
+  // stale packets are discarded even if we are in a middle of send
+  if (!hcaArb) discardStaleHoQs();
+
   // can not arbitrate if we are in a middle of send
   if (p_popMsg->isScheduled()) {
     EV << "-I- " << getFullPath()
@@ -619,13 +753,13 @@ void IBVLArb::arbitrate()
 
     // need to decrement the SentHighCounter if we are sending high packets
     if (LastSentWasHigh) {
-      SentHighCounter--;
+      SentHighCounter -= nextSendHoq->getByteLength();
     } else {
       // If we are sending the last credit of packet when the SentHighCounter
-      // is zero we need to reload it as this was the last credit of forced low
-      // packet
-      if ( isLastFlit && (SentHighCounter == 0))
-        SentHighCounter = vlHighLimit*4096/64;
+      // is exhausted we need to reload it as this was the last credit of
+      // forced low packet
+      if ( isLastFlit && (SentHighCounter <= 0))
+        SentHighCounter = vlHighLimit*4096;
     }
     found = 1;
   } else {
@@ -640,17 +774,17 @@ void IBVLArb::arbitrate()
       // if we are in High Limit case try first from low
       if ( SentHighCounter <= 0 ) {
         found = 1;
-        if (findNextSend(LowIndex, LowTbl, portNum, vl))
+        if (findNextSend(LowIndex, LowTbl, numLowEntries, portNum, vl))
           LastSentWasHigh = 0;
-        else if ( findNextSend(HighIndex, HighTbl, portNum, vl) )
+        else if ( findNextSend(HighIndex, HighTbl, numHighEntries, portNum, vl) )
           LastSentWasHigh = 1;
         else
           found = 0;
       } else {
         found = 1;
-        if ( findNextSend(HighIndex, HighTbl, portNum, vl) )
+        if ( findNextSend(HighIndex, HighTbl, numHighEntries, portNum, vl) )
           LastSentWasHigh = 1;
-        else if (findNextSend(LowIndex, LowTbl, portNum, vl))
+        else if (findNextSend(LowIndex, LowTbl, numLowEntries, portNum, vl))
           LastSentWasHigh = 0;
         else
           found = 0;
@@ -709,13 +843,13 @@ void IBVLArb::arbitrate()
     inPktHoqPerVL[LastSentPort[LastSentVL]][LastSentVL] = NULL;
 
     if (LastSentWasHigh)
-      HighTbl[HighIndex].used ++;
+      HighTbl[HighIndex].used += nextSendHoq->getByteLength();
     else
-      LowTbl[LowIndex].used ++;
+      LowTbl[LowIndex].used += nextSendHoq->getByteLength();
 
     arbDecision.record(10*(vl+1));
     sendOutMessage(nextSendHoq);
-    sendSentMessage(LastSentPort[LastSentVL],LastSentVL);
+    sendSentMessage(LastSentPort[LastSentVL], LastSentVL, LastSentWasLast);
   } else {
     // if we are in the first data credit cleanup the InsidePacket flag
     if (nextSendHoq->getFlitSn() == 0)
@@ -759,6 +893,23 @@ void IBVLArb::handlePush(IBDataMsg *p_msg)
 
   inPktHoqPerVL[pn][vl] = p_msg;
   hoqFreeProvided[pn][vl] = 0;
+  chargeLatencyStage(p_msg, IB_LAT_XBAR);
+
+  // the rest of a discarded packet
+  if (hoqDiscardPkt[pn][vl]) {
+    EV << "-I- " << getFullPath() << " discarding:" << p_msg->getName()
+       << " of a discarded packet" << endl;
+    discardFlit(pn, vl, p_msg);
+    return;
+  }
+
+  if (!hcaArb && !p_msg->getFlitSn()) {
+    simtime_t expiry = getHoQExpiry(p_msg);
+    if (expiry < nextLifeCheck) {
+      nextLifeCheck = expiry;
+      scheduleLifeCheck();
+    }
+  }
   arbitrate();
 }
 
@@ -790,6 +941,7 @@ void IBVLArb::handleTxCred(IBTxCredMsg *p_msg)
 
 void IBVLArb::handleMessage(cMessage *p_msg)
 {
+  IB_PROF_EVENT(p_msg);
   int msgType = p_msg->getKind();
   if ( msgType == IB_POP_MSG ) {
     handlePop();
@@ -800,6 +952,9 @@ void IBVLArb::handleMessage(cMessage *p_msg)
   } else if ( (msgType == IB_DONE_MSG) || (msgType == IB_FREE_MSG) ) {
     delete p_msg;
     arbitrate();
+  } else if ( msgType == IB_LIFE_TIMER_MSG ) {
+    discardStaleHoQs();
+    arbitrate();
   } else {
     opp_error("-E- %s does not know how to handle message: %d",
               getFullPath().c_str(), msgType);
@@ -809,6 +964,11 @@ void IBVLArb::handleMessage(cMessage *p_msg)
 
 void IBVLArb::finish()
 {
+  if (!hcaArb) {
+    recordScalar("HoQ-Lifetime-Discards", numHoQLifeDiscards);
+    recordScalar("Switch-Lifetime-Discards", numSwLifeDiscards);
+    recordScalar("Discarded-FLITs", numDiscardedFlits);
+  }
 
     if (useFCFSRQArb)
 
@@ -821,6 +981,37 @@ void IBVLArb::finish()
   */
 }
 
+void IBVLArb::snapshotState(stateSnapshot &s)
+{
+  for (unsigned int i = 0; i < numHighEntries; i++)
+    snap(s, HighTbl[i].used);
+  for (unsigned int i = 0; i < numLowEntries; i++)
+    snap(s, LowTbl[i].used);
+  snap(s, HighIndex);
+  snap(s, LowIndex);
+  snap(s, LastSentPort);
+  snap(s, LastSentVL);
+  snap(s, SentHighCounter);
+  snap(s, LastSentWasHigh);
+  snap(s, LastSentWasLast);
+  snap(s, InsidePacket);
+
+  for (unsigned int pn = 0; pn < numInPorts; pn++) {
+    for (unsigned int vl = 0; vl < maxVL+1; vl++) {
+      s.msg(inPktHoqPerVL[pn][vl]);
+      snap(s, hoqFreeProvided[pn][vl]);
+      snap(s, hoqDiscardPkt[pn][vl]);
+    }
+  }
+  snap(s, nextLifeCheck);
+  snap(s, linkDown);
+  snap(s, FCTBS);
+  snap(s, FCCL);
+  s.timer(p_popMsg);
+  s.timer(p_lifeMsg);
+}
+
 IBVLArb::~IBVLArb() {
 	if (p_popMsg) cancelAndDelete(p_popMsg);
+	if (p_lifeMsg) cancelAndDelete(p_lifeMsg);
 }
@@ -27,10 +27,17 @@
 // * sent[N] - backward notification of sent data
 //
 // Parameters
-// * VLHighLimit - IB style VLArb table limit of number of credits sent
+// * VLHighLimit - IB style VLArb table limit of number of 4KB units sent
 //                 from high level before low level checked.
-// * HighVLs[C], HighWeights[C], LowVLs[C], LowWeights[C] - the IB VLA config
+// * highVLArbEntries, lowVLArbEntries - the IB VLA High and Low tables
+//   of up to 64 "vl:weight" entries. Weights are in 64 bytes units (0-255).
+//   The table index is independent of the VL and entries of VLs above
+//   maxVL are skipped.
 // * popDelayPerByte_s - control the rate of Pop events
+// * hoqLife - per VL IB HOQLife in usec of a packet head waiting in the
+//   HoQ (0 is infinite). The last value repeats for higher VLs.
+// * switchLifetime (Switch parameter) - max usec a packet may spend in
+//   the switch (0 is infinite).
 //
 // Internal Events
 // * Pop - cause a credit to leave the
@@ -39,10 +46,20 @@
 // * Push - data is available on the INj (stored locally)
 // * txCred - FCCL = credits availability on remote port
 //
+// * setLinkUp - a method call by the OBUF on link failure and recovery
+//
 // Functionality
 // Every time a packet can be sent out as dictated by the Pop rate performs
 // IB style VLArb by inspecting available credits and packets.
 // Use round robin to select input port if data is available on several.
+// Switch arbiters discard packets with stale heads before arbitration:
+// the HoQ lifetime is measured from the time the head entered the HoQ and
+// the switch lifetime from its SwTimeStamp. No timer is kept per packet -
+// a single lifetime timer per arbiter fires at the earliest expiry of all
+// HoQs and scans them, so the heads of a port starved of credits (or
+// deadlocked) are discarded on time as well. The rest of a discarded
+// packet is dropped as it is pushed. Discarded FLITs are reported back to
+// the IBUF as "sent" such that their credits are freed.
 // Track sent packets on each VL (FCTBS). The txCred event updates the FCCL[vl]
 // Free credits per VL are calculated as FCCL - FCTBS.
 // When a credit is sent out of the VLArb a "Sent" event is provided back to
@@ -61,6 +78,7 @@
 
 #include <omnetpp.h>
 #include <vector>
+#include "snapshot.h"
 
 //
 // A single entry in the arbitration table
@@ -68,46 +86,62 @@
 class ArbTableEntry {
 public:
   short int VL;
-  short int weight; // max credits to send - rounded up for a packet
-  int       used;   // used credits from the above
+  short int weight; // max 64 bytes units to send - rounded up for a packet
+  int       used;   // used bytes from the above
 };
 
+#define IB_VLARB_TBL_SIZE 64
+
 //
 // Infiniband Arbiter
 //
-class IBVLArb: public cSimpleModule
+class IBVLArb: public cSimpleModule, public snapshotModule
 {
+  // the micro benchmarks drive the private handlers (microbench.h)
+  friend class IBMicroBench;
+
  private:
   cMessage *p_popMsg;
+  cMessage *p_lifeMsg;      // wakes the arbiter at nextLifeCheck
 
   // parameters:
-  int vlHighLimit;          // Max number of credits sent from High till Low
-  ArbTableEntry HighTbl[8]; // The High Priority Arbitration Table
-  ArbTableEntry LowTbl[8];  // The Low Priority Arbitration Table
+  int vlHighLimit;          // Max number of 4KB sent from High till Low
+  ArbTableEntry HighTbl[IB_VLARB_TBL_SIZE]; // The High Priority Table
+  ArbTableEntry LowTbl[IB_VLARB_TBL_SIZE];  // The Low Priority Table
+  unsigned int numHighEntries; // number of entries set in the High table
+  unsigned int numLowEntries;  // number of entries set in the Low table
   int           hcaArb;     // If 1 means the arbiter is an HCA arbiter
   int recordVectors;        // Control recording of vectors
   unsigned int maxVL;       // Maximum value of VL
   int VSWDelay;             // Delay brought by VLArb in Switch [ns] (SW par)
   bool useFCFSRQArb;        // Arbitrate RQs on same VL by First Come First Serve
+  bool linkDown;            // the link is failed - credits are ignored
+  std::vector<double> hoqLife_s; // HoQ lifetime per VL (0 is infinite)
+  double switchLifetime_s;  // switch lifetime (0 is infinite)
 
   // data structure:
   double popDelayPerByte_s;  // Rate of single byte injection
   IBDataMsg ***inPktHoqPerVL; // the head of the send Q on every VL
   short **hoqFreeProvided;    // set when a "free" HoQ provided/cleared on push
+  short **hoqDiscardPkt;      // set while discarding the rest of a packet
+  simtime_t nextLifeCheck;    // the earliest expiry of the HoQ heads
   unsigned int HighIndex, LowIndex; // points to the index in the VLArb tables.
   std::vector<int> LastSentPort; // last port that have sent data on each VL
   unsigned int LastSentVL; // the VL of the last sent packet
-  int SentHighCounter;     // counts how many credits were sent from the high
+  int SentHighCounter;     // counts how many bytes may be sent from the high
   int LastSentWasHigh;     // 1 if we were previously sending from high
   int LastSentWasLast;     // 1 if the sent data was last in the packet
   unsigned int numInPorts; // The number of input ports
   int InsidePacket;        // if 1 we are sending a packet (already arbitrated)
-  simtime_t lastSendTime;  // store the last arbitration send
 
   // methods
-  void setVLArbParams(const char *cfgStr, ArbTableEntry *tbl);
+  unsigned int setVLArbParams(const char *cfgStr, ArbTableEntry *tbl);
   void sendOutMessage(IBDataMsg *p_msg);
-  void sendSentMessage(unsigned int portNum, unsigned int vl);
+  void sendSentMessage(unsigned int portNum, unsigned int vl, int wasLast);
+  simtime_t getHoQExpiry(IBDataMsg *p_msg);
+  void discardFlit(unsigned int portNum, unsigned int vl, IBDataMsg *p_msg);
+  void discardStaleHoQs();
+  void scheduleLifeCheck();
   int  isValidArbitration(unsigned int portNum, unsigned int vl,
 				  int isFirstPacket, int numPacketCredits);
   int roundRobinNextRQForVL(int numCredits, unsigned int curPortNum, short int vl,
@@ -115,6 +149,7 @@ class IBVLArb: public cSimpleModule
   int firstComeFirstServeNextRQForVL(int numCredits, unsigned int curPortNum, short int vl,
   							   int &nextPortNum);
   int  findNextSend( unsigned int &curIdx, ArbTableEntry *Tbl,
+			   unsigned int numEntries,
 			   unsigned int &curPortNum, unsigned int &curVl );
   int  findNextSendOnVL0( unsigned int &curPortNum );
   void displayState();
@@ -123,6 +158,7 @@ class IBVLArb: public cSimpleModule
   void handlePop();
   void handleTxCred(IBTxCredMsg *p_msg);
   int  getOBufFCTBS(unsigned int vl);
+  int  getFreeCredits(unsigned int vl);
 
   // statistics
   cOutVector vl0Credits;  // the credits on VL0
@@ -130,17 +166,26 @@ class IBVLArb: public cSimpleModule
   cOutVector readyData;   // the VLs with ready data in binaru code
   cOutVector arbDecision; // the resulting VL arbitrated -1 is invalid
   cLongHistogram portXmitWaitHist;
+  unsigned int numHoQLifeDiscards; // packets discarded by HoQ lifetime
+  unsigned int numSwLifeDiscards;  // packets discarded by switch lifetime
+  unsigned int numDiscardedFlits;  // FLITs of all discarded packets
 
  public:
   // return 1 if the HoQ for that port/VL is free
   int isHoQFree(unsigned int pn, unsigned int vl);
 
+  // a failed link is drained ignoring its credits
+  void setLinkUp(bool up);
+
   // number of data packet credits sent total in this VL
   std::vector<long> FCTBS;
 
   // The last number of credits the receive port provided
   std::vector<long> FCCL;
 
+  // the arbitration tables position, the HoQs and the credits
+  virtual void snapshotState(stateSnapshot &s);
+
  protected:
   virtual void initialize();
   virtual void handleMessage(cMessage *msg);
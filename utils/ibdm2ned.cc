@@ -0,0 +1,777 @@
+// ibdm2ned - generate the simulation files of a fabric
+//
+// Reads an IBDM style .topo file or builds a parametric fabric:
+//  PGFT(h;m1,..,mh;w1,..,wh;p1,..,ph) - parallel ports generalized fat tree
+//  DF(a,p,h,g) - dragonfly of g groups of a routers with p hosts and
+//                h global links per router (g <= a*h+1)
+// Computes min-hop routes (D-mod-K spreading of equal cost ports) in
+// parallel over the leaf switches and writes:
+//  <name>.ned, <name>.fdbs, <name>.fdbs.ini, <name>.rank.ini, ftree.hcas
+//  and <name>.topo for parametric fabrics.
+//
+// Links may carry a spec: -<w>x-<speed>[-<len>m]-> where speed is in Gbps
+// (like 10G) or SDR/DDR/QDR/FDR/EDR/HDR. The cable length sets the link
+// propagation delay. Links without a length use the -l default.
+// Node names follow the generated NED: '-' becomes '_' and "_U1" is added.
+// HCA LIDs are taken from their H-<n> name when possible.
+// With -m lmc every HCA owns 2^lmc LIDs: the n'th HCA LID range starts at
+// n*2^lmc and every LID of the range is routed (by D-mod-K the LIDs of an
+// HCA take different up ports) giving the HCA generators 2^lmc paths.
+// NOTE: min-hop routes on a dragonfly are not deadlock free.
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "link_spec.h"
+
+using namespace std;
+
+// Data Model:
+
+class Peer {
+public:
+  int node;  // the remote node index or -1 if not connected
+  int port;  // the remote port (0 based)
+  Peer() { node = -1; port = -1; };
+};
+
+class Node {
+public:
+  string name;          // the topo name
+  string sysType;       // the topo system type
+  bool isHca;
+  int lid;              // HCAs only - the base LID with LMC
+  int rank;             // switches only: 0 is the top of the tree
+  vector<Peer> ports;   // by 0 based port number
+  vector<string> wires; // the wire type of the link by port
+};
+
+vector<Node> nodes;
+map<string, int> nodeByName;
+const char *wireType = "IB4XQDRWire";
+double cableLength = 0; // default cable length [m]
+int lmc = 0;            // LIDs per HCA are 2^lmc
+const int mcLidBase = 0xC000; // IB_MC_LID_BASE: unicast LIDs are below it
+set<string> hcaTypes;
+
+// the directors we know how to expand to their leaf and spine switches
+class DirectorDef {
+public:
+  const char *sysType;
+  int numLeafs;
+  int numSpines;
+  int extPorts;   // external ports per leaf (P1..) followed by spine ports
+  int swPorts;    // the ports of each leaf and spine switch
+};
+DirectorDef directors[] = {
+  {"MIS5600", 36, 18, 18, 36},
+  {"IS5600",  36, 18, 18, 36},
+};
+
+int
+getNode(const string &name, const string &sysType, bool isHca)
+{
+  map<string, int>::iterator nI = nodeByName.find(name);
+  if (nI != nodeByName.end())
+    return (*nI).second;
+  Node n;
+  n.name = name;
+  n.sysType = sysType;
+  n.isHca = isHca;
+  n.lid = 0;
+  n.rank = 0;
+  nodes.push_back(n);
+  nodeByName[name] = nodes.size() - 1;
+  return nodes.size() - 1;
+}
+
+// connect both sides of a link - 0 based ports
+int
+connect(int a, int pa, int b, int pb, const string &wire)
+{
+  for (int s = 0; s < 2; s++) {
+    Node &n = nodes[a];
+    if ((int)n.ports.size() <= pa) {
+      n.ports.resize(pa + 1);
+      n.wires.resize(pa + 1);
+    }
+    if ((n.ports[pa].node >= 0) &&
+        ((n.ports[pa].node != b) || (n.ports[pa].port != pb))) {
+      cerr << "-E- " << n.name << " port " << pa + 1
+           << " is connected twice" << endl;
+      return 1;
+    }
+    n.ports[pa].node = b;
+    n.ports[pa].port = pb;
+    n.wires[pa] = wire;
+    swap(a, b);
+    swap(pa, pb);
+  }
+  return 0;
+}
+
+DirectorDef *
+getDirectorDef(const string &sysType)
+{
+  for (unsigned int i = 0; i < sizeof(directors)/sizeof(DirectorDef); i++)
+    if (sysType == directors[i].sysType)
+      return &directors[i];
+  return NULL;
+}
+
+// create the leafs and spines of a director and their internal links
+void
+expandDirector(const string &name, DirectorDef *def)
+{
+  char buf[256];
+  if (nodeByName.find(name + "_leaf1") != nodeByName.end())
+    return;
+  for (int l = 1; l <= def->numLeafs; l++) {
+    sprintf(buf, "%s_leaf%d", name.c_str(), l);
+    int leaf = getNode(buf, def->sysType, false);
+    nodes[leaf].ports.resize(def->swPorts);
+    nodes[leaf].wires.resize(def->swPorts);
+  }
+  for (int s = 1; s <= def->numSpines; s++) {
+    sprintf(buf, "%s_spine%d", name.c_str(), s);
+    int spine = getNode(buf, def->sysType, false);
+    nodes[spine].ports.resize(def->swPorts);
+    nodes[spine].wires.resize(def->swPorts);
+    for (int l = 1; l <= def->numLeafs; l++) {
+      sprintf(buf, "%s_leaf%d", name.c_str(), l);
+      connect(nodeByName[buf], def->extPorts + s - 1, spine, l - 1, wireType);
+    }
+  }
+}
+
+// resolve a port reference: P<n> or L<leaf>/P<n> of a director
+int
+resolvePort(const string &sysType, const string &name, const char *portRef,
+            int &node, int &port)
+{
+  int l, p;
+  DirectorDef *def = getDirectorDef(sysType);
+  if (def) {
+    if ((sscanf(portRef, "L%d/P%d", &l, &p) != 2) ||
+        (l < 1) || (l > def->numLeafs) || (p < 1) || (p > def->extPorts))
+      return 1;
+    expandDirector(name, def);
+    char buf[256];
+    sprintf(buf, "%s_leaf%d", name.c_str(), l);
+    node = nodeByName[buf];
+    port = p - 1;
+    return 0;
+  }
+  if ((sscanf(portRef, "P%d", &p) != 1) || (p < 1))
+    return 1;
+  node = getNode(name, sysType, hcaTypes.count(sysType) > 0);
+  port = p - 1;
+  return 0;
+}
+
+// the NED channel of a wire with the given cable length
+string
+wireWithLength(const string &wire, double length)
+{
+  if (length <= 0)
+    return wire;
+  stringstream s;
+  s << wire << " { length = " << length << "m; }";
+  return s.str();
+}
+
+// map a link spec like -4x-10G-5m-> to a wire
+string
+wireBySpec(const char *arrow)
+{
+  if (!strcmp(arrow, "->"))
+    return wireWithLength(wireType, cableLength);
+
+  linkSpec spec;
+  bool bad = spec.parse(arrow);
+  double width = spec.width, speed = spec.speed_Gbps;
+  double length = spec.length_m ? spec.length_m : cableLength;
+  if (bad || !width || !speed) {
+    cerr << "-W- unsupported link spec: " << arrow << " using " << wireType << endl;
+    return wireWithLength(wireType, length);
+  }
+
+  if (width == 4) {
+    if (speed == 2.5) return wireWithLength("IB4XSDRWire", length);
+    if (speed == 5) return wireWithLength("IB4XDDRWire", length);
+    if (speed == 10) return wireWithLength("IB4XQDRWire", length);
+    if (speed == 14.0625) return wireWithLength("IB4XFDRWire", length);
+    if (speed == 25.78125) return wireWithLength("IB4XEDRWire", length);
+    if (speed == 53.125) return wireWithLength("IB4XHDRWire", length);
+  }
+  stringstream s;
+  s << "IBWire { width = " << width << "; speed = " << speed << "Gbps;";
+  if (length > 0)
+    s << " length = " << length << "m;";
+  s << " }";
+  return s.str();
+}
+
+int
+parseTopo(const char *fileName)
+{
+  ifstream f(fileName);
+  if (!f.good()) {
+    cerr << "-E- Failed to open file: " << fileName << endl;
+    return 1;
+  }
+
+  string line, curType, curName;
+  int lineNum = 0;
+  while (getline(f, line)) {
+    lineNum++;
+    size_t pos = line.find('#');
+    if (pos != string::npos) line.erase(pos);
+    if (line.find_first_not_of(" \t\r") == string::npos) continue;
+
+    char sysType[128], name[128], portRef[64], arrow[64];
+    char remType[128], remName[128], remPortRef[64];
+    if ((line[0] != ' ') && (line[0] != '\t')) {
+      if (sscanf(line.c_str(), "%127s %127s", sysType, name) != 2) {
+        cerr << "-E- " << fileName << ":" << lineNum
+             << " expected: <type> <name>" << endl;
+        return 1;
+      }
+      curType = sysType;
+      curName = name;
+      if (getDirectorDef(curType))
+        expandDirector(curName, getDirectorDef(curType));
+      else
+        getNode(curName, curType, hcaTypes.count(curType) > 0);
+      continue;
+    }
+
+    int a, pa, b, pb;
+    if (curName.empty() ||
+        (sscanf(line.c_str(), " %63s %63s %127s %127s %63s",
+                portRef, arrow, remType, remName, remPortRef) != 5) ||
+        resolvePort(curType, curName, portRef, a, pa) ||
+        resolvePort(remType, remName, remPortRef, b, pb)) {
+      cerr << "-E- " << fileName << ":" << lineNum
+           << " expected: <port> -> <type> <name> <port>" << endl;
+      return 1;
+    }
+    if (connect(a, pa, b, pb, wireBySpec(arrow)))
+      return 1;
+  }
+  return 0;
+}
+
+// split "1,2,3" into ints
+int
+parseIntList(const string &s, vector<int> &v)
+{
+  stringstream ss(s);
+  string tok;
+  while (getline(ss, tok, ',')) {
+    int i = atoi(tok.c_str());
+    if (i <= 0) return 1;
+    v.push_back(i);
+  }
+  return 0;
+}
+
+// PGFT(h;m1,..,mh;w1,..,wh;p1,..,ph)
+// A level l node is a digits tuple d1..dh where di < wi for i <= l and
+// di < mi for i > l. It connects to the level l+1 nodes that replace its
+// d(l+1) by any b < w(l+1), each by p(l+1) parallel links.
+int
+buildPGFT(const char *spec)
+{
+  int h;
+  char buf[256];
+  vector<int> m, w, p;
+  char ms[128], ws[128], ps[128];
+  if ((sscanf(spec, "PGFT(%d;%127[0-9,];%127[0-9,];%127[0-9,])", &h, ms, ws, ps) != 4) ||
+      parseIntList(ms, m) || parseIntList(ws, w) || parseIntList(ps, p) ||
+      ((int)m.size() != h) || ((int)w.size() != h) || ((int)p.size() != h)) {
+    cerr << "-E- bad PGFT spec: " << spec << endl;
+    return 1;
+  }
+  if ((w[0] != 1) || (p[0] != 1)) {
+    cerr << "-E- PGFT hosts have a single port: w1 and p1 must be 1" << endl;
+    return 1;
+  }
+
+  // the nodes of each level by their linear index of the digits tuple
+  vector<vector<int> > byLevel(h + 1);
+  for (int l = 0; l <= h; l++) {
+    int num = 1;
+    for (int i = 0; i < h; i++)
+      num *= (i < l) ? w[i] : m[i];
+    for (int n = 0; n < num; n++) {
+      int idx;
+      if (l == 0) {
+        sprintf(buf, "H-%d", n + 1);
+        idx = getNode(buf, "Cougar", true);
+        nodes[idx].lid = n + 1;
+      } else {
+        sprintf(buf, "SW-L%d-%d", h - l, n);
+        idx = getNode(buf, "SW", false);
+        nodes[idx].rank = h - l;
+        int numPorts = m[l-1]*p[l-1] + ((l < h) ? w[l]*p[l] : 0);
+        nodes[idx].ports.resize(numPorts);
+        nodes[idx].wires.resize(numPorts);
+      }
+      byLevel[l].push_back(idx);
+    }
+  }
+
+  for (int l = 0; l < h; l++) {
+    // the up ports of a switch follow its down ports
+    int firstUpPort = (l == 0) ? 0 : m[l-1]*p[l-1];
+    for (unsigned int n = 0; n < byLevel[l].size(); n++) {
+      // decode the digits
+      vector<int> d(h);
+      int r = n;
+      for (int i = 0; i < h; i++) {
+        int radix = (i < l) ? w[i] : m[i];
+        d[i] = r % radix;
+        r /= radix;
+      }
+      int childIdx = d[l];
+      for (int b = 0; b < w[l]; b++) {
+        // the parent digits: d(l+1) replaced by b and levels below l+1 are w
+        int pIdx = 0, mult = 1;
+        for (int i = 0; i < h; i++) {
+          int radix = (i <= l) ? w[i] : m[i];
+          pIdx += mult * ((i == l) ? b : d[i]);
+          mult *= radix;
+        }
+        for (int k = 0; k < p[l]; k++) {
+          if (connect(byLevel[l][n], firstUpPort + b*p[l] + k,
+                      byLevel[l+1][pIdx], childIdx*p[l] + k, wireWithLength(wireType, cableLength)))
+            return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// DF(a,p,h,g)
+// router r of group G: ports 0..p-1 hosts, p..p+a-2 local, then h global.
+// global link l = r*h + k of group G goes to group T = l < G ? l : l + 1
+int
+buildDF(const char *spec)
+{
+  int a, p, h, g;
+  char buf[256];
+  if ((sscanf(spec, "DF(%d,%d,%d,%d)", &a, &p, &h, &g) != 4) ||
+      (a < 1) || (p < 1) || (h < 1) || (g < 2) || (g > a*h + 1)) {
+    cerr << "-E- bad DF spec: " << spec << " (requires 2 <= g <= a*h+1)" << endl;
+    return 1;
+  }
+
+  vector<int> routers;
+  int hostIdx = 1;
+  for (int G = 0; G < g; G++) {
+    for (int r = 0; r < a; r++) {
+      sprintf(buf, "SW-G%d-R%d", G, r);
+      int sw = getNode(buf, "SW", false);
+      nodes[sw].ports.resize(p + a - 1 + h);
+      nodes[sw].wires.resize(p + a - 1 + h);
+      routers.push_back(sw);
+      for (int n = 0; n < p; n++) {
+        sprintf(buf, "H-%d", hostIdx);
+        int hca = getNode(buf, "Cougar", true);
+        nodes[hca].lid = hostIdx++;
+        if (connect(hca, 0, sw, n, wireWithLength(wireType, cableLength))) return 1;
+      }
+    }
+  }
+
+  for (int G = 0; G < g; G++) {
+    // full mesh inside the group
+    for (int r1 = 0; r1 < a; r1++)
+      for (int r2 = r1 + 1; r2 < a; r2++)
+        if (connect(routers[G*a + r1], p + r2 - 1, routers[G*a + r2], p + r1, wireWithLength(wireType, cableLength)))
+          return 1;
+    // global links
+    for (int l = 0; l < a*h; l++) {
+      int T = (l < G) ? l : l + 1;
+      if ((T >= g) || (T < G)) continue;
+      int lt = G;  // our index seen from T as G < T
+      if (connect(routers[G*a + l/h], p + a - 1 + l % h,
+                  routers[T*a + lt/h], p + a - 1 + lt % h, wireWithLength(wireType, cableLength)))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+// assign LIDs by the H-<n> names or sequentially and the switch ranks
+int
+assignLidsAndRanks(bool rankByLevel)
+{
+  set<int> used;
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    int n;
+    if (!nodes[i].isHca) continue;
+    if (!nodes[i].lid && (sscanf(nodes[i].name.c_str(), "H-%d", &n) == 1) &&
+        (n > 0) && !used.count(n))
+      nodes[i].lid = n;
+    if (nodes[i].lid) used.insert(nodes[i].lid);
+  }
+  int nextLid = 1;
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    if (!nodes[i].isHca || nodes[i].lid) continue;
+    while (used.count(nextLid)) nextLid++;
+    nodes[i].lid = nextLid;
+    used.insert(nextLid);
+  }
+
+  // the LID ranges are aligned to their size and must stay unicast
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    if (!nodes[i].isHca) continue;
+    if (((nodes[i].lid + 1) << lmc) - 1 >= mcLidBase) {
+      cerr << "-E- HCA " << nodes[i].name << " LID " << nodes[i].lid
+           << " with lmc " << lmc << " exceeds the unicast LID range (0x"
+           << hex << mcLidBase - 1 << dec << ")" << endl;
+      return 1;
+    }
+    nodes[i].lid <<= lmc;
+  }
+
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    if (nodes[i].isHca && ((nodes[i].ports.size() != 1) || (nodes[i].ports[0].node < 0))) {
+      cerr << "-E- HCA " << nodes[i].name << " must have exactly port 1 connected" << endl;
+      return 1;
+    }
+  }
+
+  if (!rankByLevel)
+    return 0;
+
+  // level of each switch by BFS from the HCAs: rank = max level - level
+  vector<int> level(nodes.size(), -1);
+  vector<int> q;
+  for (unsigned int i = 0; i < nodes.size(); i++)
+    if (nodes[i].isHca) { level[i] = 0; q.push_back(i); }
+  int maxLevel = 0;
+  for (unsigned int qi = 0; qi < q.size(); qi++) {
+    Node &n = nodes[q[qi]];
+    for (unsigned int p = 0; p < n.ports.size(); p++) {
+      int r = n.ports[p].node;
+      if ((r >= 0) && (level[r] < 0)) {
+        level[r] = level[q[qi]] + 1;
+        maxLevel = max(maxLevel, level[r]);
+        q.push_back(r);
+      }
+    }
+  }
+  for (unsigned int i = 0; i < nodes.size(); i++)
+    if (!nodes[i].isHca) nodes[i].rank = maxLevel - level[i];
+  return 0;
+}
+
+string
+nedName(const string &name)
+{
+  string s = name;
+  replace(s.begin(), s.end(), '-', '_');
+  return s + "_U1";
+}
+
+// switches sorted by NED name - their index in the fdbs file
+vector<int> switches;
+int maxLid = 0;
+vector<vector<unsigned char> > fdbs;
+
+// route all LIDs of the HCAs connected to the given leaf switches
+void
+routeLeafs(const vector<int> &leafs, const vector<vector<int> > &hcasByLeaf,
+           const vector<int> &swIdx)
+{
+  vector<int> dist(nodes.size());
+  vector<int> q;
+  for (unsigned int li = 0; li < leafs.size(); li++) {
+    int leaf = leafs[li];
+    fill(dist.begin(), dist.end(), -1);
+    q.clear();
+    dist[leaf] = 0;
+    q.push_back(leaf);
+    for (unsigned int qi = 0; qi < q.size(); qi++) {
+      Node &n = nodes[q[qi]];
+      for (unsigned int p = 0; p < n.ports.size(); p++) {
+        int r = n.ports[p].node;
+        if ((r >= 0) && !nodes[r].isHca && (dist[r] < 0)) {
+          dist[r] = dist[q[qi]] + 1;
+          q.push_back(r);
+        }
+      }
+    }
+
+    vector<int> cands;
+    for (unsigned int s = 0; s < switches.size(); s++) {
+      int sw = switches[s];
+      if (dist[sw] < 0) continue;
+      Node &n = nodes[sw];
+      cands.clear();
+      if (sw != leaf) {
+        for (unsigned int p = 0; p < n.ports.size(); p++) {
+          int r = n.ports[p].node;
+          if ((r >= 0) && !nodes[r].isHca && (dist[r] == dist[sw] - 1))
+            cands.push_back(p);
+        }
+      }
+      const vector<int> &hcas = hcasByLeaf[swIdx[leaf]];
+      for (unsigned int h = 0; h < hcas.size(); h++) {
+        int baseLid = nodes[hcas[h]].lid;
+        for (int lid = baseLid; lid < baseLid + (1 << lmc); lid++) {
+          if (sw == leaf)
+            fdbs[s][lid] = nodes[hcas[h]].ports[0].port;
+          else
+            fdbs[s][lid] = cands[lid % cands.size()];
+        }
+      }
+    }
+  }
+}
+
+void
+route(int numThreads)
+{
+  vector<int> swIdx(nodes.size(), -1);
+  for (unsigned int s = 0; s < switches.size(); s++)
+    swIdx[switches[s]] = s;
+  for (unsigned int i = 0; i < nodes.size(); i++)
+    if (nodes[i].isHca) maxLid = max(maxLid, nodes[i].lid + (1 << lmc) - 1);
+  fdbs.assign(switches.size(), vector<unsigned char>(maxLid + 1, 255));
+
+  // the HCAs by their leaf switch
+  vector<vector<int> > hcasByLeaf(switches.size());
+  vector<int> leafs;
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    if (!nodes[i].isHca) continue;
+    int leaf = nodes[i].ports[0].node;
+    if (hcasByLeaf[swIdx[leaf]].empty())
+      leafs.push_back(leaf);
+    hcasByLeaf[swIdx[leaf]].push_back(i);
+  }
+
+  // each thread routes a slice of the leafs - it writes its own LIDs only
+  vector<vector<int> > slices(numThreads);
+  for (unsigned int l = 0; l < leafs.size(); l++)
+    slices[l % numThreads].push_back(leafs[l]);
+  vector<thread> threads;
+  for (int t = 0; t < numThreads; t++)
+    threads.push_back(thread(routeLeafs, cref(slices[t]), cref(hcasByLeaf), cref(swIdx)));
+  for (int t = 0; t < numThreads; t++)
+    threads[t].join();
+}
+
+bool
+byNedName(int a, int b)
+{
+  return nedName(nodes[a].name) < nedName(nodes[b].name);
+}
+
+bool
+byLid(int a, int b)
+{
+  return nodes[a].lid < nodes[b].lid;
+}
+
+int
+writeFiles(const string &name, const string &pkg, bool writeTopo)
+{
+  vector<int> hcas;
+  for (unsigned int i = 0; i < nodes.size(); i++)
+    if (nodes[i].isHca) hcas.push_back(i);
+  sort(hcas.begin(), hcas.end(), byNedName);
+
+  // NED
+  ofstream ned((name + ".ned").c_str());
+  ned << "package " << pkg << ";\n\nimport ib_model.*;\n\nnetwork " << name
+      << "\n{\n\tsubmodules:\n"
+      << "\t\tcheckpoint: IBCheckpoint;\n\t\tsteadyState: IBSteadyState;\n"
+      << "\t\tprofiler: IBProfiler;\n\t\tfailures: IBFailures;\n";
+  for (unsigned int i = 0; i < hcas.size(); i++)
+    ned << "\t\t" << nedName(nodes[hcas[i]].name)
+        << ": HCA { parameters: srcLid = " << nodes[hcas[i]].lid
+        << (lmc ? "; lmc = " + to_string(lmc) : string()) << "; }\n";
+  for (unsigned int s = 0; s < switches.size(); s++) {
+    int np = nodes[switches[s]].ports.size();
+    ned << "\t\t" << nedName(nodes[switches[s]].name) << ": Switch {\n"
+        << "\t\tparameters: numSwitchPorts = " << np << ";\n"
+        << "\t\t\tgates: port[" << np << "];\n\t\t}\n";
+  }
+  ned << "\tconnections:\n";
+  vector<string> conns;
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    Node &n = nodes[i];
+    for (unsigned int p = 0; p < n.ports.size(); p++) {
+      int r = n.ports[p].node;
+      if (r < 0) continue;
+      Node &rn = nodes[r];
+      // once per link - the HCA or the lower (name, port) side
+      if (!n.isHca && (rn.isHca || (rn.name < n.name) ||
+                       ((rn.name == n.name) && (n.ports[p].port < (int)p))))
+        continue;
+      stringstream c;
+      c << "\t\t" << nedName(n.name) << ".port";
+      if (!n.isHca) c << "[" << p << "]";
+      c << " <--> " << n.wires[p] << " <--> " << nedName(rn.name) << ".port";
+      if (!rn.isHca) c << "[" << n.ports[p].port << "]";
+      c << ";\n";
+      conns.push_back(c.str());
+    }
+  }
+  sort(conns.begin(), conns.end());
+  for (unsigned int c = 0; c < conns.size(); c++)
+    ned << conns[c];
+  ned << "}\n";
+  ned.close();
+
+  // FDBs - the vector file lines are limited so we split long ones
+  ofstream fdb((name + ".fdbs").c_str());
+  for (unsigned int s = 0; s < switches.size(); s++) {
+    for (int lid = 0; lid <= maxLid; lid++) {
+      if (lid % 200 == 0) {
+        if (lid) fdb << "\n";
+        fdb << s << ":";
+      }
+      fdb << " " << (int)fdbs[s][lid];
+    }
+    fdb << "\n";
+  }
+  fdb.close();
+
+  ofstream fdbIni((name + ".fdbs.ini").c_str());
+  ofstream rankIni((name + ".rank.ini").c_str());
+  fdbIni << "[General]\n";
+  rankIni << "[General]\n";
+  for (unsigned int s = 0; s < switches.size(); s++) {
+    string sw = nedName(nodes[switches[s]].name);
+    fdbIni << "**." << sw << ".pktfwd.fdbIndex = " << s << "\n";
+    rankIni << "**." << sw << ".pktfwd.rank = " << nodes[switches[s]].rank << "\n";
+  }
+  fdbIni.close();
+  rankIni.close();
+
+  ofstream hcasFile("ftree.hcas");
+  sort(hcas.begin(), hcas.end(), byLid);
+  for (unsigned int i = 0; i < hcas.size(); i++)
+    hcasFile << nodes[hcas[i]].name << "/U1/1 " << nodes[hcas[i]].lid << "\n";
+  hcasFile.close();
+
+  if (writeTopo) {
+    ofstream topo((name + ".topo").c_str());
+    for (unsigned int s = 0; s < switches.size(); s++) {
+      Node &n = nodes[switches[s]];
+      topo << n.sysType << n.ports.size() << " " << n.name << "\n";
+      for (unsigned int p = 0; p < n.ports.size(); p++) {
+        int r = n.ports[p].node;
+        if (r < 0) continue;
+        Node &rn = nodes[r];
+        topo << "   P" << p + 1 << " -> "
+             << (rn.isHca ? rn.sysType : rn.sysType + to_string(rn.ports.size()))
+             << " " << rn.name << " P" << n.ports[p].port + 1 << "\n";
+      }
+      topo << "\n";
+    }
+  }
+  return 0;
+}
+
+void
+usage(const char *prog)
+{
+  cerr << "Usage: " << prog << " [-j threads] [-w wire] [-l meters] [-c hcaTypes] [-k package] [-m lmc]\n"
+       << "          <name> <file.topo | PGFT(h;m1,..;w1,..;p1,..) | DF(a,p,h,g)>\n"
+       << "Generates <name>.ned, .fdbs, .fdbs.ini, .rank.ini and ftree.hcas with\n"
+       << "min-hop routes. hcaTypes is a comma separated list of the topo HCA\n"
+       << "system types (default Cougar,Cheetah,HCA). meters is the cable\n"
+       << "length of links that do not specify one (default 0). lmc gives each\n"
+       << "HCA 2^lmc routed LIDs (default 0)." << endl;
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  int numThreads = thread::hardware_concurrency();
+  const char *hcaTypesStr = "Cougar,Cheetah,HCA";
+  string pkg;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:w:l:c:k:m:h")) != -1) {
+    switch (opt) {
+    case 'j': numThreads = atoi(optarg); break;
+    case 'w': wireType = optarg; break;
+    case 'l': cableLength = atof(optarg); break;
+    case 'c': hcaTypesStr = optarg; break;
+    case 'k': pkg = optarg; break;
+    case 'm': lmc = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2) usage(argv[0]);
+  if (numThreads < 1) numThreads = 1;
+  if ((lmc < 0) || (lmc > 7)) {
+    cerr << "-E- lmc must be 0-7" << endl;
+    return 1;
+  }
+  string name = argv[optind];
+  const char *src = argv[optind + 1];
+  if (pkg.empty()) pkg = "ib_model.examples." + name;
+
+  stringstream hts(hcaTypesStr);
+  string ht;
+  while (getline(hts, ht, ',')) hcaTypes.insert(ht);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  bool parametric = false;
+  int res;
+  if (!strncmp(src, "PGFT(", 5)) {
+    parametric = true;
+    res = buildPGFT(src);
+  } else if (!strncmp(src, "DF(", 3)) {
+    parametric = true;
+    res = buildDF(src);
+  } else {
+    res = parseTopo(src);
+  }
+  if (res || assignLidsAndRanks(!!strncmp(src, "DF(", 3)))
+    return 1;
+
+  for (unsigned int i = 0; i < nodes.size(); i++)
+    if (!nodes[i].isHca) switches.push_back(i);
+  sort(switches.begin(), switches.end(), byNedName);
+  for (unsigned int s = 0; s < switches.size(); s++) {
+    if (nodes[switches[s]].ports.size() > 254) {
+      cerr << "-E- switch " << nodes[switches[s]].name << " has more than 254 ports" << endl;
+      return 1;
+    }
+  }
+
+  chrono::steady_clock::time_point built = chrono::steady_clock::now();
+  route(numThreads);
+  chrono::steady_clock::time_point routed = chrono::steady_clock::now();
+  writeFiles(name, pkg, parametric);
+  chrono::steady_clock::time_point written = chrono::steady_clock::now();
+
+  cerr << "-I- " << nodes.size() - switches.size() << " HCAs " << switches.size()
+       << " switches. build: "
+       << chrono::duration<double>(built - start).count() << "s route ("
+       << numThreads << " threads): "
+       << chrono::duration<double>(routed - built).count() << "s write: "
+       << chrono::duration<double>(written - routed).count() << "s" << endl;
+  return 0;
+}
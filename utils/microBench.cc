@@ -0,0 +1,159 @@
+// Micro benchmarks of the simulator kernels that do not require the
+// simulation kernel: the vector file parser and the message size alias
+// sampling. The module kernels (VLArb, InBuf, OutBuf, Pktfwd and Sink)
+// are driven inside a simulation by the IBMicroBench module - see
+// examples/microbench.
+//
+// Usage: microBench [benchmark flags] [fdbs file]
+// The fdbs file defaults to the 1944 nodes example FDBs found relative to
+// the microBench binary.
+// Every benchmark reports ns/op and allocs/op (operator new calls).
+
+#include <benchmark/benchmark.h>
+#include <vec_file.h>
+#include <size_dist.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <new>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+
+using namespace std;
+
+// count every allocation so we can report allocs/op. The operators are
+// not inlined such that the compiler pairs new and delete expressions
+// with them and not with malloc and free (-Wmismatched-new-delete)
+static unsigned long long numAllocs = 0;
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+  numAllocs++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) throw()
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) throw()
+{
+  free(p);
+}
+
+static string fdbsFile;
+
+// the 1944 nodes example FDBs relative to the directory of the binary
+static string getDefaultFdbsFile(const char *argv0)
+{
+  string path = argv0;
+  char exe[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (len > 0) {
+    exe[len] = '\0';
+    path = exe;
+  }
+  size_t slash = path.rfind('/');
+  string dir = (slash == string::npos) ? string(".") : path.substr(0, slash);
+  return dir + "/../examples/is4_3l_1944n/is4_3l_1944n.fdbs";
+}
+
+// the parser reports every parsed file on cout - keep the output clean
+class coutSilencer {
+  streambuf *orig;
+  ostringstream null;
+ public:
+  coutSilencer() { orig = cout.rdbuf(null.rdbuf()); };
+  ~coutSilencer() { cout.rdbuf(orig); };
+};
+
+static void setAllocsCounter(benchmark::State &state, unsigned long long start)
+{
+  state.counters["allocs/op"] =
+    benchmark::Counter(numAllocs - start, benchmark::Counter::kAvgIterations);
+}
+
+// parse the entire fdbs file as done by the first Pktfwd
+static void BM_VecFileParse(benchmark::State &state)
+{
+  coutSilencer silence;
+  unsigned long long start = numAllocs;
+  for (auto _ : state) {
+    vecFile vf;
+    if (vf.parse(fdbsFile, 1)) {
+      state.SkipWithError("failed to parse the fdbs file");
+      break;
+    }
+    benchmark::DoNotOptimize(vf.getIntVec(0));
+  }
+  setAllocsCounter(state, start);
+}
+BENCHMARK(BM_VecFileParse)->Unit(benchmark::kMillisecond);
+
+// obtain the FDB of a switch by file name and index as every Pktfwd does
+static void BM_VecFilesGetIntVec(benchmark::State &state)
+{
+  coutSilencer silence;
+  vecFiles *vecMgr = vecFiles::get();
+  if (!vecMgr->getIntVec(fdbsFile, 0)) {
+    state.SkipWithError("failed to parse the fdbs file");
+    return;
+  }
+  int idx = 0;
+  unsigned long long start = numAllocs;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(vecMgr->getIntVec(fdbsFile, idx));
+    idx = (idx + 1) % state.range(0);
+  }
+  setAllocsCounter(state, start);
+}
+BENCHMARK(BM_VecFilesGetIntVec)->Arg(1)->Arg(648);
+
+// alias sampling of a message size distribution with N buckets
+static void BM_SizeDistSample(benchmark::State &state)
+{
+  ostringstream sizes, weights;
+  for (int i = 0; i < state.range(0); i++) {
+    sizes << 64 * (i + 1) << "-" << 64 * (i + 2) - 1 << " ";
+    weights << 1 + i % 7 << " ";
+  }
+  sizeDist dist;
+  if (dist.parseSet(sizes.str(), weights.str())) {
+    state.SkipWithError(dist.getError().c_str());
+    return;
+  }
+
+  // pre-generate the uniforms so we only measure the sampling
+  vector<double> u(4096);
+  srand(1);
+  for (unsigned int i = 0; i < u.size(); i++)
+    u[i] = rand() / (RAND_MAX + 1.0);
+
+  unsigned int i = 0;
+  unsigned long long start = numAllocs;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(dist.sample(u[i & 4095], u[(i + 1) & 4095]));
+    i += 2;
+  }
+  setAllocsCounter(state, start);
+}
+BENCHMARK(BM_SizeDistSample)->Arg(4)->Arg(1024)->Arg(65536);
+
+int main(int argc, char **argv)
+{
+  benchmark::Initialize(&argc, argv);
+  if (argc > 2) {
+    cerr << "Usage: " << argv[0] << " [benchmark flags] [fdbs file]" << endl;
+    return 1;
+  }
+  fdbsFile = (argc == 2) ? argv[1] : getDefaultFdbsFile(argv[0]);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}